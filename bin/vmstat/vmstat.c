@@ -0,0 +1,138 @@
+#include <sys/types.h>
+#include <sys/vmstat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+/*
+ * vmstat - report memory and paging statistics.
+ * Usage: vmstat [-p pid] [interval [count]]
+ *    -p   Report on process PID instead of the whole system.
+ *
+ * The first line has the counts since boot (or since the process
+ * started). Given an interval, another line follows every that many
+ * seconds with what happened in between, COUNT lines in all (default
+ * 10). There's no way to sleep, so it spins on the clock meanwhile;
+ * that keeps the CPU busy, but doesn't show up as paging.
+ *
+ * Columns: free, resident and swapped-out pages (as of that moment),
+ * then TLB misses, minor and major faults, pages swapped in and out,
+ * pages read from files and zero-filled pages.
+ */
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: vmstat [-p pid] [interval [count]]");
+}
+
+static
+void
+header(void)
+{
+	printf("%6s %6s %6s %8s %7s %7s %6s %6s %6s %6s\n",
+	       "free", "res", "swap", "tlbmiss", "minflt", "majflt",
+	       "si", "so", "fread", "zero");
+}
+
+/*
+ * Print NOW, with the counters relative to BEFORE.
+ */
+static
+void
+show(const struct vmstat *now, const struct vmstat *before)
+{
+	printf("%6u %6u %6u %8u %7u %7u %6u %6u %6u %6u\n",
+	       now->vs_freepages, now->vs_resident, now->vs_swapped,
+	       now->vs_tlbmisses - before->vs_tlbmisses,
+	       now->vs_minflt - before->vs_minflt,
+	       now->vs_majflt - before->vs_majflt,
+	       now->vs_swapins - before->vs_swapins,
+	       now->vs_swapouts - before->vs_swapouts,
+	       now->vs_filereads - before->vs_filereads,
+	       now->vs_zerofills - before->vs_zerofills);
+}
+
+/*
+ * Spin until the clock reads SECS seconds and NSECS nanoseconds.
+ */
+static
+void
+waituntil(time_t secs, unsigned long nsecs)
+{
+	time_t s;
+	unsigned long ns;
+
+	do {
+		__time(&s, &ns);
+	} while (s < secs || (s == secs && ns < nsecs));
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct vmstat before, now;
+	pid_t pid = 0;
+	int interval = 0, count = 10;
+	int i;
+	time_t start;
+	unsigned long startns;
+
+	i = 1;
+	if (i < argc && !strcmp(argv[i], "-p")) {
+		if (i + 1 >= argc) {
+			usage();
+		}
+		pid = atoi(argv[i+1]);
+		if (pid <= 0) {
+			usage();
+		}
+		i += 2;
+	}
+	if (i < argc) {
+		interval = atoi(argv[i++]);
+		if (interval <= 0) {
+			usage();
+		}
+	}
+	if (i < argc) {
+		count = atoi(argv[i++]);
+		if (count <= 0) {
+			usage();
+		}
+	}
+	if (i < argc) {
+		usage();
+	}
+
+	if (getvmstat(pid, &now)) {
+		err(1, "getvmstat");
+	}
+	__time(&start, &startns);
+
+	if (pid) {
+		printf("Process %d", pid);
+	}
+	else {
+		printf("System");
+	}
+	printf(": %u pages, %uk\n", now.vs_totalpages, now.vs_totalpages * 4);
+	header();
+
+	bzero(&before, sizeof(before));
+	show(&now, &before);
+
+	for (i = 1; interval > 0 && i < count; i++) {
+		before = now;
+		waituntil(start + i * interval, startns);
+		if (getvmstat(pid, &now)) {
+			err(1, "getvmstat");
+		}
+		show(&now, &before);
+	}
+
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _SYS_VMSTAT_H_
+#define _SYS_VMSTAT_H_
+
+/*
+ * Get struct vmstat from the kernel
+ */
+#include <kern/vmstat.h>
+
+/*
+ * Fill in BUF with the memory and paging statistics of process PID,
+ * or of the whole system if PID is 0.
+ */
+int getvmstat(pid_t pid, struct vmstat *buf);
+
+#endif /* _SYS_VMSTAT_H_ */
@@ -11,6 +11,9 @@
 #include <kern/unistd.h>
 #include <kern/ioctl.h>
 
+/* What mmap returns on failure */
+#define MAP_FAILED	((void *) -1)
+
 
 /*
  * Prototypes for OS/161 system calls.
@@ -120,6 +123,9 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -20,6 +20,11 @@
  *        was found. ENTRYLO is not actually used, but must be set; 0
  *        should be passed.
  *
+ *   TLB_SetPID: make PID the current address space ID. Only entries
+ *        tagged with it (or global ones) will match from then on.
+ *
+ *        The functions above all leave the current PID alone.
+ *
  *        IMPORTANT NOTE: An entry may be matching even if the valid bit 
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
@@ -30,14 +35,17 @@ void TLB_Random(u_int32_t entryhi, u_int32_t entrylo);
 void TLB_Write(u_int32_t entryhi, u_int32_t entrylo, u_int32_t index);
 void TLB_Read(u_int32_t *entryhi, u_int32_t *entrylo, u_int32_t index);
 int TLB_Probe(u_int32_t entryhi, u_int32_t entrylo);
+void TLB_SetPID(u_int32_t pid);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID). Each
+ * address space gets one (see as_activate), so entries don't have to
+ * be flushed on every context switch. TLBLO_GLOBAL, which makes an
+ * entry match whatever the ID, is only set on entries for kseg2 (see
+ * kva_fault), which is the same in every address space. The bits that
+ * aren't assigned a meaning are left always zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -49,14 +57,15 @@ int TLB_Probe(u_int32_t entryhi, u_int32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PID_SHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
 #define TLBLO_NOCACHE 0x00000800
 #define TLBLO_DIRTY   0x00000400
 #define TLBLO_VALID   0x00000200
-/*      TLBLO_GLOBAL  0x00000100 */
+#define TLBLO_GLOBAL  0x00000100
 
 /*
  * Values for completely invalid TLB entries. The TLB entry index should
@@ -72,5 +81,11 @@ int TLB_Probe(u_int32_t entryhi, u_int32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of address space IDs.
+ */
+
+#define NUM_TLB_PID  64
+
 
 #endif /* _MACHINE_TLB_H_ */
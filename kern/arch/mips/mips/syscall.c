@@ -34,9 +34,9 @@
  * return code will restart the "syscall" instruction and the system
  * call will repeat forever.
  *
- * Since none of the OS/161 system calls have more than 4 arguments,
- * there should be no need to fetch additional arguments from the
- * user-level stack.
+ * Apart from mmap, none of the OS/161 system calls have more than 4
+ * arguments, so there's no need to fetch additional arguments from
+ * the user-level stack. (sys_mmap() does so for its last two.)
  *
  * Watch out: if you make system calls that have 64-bit quantities as
  * arguments, they will get passed in pairs of registers, and not
@@ -171,6 +171,26 @@ mips_syscall(struct trapframe *tf)
 		err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
 		break;
 
+	    case SYS___time:
+		err = sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1, &retval);
+		break;
+
+	    case SYS_mmap:
+		err = sys_mmap(tf, &retval);
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((void *)tf->tf_a0, tf->tf_a1, &retval);
+		break;
+
+	    case SYS_msync:
+		err = sys_msync((void *)tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
+		break;
+
+	    case SYS_getvmstat:
+		err = sys_getvmstat(tf->tf_a0, (userptr_t)tf->tf_a1, &retval);
+		break;
+
 	    /* Add stuff here */
  
 	    default:
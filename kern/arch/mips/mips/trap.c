@@ -117,16 +117,20 @@ mips_trap(struct trapframe *tf)
 	 */
 	switch (code) {
 	case EX_MOD:
+		vmstats.tlb_modify_faults++;
 		if (vm_fault(VM_FAULT_READONLY, tf->tf_vaddr)==0) {
 			goto done;
 		}
 		break;
 	case EX_TLBL:
+		/* UTLB misses the refill handler couldn't deal with end up here too */
+		vmstats.tlb_slow_misses++;
 		if (vm_fault(VM_FAULT_READ, tf->tf_vaddr)==0) {
 			goto done;
 		}
 		break;
 	case EX_TLBS:
+		vmstats.tlb_slow_misses++;
 		if (vm_fault(VM_FAULT_WRITE, tf->tf_vaddr)==0) {
 			goto done;
 		}
@@ -673,6 +673,21 @@ emufs_fsync(struct vnode *v)
 	return 0;
 }
 
+/*
+ * VOP_MMAP
+ *
+ * The VM system reads and writes mapped pages with VOP_READ and
+ * VOP_WRITE, so any file will do. (Each open gets its own vnode,
+ * though, so separate opens of the same file don't share pages.)
+ */
+static
+int
+emufs_mmap(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
 /*
  * VOP_TRUNCATE
  */
@@ -853,7 +868,7 @@ static const struct vnode_ops emufs_fileops = {
 	emufs_file_gettype,
 	emufs_tryseek,
 	emufs_fsync,
-	UNIMP,   /* mmap */
+	emufs_mmap,
 	emufs_truncate,
 	NOTDIR,  /* namefile */
 
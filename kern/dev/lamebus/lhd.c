@@ -196,12 +196,16 @@ lhd_io(struct device *d, struct uio *uio)
 		statval |= LHD_ISWRITE;
 	}
 
+	/*
+	 * Wait until nobody else is using the device, and keep it for the
+	 * whole request, so that a multi-sector transfer (a cluster of
+	 * swap pages, say) goes through in order without seeking away.
+	 */
+	P(lh->lh_clear);
+
 	/* Loop over all the sectors we were asked to do. */
 	for (i=0; i<len; i++) {
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
 		/*
 		 * Are we writing? If so, transfer the data to the
 		 * on-card buffer.
@@ -234,15 +238,16 @@ lhd_io(struct device *d, struct uio *uio)
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
 		/* If we failed, return the error. */
 		if (result) {
+			V(lh->lh_clear);
 			return result;
 		}
 	}
 
+	/* Tell another thread it's cleared to go ahead. */
+	V(lh->lh_clear);
+
 	return 0;
 }
 
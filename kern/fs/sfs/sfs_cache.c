@@ -0,0 +1,786 @@
+/*
+ * SFS filesystem
+ *
+ * Buffer cache.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <uio.h>
+#include <vm.h>
+#include <sfs.h>
+
+/*
+ * Blocks of every mounted SFS, hashed by device and block number.
+ * Inodes, indirect blocks and the parts of file blocks that partial
+ * reads and writes touch are kept here rather than going straight to
+ * the disk: a block is read once and then found again, and changes to
+ * it are written back when its buffer is reused, at fsync() or sync, or
+ * at unmount. A run of small writes to a block costs one disk write
+ * instead of a read and a write each.
+ *
+ * A buffer that's been handed out is busy: it's its holder's alone
+ * until sfs_brelse(), and anyone else who wants it waits. The rest are
+ * on the LRU list, most recently released first; the clean one nearest
+ * the end is reused when a block needs a buffer and there's no room
+ * for another (the one at the very end, written back first, if they're
+ * all dirty).
+ *
+ * Dirty blocks are written back in clusters: a block goes along with
+ * the dirty ones that follow it on disk, in one request. While that's
+ * happening the ones that went along are busy too, but stay where they
+ * were on the LRU list.
+ *
+ * Read-ahead requests from sfs_io() are queued for the read-ahead
+ * thread, which gives each block of a run a buffer and then reads the
+ * run in one request. Anyone who wants one of those blocks meanwhile
+ * waits for it, as for any busy buffer.
+ *
+ * How many there may be is set from the size of memory at the first
+ * mount. The cache also stops growing, and hands clean buffers back,
+ * while the VM is short of free pages.
+ *
+ * buf_lock protects the hash table, the LRU list, buf_count, the
+ * read-ahead queue and the fields of buffers that aren't busy. It isn't
+ * held during disk I/O or while allocating memory, which might write an
+ * mmap()ed page back to its file through here. cluster_lock protects
+ * cluster_buf, which clustered writes are gathered into.
+ */
+static struct lock *buf_lock;
+static struct cv *buf_cv;		/* signalled when a buffer is released */
+static struct sfs_buf *buf_hash[SFS_CACHE_BUCKETS];
+static struct sfs_buf *lru_head, *lru_tail;
+static u_int32_t buf_count, buf_max;
+static struct lock *cluster_lock;
+static char cluster_buf[SFS_CLUSTER * SFS_BLOCKSIZE];
+
+/*
+ * Read-ahead queue, and the filesystem whose run the thread is reading
+ * in (so unmount can wait for it). Requests that don't fit are dropped.
+ */
+#define RA_QUEUE	8
+static struct {
+	struct sfs_fs *sfs;
+	u_int32_t block, n;
+} ra_queue[RA_QUEUE];
+static unsigned ra_head, ra_count;
+static struct sfs_fs *ra_active;
+static struct cv *ra_cv;		/* signalled when a request is queued */
+static char ra_buf[SFS_CLUSTER * SFS_BLOCKSIZE];
+
+/* Most clean buffers handed back to the VM per miss while memory's low */
+#define BUF_SHRINK	8
+
+/* How buf_get() treats a block that isn't cached */
+#define BUF_READ	0	/* read it in */
+#define BUF_ZERO	1	/* zero it */
+#define BUF_PEEK	2	/* leave it */
+
+static struct kmem_cache buf_cache =
+	KMEM_CACHE_INITIALIZER("sfs_buf", sizeof(struct sfs_buf));
+static struct kmem_cache bufdata_cache =
+	KMEM_CACHE_INITIALIZER("sfs_bufdata", SFS_BLOCKSIZE);
+
+static struct {
+	u_int32_t hits;		/* lookups that found the block cached */
+	u_int32_t misses;	/* ...and that didn't */
+	u_int32_t reads;	/* blocks read from disk */
+	u_int32_t writes;	/* dirty blocks written to disk */
+	u_int32_t clustered;	/* ...along with another block */
+	u_int32_t ra_runs;	/* read-ahead requests read */
+	u_int32_t ra_blocks;	/* blocks they brought in */
+	u_int32_t ra_dropped;	/* requests dropped (queue full) */
+	u_int32_t reuses;	/* buffers taken from one block for another */
+	u_int32_t shrinks;	/* buffers freed because memory was low */
+	u_int32_t waits;	/* waits for a busy buffer */
+} bufstats;
+
+static void readahead_thread(void *, unsigned long);
+
+int
+sfs_cache_bootstrap(void)
+{
+	int result;
+
+	if (buf_lock != NULL) {
+		return 0;
+	}
+
+	buf_lock = lock_create("sfs buffer cache");
+	buf_cv = cv_create("sfs buffers");
+	ra_cv = cv_create("sfs read-ahead");
+	cluster_lock = lock_create("sfs write cluster");
+	if (buf_lock == NULL || buf_cv == NULL || ra_cv == NULL ||
+	    cluster_lock == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	result = thread_fork("sfs read-ahead", NULL, 0, readahead_thread, NULL);
+	if (result) {
+		goto fail;
+	}
+
+	buf_max = vm_user_pages() / SFS_CACHE_DIV * (PAGE_SIZE / SFS_BLOCKSIZE);
+	if (buf_max < SFS_CACHE_MIN) {
+		buf_max = SFS_CACHE_MIN;
+	}
+	return 0;
+
+ fail:
+	if (buf_lock != NULL) lock_destroy(buf_lock);
+	if (buf_cv != NULL) cv_destroy(buf_cv);
+	if (ra_cv != NULL) cv_destroy(ra_cv);
+	if (cluster_lock != NULL) lock_destroy(cluster_lock);
+	buf_lock = cluster_lock = NULL;
+	buf_cv = ra_cv = NULL;
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Hash table and LRU list. Callers hold buf_lock.
+
+static
+unsigned
+buf_bucket(struct device *dev, u_int32_t block)
+{
+	return (((u_int32_t) dev >> 4) ^ block) % SFS_CACHE_BUCKETS;
+}
+
+static
+struct sfs_buf *
+buf_lookup(struct device *dev, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = buf_hash[buf_bucket(dev, block)]; b != NULL; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buf_unhash(struct sfs_buf *b)
+{
+	struct sfs_buf **p;
+
+	for (p = &buf_hash[buf_bucket(b->b_dev, b->b_block)]; *p != NULL;
+	     p = &(*p)->b_hashnext) {
+		if (*p == b) {
+			*p = b->b_hashnext;
+			b->b_hashnext = NULL;
+			return;
+		}
+	}
+	panic("sfs: buffer for block %u not in hash table\n", b->b_block);
+}
+
+static
+void
+lru_remove(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) b->b_lruprev->b_lrunext = b->b_lrunext;
+	else lru_head = b->b_lrunext;
+	if (b->b_lrunext != NULL) b->b_lrunext->b_lruprev = b->b_lruprev;
+	else lru_tail = b->b_lruprev;
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+lru_add(struct sfs_buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = lru_head;
+	if (lru_head != NULL) lru_head->b_lruprev = b;
+	else lru_tail = b;
+	lru_head = b;
+}
+
+/* Free a buffer that's in neither the hash table nor the LRU list */
+static
+void
+buf_destroy(struct sfs_buf *b)
+{
+	kmem_cache_free(&bufdata_cache, b->b_data);
+	kmem_cache_free(&buf_cache, b);
+	buf_count--;
+}
+
+/*
+ * Give some clean buffers from the old end of the LRU list back to the
+ * VM, keeping at least SFS_CACHE_MIN.
+ */
+static
+void
+buf_shrink(void)
+{
+	struct sfs_buf *b, *prev;
+	int n = 0;
+
+	for (b = lru_tail; b != NULL && n < BUF_SHRINK; b = prev) {
+		prev = b->b_lruprev;
+		if (buf_count <= SFS_CACHE_MIN) {
+			break;
+		}
+		if (!b->b_dirty && !b->b_busy) {
+			lru_remove(b);
+			buf_unhash(b);
+			buf_destroy(b);
+			bufstats.shrinks++;
+			n++;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Getting and releasing buffers
+
+/*
+ * Write back B, which is busy and dirty, along with the dirty blocks
+ * that follow it on disk, up to SFS_CLUSTER in all, if they're cached
+ * and nobody's using them. buf_lock is held, and let go of during the
+ * write.
+ */
+static
+int
+buf_write(struct sfs_buf *b)
+{
+	struct sfs_buf *run[SFS_CLUSTER];
+	struct sfs_buf *next;
+	struct uio ku;
+	u_int32_t n, i;
+	int result;
+
+	assert(b->b_busy && b->b_valid && b->b_dirty);
+
+	run[0] = b;
+	for (n = 1; n < SFS_CLUSTER; n++) {
+		next = buf_lookup(b->b_dev, b->b_block + n);
+		if (next == NULL || next->b_busy || !next->b_dirty) {
+			break;
+		}
+		/* It stays on the LRU list */
+		next->b_busy = 1;
+		run[n] = next;
+	}
+	lock_release(buf_lock);
+
+	if (n == 1) {
+		result = sfs_wblock(b->b_sfs, b->b_data, b->b_block);
+	}
+	else {
+		lock_acquire(cluster_lock);
+		for (i = 0; i < n; i++) {
+			memcpy(cluster_buf + i * SFS_BLOCKSIZE, run[i]->b_data,
+			       SFS_BLOCKSIZE);
+		}
+		mk_kuio(&ku, cluster_buf, n * SFS_BLOCKSIZE,
+			((off_t) b->b_block) * SFS_BLOCKSIZE, UIO_WRITE);
+		result = sfs_rwblock(b->b_sfs, &ku);
+		lock_release(cluster_lock);
+	}
+
+	lock_acquire(buf_lock);
+	for (i = 0; i < n; i++) {
+		if (result == 0) {
+			run[i]->b_dirty = 0;
+		}
+		if (i > 0) {
+			run[i]->b_busy = 0;
+		}
+	}
+	if (n > 1) {
+		cv_broadcast(buf_cv, buf_lock);
+	}
+	if (result == 0) {
+		bufstats.writes += n;
+		bufstats.clustered += n - 1;
+	}
+	return result;
+}
+
+/*
+ * Find a buffer that isn't being used for a block: a new one if there's
+ * room (and memory), otherwise the least recently used, written back
+ * first if need be. It's handed back busy and out of the hash table.
+ * buf_lock is held, but is let go of along the way, so the caller has
+ * to check whether somebody cached the block it wants meanwhile.
+ */
+static
+int
+buf_new(struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	void *data;
+	int result;
+
+	if (vm_memory_low()) {
+		buf_shrink();
+	}
+	if (buf_count < buf_max && (buf_count < SFS_CACHE_MIN || !vm_memory_low())) {
+		/* Count it now so nobody else takes the room */
+		buf_count++;
+		lock_release(buf_lock);
+		b = kmem_cache_alloc(&buf_cache);
+		data = kmem_cache_alloc(&bufdata_cache);
+		lock_acquire(buf_lock);
+
+		if (b != NULL && data != NULL) {
+			bzero(b, sizeof(*b));
+			b->b_data = data;
+			b->b_busy = 1;
+			*ret = b;
+			return 0;
+		}
+		kmem_cache_free(&buf_cache, b);
+		kmem_cache_free(&bufdata_cache, data);
+		buf_count--;
+	}
+
+	for (;;) {
+		/* The clean one used longest ago, or failing that the oldest */
+		for (b = lru_tail; b != NULL && (b->b_dirty || b->b_busy);
+		     b = b->b_lruprev);
+		if (b == NULL) {
+			for (b = lru_tail; b != NULL && b->b_busy;
+			     b = b->b_lruprev);
+		}
+		if (b == NULL) {
+			/* They're all in use */
+			if (buf_count == 0) {
+				return ENOMEM;
+			}
+			bufstats.waits++;
+			cv_wait(buf_cv, buf_lock);
+			continue;
+		}
+
+		lru_remove(b);
+		b->b_busy = 1;
+		if (!b->b_dirty) {
+			break;
+		}
+
+		result = buf_write(b);
+		if (result) {
+			b->b_busy = 0;
+			lru_add(b);
+			cv_broadcast(buf_cv, buf_lock);
+			return result;
+		}
+		break;
+	}
+
+	buf_unhash(b);
+	b->b_valid = 0;
+	bufstats.reuses++;
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Hand back BLOCK of SFS, busy, finding it in the cache or giving it a
+ * buffer as HOW says.
+ */
+static
+int
+buf_get(struct sfs_fs *sfs, u_int32_t block, int how, struct sfs_buf **ret)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_buf *b, *spare = NULL;
+	int result;
+
+	assert(block < sfs->sfs_super.sp_nblocks);
+
+	lock_acquire(buf_lock);
+	for (;;) {
+		b = buf_lookup(dev, block);
+		if (b != NULL) {
+			if (b->b_busy) {
+				bufstats.waits++;
+				cv_wait(buf_cv, buf_lock);
+				continue;
+			}
+			lru_remove(b);
+			b->b_busy = 1;
+			bufstats.hits++;
+			break;
+		}
+
+		if (how == BUF_PEEK) {
+			lock_release(buf_lock);
+			*ret = NULL;
+			return 0;
+		}
+
+		if (spare == NULL) {
+			result = buf_new(&spare);
+			if (result) {
+				lock_release(buf_lock);
+				return result;
+			}
+			/* Look again; the lock may have been let go of */
+			continue;
+		}
+
+		b = spare;
+		spare = NULL;
+		b->b_sfs = sfs;
+		b->b_dev = dev;
+		b->b_block = block;
+		b->b_dirty = 0;
+		b->b_hashnext = buf_hash[buf_bucket(dev, block)];
+		buf_hash[buf_bucket(dev, block)] = b;
+		bufstats.misses++;
+		break;
+	}
+
+	if (spare != NULL) {
+		/* Somebody brought the block in while we found a buffer */
+		buf_destroy(spare);
+	}
+	lock_release(buf_lock);
+
+	/* A buffer that isn't valid yet was just given to the block */
+	if (!b->b_valid) {
+		if (how == BUF_READ) {
+			result = sfs_rblock(sfs, b->b_data, block);
+			if (result) {
+				lock_acquire(buf_lock);
+				buf_unhash(b);
+				buf_destroy(b);
+				cv_broadcast(buf_cv, buf_lock);
+				lock_release(buf_lock);
+				return result;
+			}
+			bufstats.reads++;
+		}
+		else {
+			bzero(b->b_data, SFS_BLOCKSIZE);
+		}
+		b->b_valid = 1;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+int
+sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	return buf_get(sfs, block, BUF_READ, ret);
+}
+
+int
+sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	return buf_get(sfs, block, BUF_ZERO, ret);
+}
+
+int
+sfs_bpeek(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	return buf_get(sfs, block, BUF_PEEK, ret);
+}
+
+void
+sfs_brelse(struct sfs_buf *b)
+{
+	lock_acquire(buf_lock);
+	assert(b->b_busy);
+	b->b_busy = 0;
+	lru_add(b);
+	cv_broadcast(buf_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+int
+sfs_bcached(struct sfs_fs *sfs, u_int32_t block)
+{
+	int ret;
+
+	lock_acquire(buf_lock);
+	ret = buf_lookup(sfs->sfs_device, block) != NULL;
+	lock_release(buf_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Read-ahead
+
+void
+sfs_breadahead(struct sfs_fs *sfs, u_int32_t block, u_int32_t n)
+{
+	unsigned i;
+
+	assert(n > 0 && n <= SFS_CLUSTER);
+
+	lock_acquire(buf_lock);
+	if (ra_count == RA_QUEUE) {
+		bufstats.ra_dropped++;
+	}
+	else {
+		i = (ra_head + ra_count) % RA_QUEUE;
+		ra_queue[i].sfs = sfs;
+		ra_queue[i].block = block;
+		ra_queue[i].n = n;
+		ra_count++;
+		cv_signal(ra_cv, buf_lock);
+	}
+	lock_release(buf_lock);
+}
+
+/*
+ * Read N blocks from BLOCK of SFS into the cache. The run stops short
+ * at the first block that's cached already. Called with buf_lock held.
+ */
+static
+void
+readahead_run(struct sfs_fs *sfs, u_int32_t block, u_int32_t n)
+{
+	struct sfs_buf *run[SFS_CLUSTER];
+	struct sfs_buf *b;
+	struct uio ku;
+	u_int32_t i, got;
+	int result;
+
+	/* Give each block a buffer, busy, so nobody reads it meanwhile */
+	for (got = 0; got < n; got++) {
+		if (buf_lookup(sfs->sfs_device, block + got) != NULL) {
+			break;
+		}
+		if (buf_new(&b)) {
+			break;
+		}
+		/* buf_new may have let go of the lock */
+		if (buf_lookup(sfs->sfs_device, block + got) != NULL) {
+			buf_destroy(b);
+			break;
+		}
+		b->b_sfs = sfs;
+		b->b_dev = sfs->sfs_device;
+		b->b_block = block + got;
+		b->b_dirty = 0;
+		b->b_hashnext = buf_hash[buf_bucket(b->b_dev, b->b_block)];
+		buf_hash[buf_bucket(b->b_dev, b->b_block)] = b;
+		run[got] = b;
+	}
+	if (got == 0) {
+		return;
+	}
+	lock_release(buf_lock);
+
+	mk_kuio(&ku, ra_buf, got * SFS_BLOCKSIZE,
+		((off_t) block) * SFS_BLOCKSIZE, UIO_READ);
+	result = sfs_rwblock(sfs, &ku);
+
+	lock_acquire(buf_lock);
+	for (i = 0; i < got; i++) {
+		b = run[i];
+		if (result) {
+			buf_unhash(b);
+			buf_destroy(b);
+			continue;
+		}
+		memcpy(b->b_data, ra_buf + i * SFS_BLOCKSIZE, SFS_BLOCKSIZE);
+		b->b_valid = 1;
+		b->b_busy = 0;
+		lru_add(b);
+	}
+	cv_broadcast(buf_cv, buf_lock);
+	if (result == 0) {
+		bufstats.ra_runs++;
+		bufstats.ra_blocks += got;
+	}
+}
+
+/*
+ * The read-ahead thread: reads in runs queued by sfs_breadahead(), in
+ * the order they were asked for.
+ */
+static
+void
+readahead_thread(void *unused, unsigned long unused2)
+{
+	struct sfs_fs *sfs;
+	u_int32_t block, n;
+
+	(void)unused;
+	(void)unused2;
+
+	lock_acquire(buf_lock);
+	for (;;) {
+		while (ra_count == 0) {
+			cv_wait(ra_cv, buf_lock);
+		}
+		sfs = ra_queue[ra_head].sfs;
+		block = ra_queue[ra_head].block;
+		n = ra_queue[ra_head].n;
+		ra_head = (ra_head + 1) % RA_QUEUE;
+		ra_count--;
+
+		ra_active = sfs;
+		readahead_run(sfs, block, n);
+		ra_active = NULL;
+		cv_broadcast(buf_cv, buf_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Whole-filesystem operations
+
+/*
+ * BLOCK has been freed; whatever's cached for it doesn't need writing.
+ * The caller mustn't have it.
+ */
+void
+sfs_binval(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	lock_acquire(buf_lock);
+	for (;;) {
+		b = buf_lookup(sfs->sfs_device, block);
+		if (b == NULL) {
+			break;
+		}
+		if (b->b_busy) {
+			bufstats.waits++;
+			cv_wait(buf_cv, buf_lock);
+			continue;
+		}
+		lru_remove(b);
+		buf_unhash(b);
+		buf_destroy(b);
+		break;
+	}
+	lock_release(buf_lock);
+}
+
+/*
+ * Write back the dirty blocks of SFS. Ones that are busy are being
+ * changed, and get written another time.
+ */
+int
+sfs_bflush(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	unsigned i;
+	int result;
+
+	lock_acquire(buf_lock);
+	for (i = 0; i < SFS_CACHE_BUCKETS; i++) {
+	 again:
+		for (b = buf_hash[i]; b != NULL; b = b->b_hashnext) {
+			if (b->b_dev != sfs->sfs_device || !b->b_dirty || b->b_busy) {
+				continue;
+			}
+
+			/* Like the blocks that go with it, it stays on the LRU list */
+			b->b_busy = 1;
+			result = buf_write(b);
+			b->b_busy = 0;
+			cv_broadcast(buf_cv, buf_lock);
+			if (result) {
+				lock_release(buf_lock);
+				return result;
+			}
+
+			/* The chain may have changed meanwhile */
+			goto again;
+		}
+	}
+	lock_release(buf_lock);
+	return 0;
+}
+
+/*
+ * Unmount: drop every buffer of SFS. They've all just been written
+ * back, and nobody can be using them.
+ */
+void
+sfs_bpurge(struct sfs_fs *sfs)
+{
+	struct sfs_buf **p, *b;
+	unsigned i, j, n;
+
+	lock_acquire(buf_lock);
+
+	/* Forget its read-ahead requests, and wait out the one being read */
+	n = ra_count;
+	ra_count = 0;
+	for (i = 0; i < n; i++) {
+		j = (ra_head + i) % RA_QUEUE;
+		if (ra_queue[j].sfs != sfs) {
+			ra_queue[(ra_head + ra_count++) % RA_QUEUE] = ra_queue[j];
+		}
+	}
+	while (ra_active == sfs) {
+		cv_wait(buf_cv, buf_lock);
+	}
+
+	for (i = 0; i < SFS_CACHE_BUCKETS; i++) {
+		p = &buf_hash[i];
+		while (*p != NULL) {
+			b = *p;
+			if (b->b_dev != sfs->sfs_device) {
+				p = &b->b_hashnext;
+				continue;
+			}
+			assert(!b->b_busy);
+			if (b->b_dirty) {
+				kprintf("sfs: unmount: block %u still dirty\n",
+					b->b_block);
+			}
+			*p = b->b_hashnext;
+			lru_remove(b);
+			buf_destroy(b);
+		}
+	}
+	lock_release(buf_lock);
+}
+
+void
+sfs_cache_printstats(void)
+{
+	struct sfs_buf *b;
+	u_int32_t lookups, idle = 0, dirty = 0;
+
+	if (buf_lock == NULL) {
+		kprintf("SFS buffer cache: no SFS has been mounted\n");
+		return;
+	}
+
+	lock_acquire(buf_lock);
+	for (b = lru_head; b != NULL; b = b->b_lrunext) {
+		idle++;
+		if (b->b_dirty) dirty++;
+	}
+	lookups = bufstats.hits + bufstats.misses;
+
+	kprintf("SFS buffer cache:\n");
+	kprintf("    buffers: %u of %u (%uk), %u in use, %u of the rest dirty\n",
+		buf_count, buf_max, buf_count * SFS_BLOCKSIZE / 1024,
+		buf_count - idle, dirty);
+	kprintf("    lookups: %u hits, %u misses (%u%% hit rate)\n",
+		bufstats.hits, bufstats.misses,
+		lookups ? bufstats.hits * 100 / lookups : 0);
+	kprintf("    disk: %u blocks read, %u written back (%u along with another)\n",
+		bufstats.reads, bufstats.writes, bufstats.clustered);
+	kprintf("    read-ahead: %u runs, %u blocks, %u requests dropped\n",
+		bufstats.ra_runs, bufstats.ra_blocks, bufstats.ra_dropped);
+	kprintf("    direct file I/O: %u requests, %u blocks\n",
+		sfs_iostats.requests, sfs_iostats.blocks);
+	kprintf("    buffers reused: %u, freed for the VM: %u, waits for busy buffers: %u\n",
+		bufstats.reuses, bufstats.shrinks, bufstats.waits);
+	lock_release(buf_lock);
+}
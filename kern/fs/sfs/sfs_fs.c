@@ -7,7 +7,6 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
-#include <array.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <dev.h>
@@ -83,7 +82,8 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
-	int i, num, result;
+	u_int32_t i;
+	int result;
 
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
@@ -117,11 +117,24 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv = array_getguy(sfs->sfs_vnodes, i);
-		VOP_FSYNC(&sv->sv_v);
+	/*
+	 * Go over the table of loaded vnodes, putting their inodes in the
+	 * buffer cache (not VOP_FSYNC, which would flush the whole cache
+	 * for each one), then write back the lot once.
+	 */
+	lock_acquire(sfs->sfs_vnodes_lock);
+	for (i=0; i<sfs->sfs_vnbuckets; i++) {
+		struct sfs_vnode *sv;
+		for (sv = sfs->sfs_vnodes[i]; sv != NULL; sv = sv->sv_hashnext) {
+			sfs_sync_inode(sv);
+		}
+	}
+	lock_release(sfs->sfs_vnodes_lock);
+
+	/* Write back the buffer cache */
+	result = sfs_bflush(sfs);
+	if (result) {
+		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
@@ -170,7 +183,7 @@ sfs_unmount(struct fs *fs)
 	struct sfs_fs *sfs = fs->fs_data;
 	
 	/* Do we have any files open? If so, can't unmount. */
-	if (array_getnum(sfs->sfs_vnodes)>0) {
+	if (sfs->sfs_nvnodes>0) {
 		return EBUSY;
 	}
 
@@ -179,7 +192,8 @@ sfs_unmount(struct fs *fs)
 	assert(sfs->sfs_freemapdirty==0);
 
 	/* Once we start nuking stuff we can't fail. */
-	array_destroy(sfs->sfs_vnodes);
+	sfs_bpurge(sfs);
+	kfree(sfs->sfs_vnodes);
 	bitmap_destroy(sfs->sfs_freemap);
 	
 	/* The vfs layer takes care of the device for us */
@@ -239,18 +253,27 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENXIO;
 	}
 
+	/* Set up the buffer cache, if this is the first mount */
+	result = sfs_cache_bootstrap();
+	if (result) {
+		return result;
+	}
+
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate array */
-	sfs->sfs_vnodes = array_create();
+	/* Allocate vnode table */
+	sfs->sfs_vnbuckets = SFS_VNODE_BUCKETS;
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_vnodes = kmalloc(SFS_VNODE_BUCKETS * sizeof(struct sfs_vnode *));
 	if (sfs->sfs_vnodes == NULL) {
 		kfree(sfs);
 		return ENOMEM;
 	}
+	bzero(sfs->sfs_vnodes, SFS_VNODE_BUCKETS * sizeof(struct sfs_vnode *));
 
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
@@ -258,7 +281,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
-		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs->sfs_vnodes);
 		kfree(sfs);
 		return result;
 	}
@@ -270,11 +293,21 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
-		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs->sfs_vnodes);
 		kfree(sfs);
 		return EINVAL;
 	}
 	
+	if ((sfs->sfs_super.sp_features & ~SFS_FEATURES) != 0 ||
+	    (SFS_HAS(sfs, SFS_FEATURE_HASHDIR) &&
+	     !SFS_HAS(sfs, SFS_FEATURE_DINDIRECT))) {
+		kprintf("sfs: Unsupported features in superblock (0x%x)\n",
+			sfs->sfs_super.sp_features);
+		kfree(sfs->sfs_vnodes);
+		kfree(sfs);
+		return EINVAL;
+	}
+
 	if (sfs->sfs_super.sp_nblocks > dev->d_blocks) {
 		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
 			sfs->sfs_super.sp_nblocks, dev->d_blocks);
@@ -286,14 +319,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
-		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs->sfs_vnodes);
 		kfree(sfs);
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
-		array_destroy(sfs->sfs_vnodes);
+		kfree(sfs->sfs_vnodes);
 		kfree(sfs);
 		return result;
 	}
@@ -301,7 +334,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	sfs->sfs_super_lock = lock_create("super_lock");
 	if(sfs->sfs_super_lock == NULL){
 		bitmap_destroy(sfs->sfs_freemap);
-                array_destroy(sfs->sfs_vnodes);
+                kfree(sfs->sfs_vnodes);
                 kfree(sfs);
                 return ENOMEM;
 	}
@@ -310,7 +343,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
         if(sfs->sfs_vnodes_lock == NULL){
                 lock_destroy(sfs->sfs_super_lock);
 		bitmap_destroy(sfs->sfs_freemap);
-                array_destroy(sfs->sfs_vnodes);
+                kfree(sfs->sfs_vnodes);
                 kfree(sfs);
                 return ENOMEM;
         }
@@ -320,7 +353,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		lock_destroy(sfs->sfs_vnodes_lock);
 		lock_destroy(sfs->sfs_super_lock);
                 bitmap_destroy(sfs->sfs_freemap);
-                array_destroy(sfs->sfs_vnodes);
+                kfree(sfs->sfs_vnodes);
                 kfree(sfs);
                 return ENOMEM;
         }
@@ -339,11 +372,12 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Set up . and .. in root dir */
         result = sfs_setup_root(sfs);
         if (result) {
+		sfs_bpurge(sfs);
 		lock_destroy(sfs->sfs_freemap_lock);
 		lock_destroy(sfs->sfs_vnodes_lock);
                 lock_destroy(sfs->sfs_super_lock);
                 bitmap_destroy(sfs->sfs_freemap);
-                array_destroy(sfs->sfs_vnodes);
+                kfree(sfs->sfs_vnodes);
                 kfree(sfs);
                 return result;
         }
@@ -55,6 +55,51 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	return result;
 }
 
+struct sfs_iostats sfs_iostats;
+
+/*
+ * Transfer N blocks, starting at BLOCK on disk, between the disk and
+ * UIO in one request. UIO is set up for a file, so its offset is
+ * swapped for the disk's during the transfer and then moved on by the
+ * amount done. It must have at least N blocks left.
+ */
+int
+sfs_rwblocks(struct sfs_fs *sfs, struct uio *uio, u_int32_t block,
+	     u_int32_t n)
+{
+	off_t saveoff;
+	off_t diskoff;
+	off_t saveres;
+	off_t diskres;
+	int result;
+
+	saveoff = uio->uio_offset;
+	diskoff = ((off_t)block) * SFS_BLOCKSIZE;
+	uio->uio_offset = diskoff;
+
+	/*
+	 * Temporarily set the residue to the size of the transfer.
+	 */
+	assert(uio->uio_resid >= n * SFS_BLOCKSIZE);
+	saveres = uio->uio_resid;
+	diskres = n * SFS_BLOCKSIZE;
+	uio->uio_resid = diskres;
+
+	result = sfs_rwblock(sfs, uio);
+
+	/*
+	 * Now, restore the original uio_offset and uio_resid and update 
+	 * them by the amount of I/O done.
+	 */
+	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
+	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+
+	sfs_iostats.requests++;
+	sfs_iostats.blocks += n;
+
+	return result;
+}
+
 int
 sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block)
 {
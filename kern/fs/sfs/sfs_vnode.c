@@ -6,45 +6,61 @@
 #include <types.h>
 #include <lib.h>
 #include <synch.h>
-#include <array.h>
 #include <bitmap.h>
 #include <kern/stat.h>
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <uio.h>
 #include <dev.h>
+#include <vfs.h>
 #include <sfs.h>
 
 /* At bottom of file */
 static int 
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
 		 struct sfs_vnode **ret);
+static void sfs_vnremove(struct sfs_fs *sfs, struct sfs_vnode *sv);
+static int sfs_truncate(struct vnode *v, off_t len);
 
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
 
-/* Zero out a disk block. */
+/* Zero out a disk block (in the buffer cache; it gets written later). */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, u_int32_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	struct sfs_buf *buf;
+	int result;
+
+	result = sfs_bget(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(buf->b_data, SFS_BLOCKSIZE);
+	buf->b_dirty = 1;
+	sfs_brelse(buf);
+	return 0;
 }
 
-/* Write an on-disk inode structure back out to disk. */
-static
+/*
+ * Write an on-disk inode structure back out to its block in the
+ * buffer cache. sfs_bflush() takes it to the disk.
+ */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		struct sfs_buf *buf;
+		int result = sfs_bget(sfs, sv->sv_ino, &buf);
 		if (result) {
 			return result;
 		}
+		memcpy(buf->b_data, &sv->sv_i, SFS_BLOCKSIZE);
+		buf->b_dirty = 1;
+		sfs_brelse(buf);
 		sv->sv_dirty = 0;
 	}
 	return 0;
@@ -67,6 +83,7 @@ sfs_balloc(struct sfs_fs *sfs, u_int32_t *diskblock)
 
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
+		lock_release(sfs->sfs_freemap_lock);
 		return result;
 	}
 	sfs->sfs_freemapdirty = 1;
@@ -88,9 +105,17 @@ static
 void
 sfs_bfree(struct sfs_fs *sfs, u_int32_t diskblock)
 {
-	/* Don't think we need to synchronize this */
+	/*
+	 * Whatever was in it needn't be written now. Drop it from the
+	 * buffer cache before the block can be allocated again, or the
+	 * new owner could pick up the old buffer and lose it to us.
+	 */
+	sfs_binval(sfs, diskblock);
+
+	lock_acquire(sfs->sfs_freemap_lock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = 1;
+	lock_release(sfs->sfs_freemap_lock);
 }
 
 /*
@@ -112,6 +137,59 @@ sfs_bused(struct sfs_fs *sfs, u_int32_t diskblock)
 //
 // Block mapping/inode maintenance
 
+/*
+ * Get entry IDOFF of indirect block IDBLOCK of a file, allocating a
+ * block for it if there isn't one and DOALLOC is set. (The indirect
+ * blocks under the double indirect block are found with this too.)
+ */
+static
+int
+sfs_bmap_indirect(struct sfs_vnode *sv, u_int32_t idblock, u_int32_t idoff,
+		  int doalloc, u_int32_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	u_int32_t *idbuf;
+	u_int32_t block;
+	int result;
+
+	/*
+	 * Get the indirect block from the buffer cache. (One we just
+	 * allocated is already there, cleared by sfs_balloc.)
+	 */
+	result = sfs_bread(sfs, idblock, &buf);
+	if (result) {
+		return result;
+	}
+	idbuf = buf->b_data;
+
+	/* Get the block out of the indirect block buffer */
+	block = idbuf[idoff];
+
+	/* If there's no block there, allocate one */
+	if (block==0 && doalloc) {
+		result = sfs_balloc(sfs, &block);
+		if (result) {
+			sfs_brelse(buf);
+			return result;
+		}
+
+		/* Remember the block we allocated; the indirect block is dirty */
+		idbuf[idoff] = block;
+		buf->b_dirty = 1;
+	}
+	sfs_brelse(buf);
+
+	/* Hand back the result and return. */
+	if (block != 0 && !sfs_bused(sfs, block)) {
+		panic("sfs: Block %u (entry %u of indirect block %u of "
+		      "file %u) marked free\n", block, idoff, idblock,
+		      sv->sv_ino);
+	}
+	*diskblock = block;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
@@ -123,22 +201,13 @@ int
 sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	    u_int32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	u_int32_t block;
 	u_int32_t idblock;
 	u_int32_t idnum, idoff;
 	int result;
 
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	assert(SFS_DBPERIDB * sizeof(u_int32_t) == SFS_BLOCKSIZE);
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -175,23 +244,63 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block; it must be in the indirect block, or
+	 * under the double indirect block. Subtract off the number of
+	 * direct blocks, so FILEBLOCK is now the offset into the indirect
+	 * block space.
 	 */
 
 	fileblock -= SFS_NDIRECT;
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	if (fileblock < SFS_DBPERIDB) {
+		/* Get the disk block number of the indirect block. */
+		idblock = sv->sv_i.sfi_indirect;
+		idoff = fileblock;
+	}
+	else {
+		/*
+		 * Past the indirect block. Without the double indirect
+		 * block (or past what it covers) we can't handle it, so
+		 * fail.
+		 */
+		fileblock -= SFS_DBPERIDB;
+		idnum = fileblock / SFS_DBPERIDB;
+		idoff = fileblock % SFS_DBPERIDB;
+		if (!SFS_HAS(sfs, SFS_FEATURE_DINDIRECT) ||
+		    idnum >= SFS_DBPERIDB) {
+			return EINVAL;
+		}
+
+		if (sv->sv_i.sfi_dindirect==0 && !doalloc) {
+			*diskblock = 0;
+			return 0;
+		}
+		else if (sv->sv_i.sfi_dindirect==0) {
+			result = sfs_balloc(sfs, &idblock);
+			if (result) {
+				return result;
+			}
+			sv->sv_i.sfi_dindirect = idblock;
+			sv->sv_dirty = 1;
+		}
 
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum > 0) {
-		return EINVAL;
+		/* Find (or allocate) the indirect block in it */
+		result = sfs_bmap_indirect(sv, sv->sv_i.sfi_dindirect, idnum,
+					   doalloc, &idblock);
+		if (result) {
+			return result;
+		}
+		if (idblock == 0) {
+			*diskblock = 0;
+			return 0;
+		}
+
+		result = sfs_bmap_indirect(sv, idblock, idoff, doalloc, &block);
+		if (result) {
+			return result;
+		}
+		*diskblock = block;
+		return 0;
 	}
 
 	/* 
@@ -200,9 +309,6 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	 * time (this is protected with file locks in the VFS layer).
 	 */
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
-
 	if (idblock==0 && !doalloc) {
 		/*
 		 * There's no indirect block allocated. We weren't
@@ -229,44 +335,11 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = 1;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
-	}
-
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
-
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
-		}
-
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
-
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
 	}
 
-	/* Hand back the result and return. */
-	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: Data block %u (block %u of file %u) marked free\n",
-		      block, fileblock, sv->sv_ino);
+	result = sfs_bmap_indirect(sv, idblock, idoff, doalloc, &block);
+	if (result) {
+		return result;
 	}
 	*diskblock = block;
 	return 0;
@@ -291,16 +364,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      u_int32_t skipstart, u_int32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
 	int result;
@@ -319,74 +384,57 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 		return result;
 	}
 
-	/* f_test 3 debug */
-	u_int32_t i;
-	char ch;
-
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		assert(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
-
-		/* f_test 3 debug
-		if(uio->uio_rw == UIO_READ && diskblock > 6){
-                	for(i=0; i<len; i++){
-                        	ch = (iobuf+skipstart)[i];
-                        	if(ch != 'w' && ch != 'r') kprintf("Read Error on diskblock %d - iobuf[%d]: %c\n", diskblock, i, ch);
-                	}       
-        	}
-		*/
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = sfs_bread(sfs, diskblock, &buf);
 	if (result) {
 		return result;
 	}
-	
+
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * If it was a write, the block gets written back later.
 	 */
-	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+	result = uiomove((char *)buf->b_data + skipstart, len, uio);
+	if (result == 0 && uio->uio_rw == UIO_WRITE) {
+		buf->b_dirty = 1;
 	}
+	sfs_brelse(buf);
 
-	return 0;
+	return result;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O (either read or write) of whole blocks: the one at the uio's
+ * offset, and as many of the ones after it as come right after it on
+ * disk too, up to MAXBLOCKS in all (and SFS_CLUSTER), in one request.
+ * Holes and blocks that are in the buffer cache are done one at a time.
+ * Hands back how many blocks were done in *DONE.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio, u_int32_t maxblocks,
+	    u_int32_t *done)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	u_int32_t diskblock;
+	struct sfs_buf *buf;
+	u_int32_t diskblock, nextblock;
 	u_int32_t fileblock;
+	u_int32_t n, i;
 	int result;
 	int doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
+
+	*done = 0;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -405,35 +453,113 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		assert(uio->uio_rw == UIO_READ);
+		*done = 1;
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
+	 * If the block is in the buffer cache (because it was newly
+	 * allocated, partly read or written, or read ahead), use that
+	 * copy, which may be newer than the disk's.
 	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	result = sfs_bpeek(sfs, diskblock, &buf);
+	if (result) {
+		return result;
+	}
+	if (buf != NULL) {
+		result = uiomove(buf->b_data, SFS_BLOCKSIZE, uio);
+		if (result == 0 && uio->uio_rw == UIO_WRITE) {
+			buf->b_dirty = 1;
+		}
+		sfs_brelse(buf);
+		*done = 1;
+		return result;
+	}
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * Otherwise find how many of the blocks after it follow it on
+	 * disk (and aren't cached either), and do them all directly to
+	 * the uio region.
 	 */
-	assert(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
-	
-	result = sfs_rwblock(sfs, uio);
+	if (maxblocks > SFS_CLUSTER) {
+		maxblocks = SFS_CLUSTER;
+	}
+	for (n = 1; n < maxblocks; n++) {
+		result = sfs_bmap(sv, fileblock + n, doalloc, &nextblock);
+		if (result) {
+			return result;
+		}
+		if (nextblock != diskblock + n || sfs_bcached(sfs, nextblock)) {
+			break;
+		}
+	}
+
+	result = sfs_rwblocks(sfs, uio, diskblock, n);
+	if (result) {
+		return result;
+	}
 
 	/*
-	 * Now, restore the original uio_offset and uio_resid and update 
-	 * them by the amount of I/O done.
+	 * Anything the read-ahead thread brought in while we were
+	 * writing may be older than what we wrote.
 	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	if (uio->uio_rw == UIO_WRITE) {
+		for (i=0; i<n; i++) {
+			sfs_binval(sfs, diskblock + i);
+		}
+	}
 
-	return result;
+	*done = n;
+	return 0;
+}
+
+/*
+ * SV is being read sequentially, and the read just done ended at
+ * ENDOFF. Unless read-ahead is already far enough ahead of that, have
+ * the blocks after it read into the buffer cache, a run of blocks
+ * that are together on disk at a time.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, off_t endoff)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t block, last, diskblock;
+	u_int32_t start = 0, n = 0;
+
+	block = DIVROUNDUP(endoff, SFS_BLOCKSIZE);
+	if (sv->sv_rablock >= block + SFS_READAHEAD/2) {
+		return;
+	}
+
+	last = block + SFS_READAHEAD;
+	if (last > DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE)) {
+		last = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	}
+	if (block < sv->sv_rablock) {
+		block = sv->sv_rablock;
+	}
+
+	for (; block < last; block++) {
+		if (sfs_bmap(sv, block, 0, &diskblock)) {
+			break;
+		}
+		if (n > 0 && n < SFS_CLUSTER && diskblock == start + n) {
+			n++;
+			continue;
+		}
+		if (n > 0) {
+			sfs_breadahead(sfs, start, n);
+		}
+		/* Holes don't need reading */
+		start = diskblock;
+		n = (diskblock != 0);
+	}
+	if (n > 0) {
+		sfs_breadahead(sfs, start, n);
+	}
+
+	sv->sv_rablock = block;
 }
 
 /*
@@ -444,8 +570,9 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	u_int32_t blkoff;
-	u_int32_t nblocks, i;
+	u_int32_t nblocks, done;
 	int result = 0;
+	int sequential = 0;
 	u_int32_t extraresid = 0;
 
 	/*
@@ -467,6 +594,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			assert(uio->uio_resid > extraresid);
 			uio->uio_resid -= extraresid;
 		}
+
+		/* Does it carry on from the last read? */
+		sequential = (uio->uio_offset == sv->sv_nextoff);
+		if (!sequential) {
+			sv->sv_rablock = 0;
+		}
 	}
 	
 	/*
@@ -502,11 +635,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	 */
 	assert(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (nblocks > 0) {
+		result = sfs_blockio(sv, uio, nblocks, &done);
 		if (result) {
 			goto out;
 		}
+		nblocks -= done;
 	}
 
 	/*
@@ -530,6 +664,14 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = 1;
 	}
 
+	/* If reading, remember where we got to, and maybe read ahead */
+	if (uio->uio_rw == UIO_READ && result == 0) {
+		sv->sv_nextoff = uio->uio_offset;
+		if (sequential) {
+			sfs_readahead(sv, uio->uio_offset);
+		}
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -630,6 +772,134 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+/*
+ * Find the first entry in use at or after slot *SLOT of a directory,
+ * and read it into SD. Sets *SLOT to sfs_dir_nentries() if there isn't
+ * one. Holes (the buckets of a hashed directory that nothing has been
+ * put in) are skipped a block at a time.
+ */
+static
+int
+sfs_dir_next(struct sfs_vnode *sv, int *slot, struct sfs_dir *sd)
+{
+	int nentries = sfs_dir_nentries(sv);
+	u_int32_t block;
+	int result;
+
+	while (*slot < nentries) {
+		if (*slot % SFS_DIRPERBLK == 0) {
+			result = sfs_bmap(sv, *slot / SFS_DIRPERBLK, 0, &block);
+			if (result) {
+				return result;
+			}
+			if (block == 0) {
+				*slot += SFS_DIRPERBLK;
+				continue;
+			}
+		}
+
+		result = sfs_readdir(sv, sd, *slot);
+		if (result) {
+			return result;
+		}
+		if (sd->sfd_ino != SFS_NOINO) {
+			return 0;
+		}
+		(*slot)++;
+	}
+
+	*slot = nentries;
+	return 0;
+}
+
+/*
+ * Bucket of a name in a hashed directory (see kern/sfs.h).
+ */
+static
+u_int32_t
+sfs_hdir_hash(const char *name)
+{
+	u_int32_t h = 5381;
+
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return 0;
+	}
+	while (*name) {
+		h = h * 33 + (unsigned char) *name++;
+	}
+	return h % SFS_HDIR_BUCKETS;
+}
+
+/*
+ * sfs_dir_findname for a hashed directory. Searches the buckets from
+ * the one NAME hashes to until it turns up or a bucket with a slot
+ * that's never been used (or a hole) does. The empty slot handed back
+ * is the first free one on the way, which is where NAME belongs.
+ */
+static
+int
+sfs_hdir_findname(struct sfs_vnode *sv, const char *name,
+		  u_int32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	struct sfs_dir *sd;
+	u_int32_t bucket, block, i;
+	int j, freeslot = -1, unused = 0;
+	int result;
+
+	bucket = sfs_hdir_hash(name);
+	for (i=0; i<SFS_HDIR_BUCKETS && !unused; i++) {
+		result = sfs_bmap(sv, bucket, 0, &block);
+		if (result) {
+			return result;
+		}
+		if (block == 0) {
+			if (freeslot < 0) {
+				freeslot = bucket * SFS_DIRPERBLK;
+			}
+			break;
+		}
+
+		result = sfs_bread(sfs, block, &buf);
+		if (result) {
+			return result;
+		}
+		sd = buf->b_data;
+
+		for (j=0; j<SFS_DIRPERBLK; j++) {
+			if (sd[j].sfd_ino == SFS_NOINO) {
+				if (freeslot < 0) {
+					freeslot = bucket * SFS_DIRPERBLK + j;
+				}
+				if ((unsigned char)sd[j].sfd_name[0] !=
+				    SFS_HDIR_DELETED) {
+					unused = 1;
+				}
+			}
+			else if (sd[j].sfd_name[SFS_NAMELEN-1] == 0 &&
+				 !strcmp(sd[j].sfd_name, name)) {
+				if (slot != NULL) {
+					*slot = bucket * SFS_DIRPERBLK + j;
+				}
+				if (ino != NULL) {
+					*ino = sd[j].sfd_ino;
+				}
+				sfs_brelse(buf);
+				return 0;
+			}
+		}
+		sfs_brelse(buf);
+
+		bucket = (bucket + 1) % SFS_HDIR_BUCKETS;
+	}
+
+	if (emptyslot != NULL && freeslot >= 0) {
+		*emptyslot = freeslot;
+	}
+	return ENOENT;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -641,11 +911,16 @@ int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		    u_int32_t *ino, int *slot, int *emptyslot)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	struct sfs_dir tsd;
 	int found = 0;
 	int nentries = sfs_dir_nentries(sv);
 	int i, result;
 
+	if (SFS_HAS(sfs, SFS_FEATURE_HASHDIR)) {
+		return sfs_hdir_findname(sv, name, ino, slot, emptyslot);
+	}
+
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
 
@@ -690,6 +965,7 @@ static
 int
 sfs_dir_link(struct sfs_vnode *sv, const char *name, u_int32_t ino, int *slot)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	int emptyslot = -1;
 	int result;
 	struct sfs_dir sd;
@@ -707,8 +983,14 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, u_int32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
+	/*
+	 * If we didn't get an empty slot, add the entry at the end. A
+	 * hashed directory can't grow, so it's full.
+	 */
 	if (emptyslot < 0) {
+		if (SFS_HAS(sfs, SFS_FEATURE_HASHDIR)) {
+			return ENOSPC;
+		}
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -726,6 +1008,55 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, u_int32_t ino, int *slot)
 	return sfs_writedir(sv, &sd, emptyslot);	
 }
 
+/*
+ * sfs_dir_unlink for a hashed directory. Searches stop at a bucket with
+ * a slot that's never been used, so if this bucket has another one
+ * the slot can just be freed; otherwise searches for names that went
+ * on to later buckets have to go past it, and it's marked deleted.
+ */
+static
+int
+sfs_hdir_unlink(struct sfs_vnode *sv, int slot)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	struct sfs_dir *sd;
+	u_int32_t block;
+	int j, first, unused = 0;
+	int result;
+
+	result = sfs_bmap(sv, slot / SFS_DIRPERBLK, 0, &block);
+	if (result) {
+		return result;
+	}
+	assert(block != 0);
+
+	result = sfs_bread(sfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	sd = buf->b_data;
+
+	first = slot - slot % SFS_DIRPERBLK;
+	for (j=0; j<SFS_DIRPERBLK; j++) {
+		if (first + j != slot && sd[j].sfd_ino == SFS_NOINO &&
+		    (unsigned char)sd[j].sfd_name[0] != SFS_HDIR_DELETED) {
+			unused = 1;
+		}
+	}
+
+	sd += slot - first;
+	bzero(sd, sizeof(*sd));
+	sd->sfd_ino = SFS_NOINO;
+	if (!unused) {
+		sd->sfd_name[0] = (char) SFS_HDIR_DELETED;
+	}
+	buf->b_dirty = 1;
+	sfs_brelse(buf);
+
+	return 0;
+}
+
 /*
  * Unlink a name in a directory, by slot number.
  */
@@ -733,8 +1064,13 @@ static
 int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	struct sfs_dir sd;
 
+	if (SFS_HAS(sfs, SFS_FEATURE_HASHDIR)) {
+		return sfs_hdir_unlink(sv, slot);
+	}
+
 	/* Initialize a suitable directory entry... */ 
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
@@ -775,6 +1111,37 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 	return 0;
 }
 
+/*
+ * sfs_lookonce for the path walkers: try the VFS name cache first, and
+ * enter what the directory search finds.
+ */
+static
+int
+sfs_lookcached(struct sfs_vnode *sv, const char *name,
+	       struct sfs_vnode **ret)
+{
+	struct vnode *vn;
+	u_int32_t gen;
+	int result;
+
+	if (vfs_nclookup(&sv->sv_v, name, &vn, &gen)) {
+		if (vn == NULL) {
+			return ENOENT;
+		}
+		*ret = vn->vn_data;
+		return 0;
+	}
+
+	result = sfs_lookonce(sv, name, ret, NULL);
+	if (result == 0) {
+		vfs_ncenter(&sv->sv_v, name, &(*ret)->sv_v, gen);
+	}
+	else if (result == ENOENT) {
+		vfs_ncenter(&sv->sv_v, name, NULL, gen);
+	}
+	return result;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Object creation
@@ -868,8 +1235,11 @@ static
 int
 sfs_close(struct vnode *v)
 {
-	/* Sync it. */
-	return VOP_FSYNC(v);
+	/*
+	 * Put the inode in the buffer cache. It goes to disk with
+	 * everything else at fsync or sync time.
+	 */
+	return sfs_sync_inode(v->vn_data);
 }
 
 /*
@@ -883,7 +1253,7 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	int ix, i, num, result;
+	int result;
 
 	lock_acquire(sfs->sfs_vnodes_lock);
 
@@ -908,12 +1278,12 @@ sfs_reclaim(struct vnode *v)
 	
 
 	/* If there are no on-disk references to the file either, erase it. */
-	if (sv->sv_i.sfi_linkcount==0 && sv->sv_i.sfi_type==SFS_TYPE_FILE) {
-		/* 
-		 * VOP_TRUNCATE doesn't work on directories, which is why I added
-		 * the second requirement to the above if statement.
+	if (sv->sv_i.sfi_linkcount==0) {
+		/*
+		 * Call sfs_truncate directly: VOP_TRUNCATE doesn't work on
+		 * directories, and a removed one's blocks need freeing too.
 		 */
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+		result = sfs_truncate(&sv->sv_v, 0);
 		if (result) {
 			lock_release(sfs->sfs_vnodes_lock);
 			return result;
@@ -933,20 +1303,7 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	ix = -1;
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv2 = array_getguy(sfs->sfs_vnodes, i);
-		if (sv2==sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix<0) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
-	}
-	array_remove(sfs->sfs_vnodes, ix);
+	sfs_vnremove(sfs, sv);
 
 	VOP_KILL(&sv->sv_v);
 
@@ -1079,18 +1436,87 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
-	return sfs_sync_inode(sv);
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	result = sfs_sync_inode(sv);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * We don't keep track of which cached blocks are whose, so
+	 * write back all of them.
+	 */
+	return sfs_bflush(sfs);
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). The VM system fills mapped pages with VOP_READ
+ * and writes dirty shared ones back with VOP_WRITE, so all we have to
+ * say is that regular files can be mapped.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
+}
+
+/*
+ * Free what indirect block IDBLOCK maps at or past file block BLOCKLEN.
+ * Its entries map SPAN file blocks each, starting at BASEBLOCK: data
+ * blocks if SPAN is 1, or indirect blocks (for the double indirect
+ * block). Sets *EMPTY if it's left with no entries.
+ */
+static
+int
+sfs_truncindirect(struct sfs_fs *sfs, u_int32_t idblock, u_int32_t baseblock,
+		  u_int32_t span, u_int32_t blocklen, int *empty)
+{
+	struct sfs_buf *buf;
+	u_int32_t *idbuf;
+	u_int32_t j;
+	int result, subempty;
+
+	/* Read the indirect block */
+	result = sfs_bread(sfs, idblock, &buf);
+	if (result) {
+		return result;
+	}
+	idbuf = buf->b_data;
+
+	*empty = 1;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		/* Discard any blocks that are past the new EOF */
+		if (idbuf[j] != 0 && blocklen < baseblock + (j+1)*span) {
+			subempty = 1;
+			if (span > 1) {
+				result = sfs_truncindirect(sfs, idbuf[j],
+							   baseblock + j*span,
+							   span / SFS_DBPERIDB,
+							   blocklen, &subempty);
+				if (result) {
+					sfs_brelse(buf);
+					return result;
+				}
+			}
+			if (subempty) {
+				sfs_bfree(sfs, idbuf[j]);
+				idbuf[j] = 0;
+				buf->b_dirty = 1;
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			*empty = 0;
+		}
+	}
+
+	/* Let go of it; the caller frees it if it's empty */
+	sfs_brelse(buf);
+	return 0;
 }
 
 /*
@@ -1100,27 +1526,16 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	u_int32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	u_int32_t i, j, block;
-	u_int32_t idblock, baseblock, highblock;
+	u_int32_t i, block;
+	u_int32_t idblock, baseblock;
 	int result;
-	int hasnonzero, iddirty;
-
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	int empty;
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1135,51 +1550,39 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 	}
 
-	/* Indirect block number */
+	/*
+	 * The indirect block maps the blocks after the direct ones, and
+	 * the double indirect block the ones after that. Unless they're
+	 * all before the proposed EOF, we may need to free stuff.
+	 */
 	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+	if (idblock != 0 && blocklen < baseblock + SFS_DBPERIDB) {
+		result = sfs_truncindirect(sfs, idblock, baseblock, 1,
+					   blocklen, &empty);
 		if (result) {
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
+		if (empty) {
 			/* The whole indirect block is empty now; free it */
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = 1;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				return result;
-			}
+	}
+
+	idblock = sv->sv_i.sfi_dindirect;
+	baseblock = SFS_NDIRECT + SFS_DBPERIDB;
+	if (idblock != 0 && blocklen < baseblock + SFS_DBPERIDB*SFS_DBPERIDB) {
+		result = sfs_truncindirect(sfs, idblock, baseblock,
+					   SFS_DBPERIDB, blocklen, &empty);
+		if (result) {
+			return result;
+		}
+		if (empty) {
+			sfs_bfree(sfs, idblock);
+			sv->sv_i.sfi_dindirect = 0;
+			sv->sv_dirty = 1;
 		}
 	}
 
@@ -1238,11 +1641,11 @@ sfs_namefile(struct vnode *vv, struct uio *uio)
 
 		nentries = sfs_dir_nentries(parent_dir);
 		slot = 2;
-		while (slot < nentries){
-			err = sfs_readdir(parent_dir, &tsd, slot);
+		while (1){
+			err = sfs_dir_next(parent_dir, &slot, &tsd);
         		if(err) return err;
 
-			if(tsd.sfd_ino == child_dir->sv_ino) break;
+			if(slot >= nentries || tsd.sfd_ino == child_dir->sv_ino) break;
                 	slot++;
         	}
 
@@ -1317,6 +1720,7 @@ sfs_creat(struct vnode *v, const char *name, int excl, struct vnode **ret)
 		VOP_DECREF(&newguy->sv_v);
 		return result;
 	}
+	vfs_ncremove(v, name);
 
 	/* Update the linkcount of the new file */
 	newguy->sv_i.sfi_linkcount++;
@@ -1348,6 +1752,7 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 	if (result) {
 		return result;
 	}
+	vfs_ncremove(dir, name);
 
 	/* and update the link count, marking the inode dirty */
 	f->sv_i.sfi_linkcount++;
@@ -1381,6 +1786,7 @@ sfs_remove(struct vnode *dir, const char *name)
 		assert(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = 1;
+		vfs_ncremove(dir, name);
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
@@ -1440,6 +1846,9 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = 1;
 
+	vfs_ncremove(d1, n1);
+	vfs_ncremove(d2, n2);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 
@@ -1456,6 +1865,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 			strerror(result2));
 		panic("sfs: rename: Cannot recover\n");
 	}
+	vfs_ncremove(d2, n2);
 	g1->sv_i.sfi_linkcount--;
  puke:
 	/* Let go of the reference to g1 */
@@ -1497,7 +1907,7 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 			strcpy(name, path);
 			path = &path[i + 1];
 
-			err = sfs_lookonce(parent, name, &child, NULL);
+			err = sfs_lookcached(parent, name, &child);
 			if(err){
 				VOP_DECREF(&parent->sv_v);
 				return err;
@@ -1554,7 +1964,7 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
                         strcpy(name, path);
                         path = &path[i + 1];
          
-                        err = sfs_lookonce(parent, name, &child, NULL);
+                        err = sfs_lookcached(parent, name, &child);
                         if(err){
                                 VOP_DECREF(&parent->sv_v);
                                 return err;
@@ -1566,7 +1976,7 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
                 } else{ /* Hit NULL, so this is our last time through */
                         assert(path[i] == '\0');
                         
-			err = sfs_lookonce(parent, path, &child, NULL);
+			err = sfs_lookcached(parent, path, &child);
                         if(err){
                                 VOP_DECREF(&parent->sv_v);
                                 return err;
@@ -1613,13 +2023,8 @@ sfs_getdirentry(struct vnode *vv, struct uio *uio)
 		slot = uio->uio_offset/sizeof(struct sfs_dir) + 1;
 	}
 
-	while(slot < nentries){
-		err = sfs_readdir(sv, &tsd, slot);
-		if(err) return err;
-
-		if(tsd.sfd_ino != SFS_NOINO) break;
-		slot++;
-	}
+	err = sfs_dir_next(sv, &slot, &tsd);
+	if(err) return err;
 
 	if(slot >= nentries){
 		/* EOF - just return */
@@ -1664,6 +2069,12 @@ sfs_mkdir(struct vnode *vv, const char *name){
                 return result;
         }
 
+	/* A hashed directory has all its buckets (as holes) from the start */
+	if (SFS_HAS(sfs, SFS_FEATURE_HASHDIR)) {
+		newguy->sv_i.sfi_size = SFS_HDIR_BUCKETS * SFS_BLOCKSIZE;
+		newguy->sv_dirty = 1;
+	}
+
         /* Link it into the directory */
         result = sfs_dir_link(sv, name, newguy->sv_ino, &slot1);
         if (result) {
@@ -1679,6 +2090,7 @@ sfs_mkdir(struct vnode *vv, const char *name){
 	result = sfs_dir_link(newguy, ".", newguy->sv_ino, &slot2);
         if (result) {
 		result2 = sfs_dir_unlink(sv, slot1);
+		vfs_ncremove(vv, name);
                 if(result2){
 			VOP_DECREF(&newguy->sv_v);
 			return result2;
@@ -1702,6 +2114,7 @@ sfs_mkdir(struct vnode *vv, const char *name){
                 newguy->sv_i.sfi_linkcount--; 
                 newguy->sv_dirty = 1;
                 result2 = sfs_dir_unlink(sv, slot1);
+                vfs_ncremove(vv, name);
 		if(result2){
                         VOP_DECREF(&newguy->sv_v);
                         return result2;
@@ -1715,6 +2128,8 @@ sfs_mkdir(struct vnode *vv, const char *name){
         sv->sv_i.sfi_linkcount++;
         sv->sv_dirty = 1;
 
+	vfs_ncremove(vv, name);
+
 	VOP_DECREF(&newguy->sv_v);
 
 	return 0;
@@ -1741,23 +2156,17 @@ sfs_rmdir(struct vnode *vv, const char *name){
 		return ENOTDIR;
 	}
 
+	/* Ensure all other entries are blank */
 	nentries = sfs_dir_nentries(victim);
-	if(nentries != 2){
-		slot2 = 2; 
-		while(slot2 < nentries){
-			/* Ensure all other entries are blank */
-			result = sfs_readdir(victim, &tsd, slot2);
-                	if(result){
-				VOP_DECREF(&victim->sv_v);
-				return result;
-			}
-
-                	if(tsd.sfd_ino != SFS_NOINO){
-				VOP_DECREF(&victim->sv_v);
-                                return ENOTEMPTY;
-			}
-                	slot2++;
-		}	
+	slot2 = 2;
+	result = sfs_dir_next(victim, &slot2, &tsd);
+	if(result){
+		VOP_DECREF(&victim->sv_v);
+		return result;
+	}
+	if(slot2 < nentries){
+		VOP_DECREF(&victim->sv_v);
+		return ENOTEMPTY;
 	}
 
 	/* Get rid of . and .. (should always be in slot 0 and 1) */
@@ -1772,6 +2181,7 @@ sfs_rmdir(struct vnode *vv, const char *name){
 
 	result = sfs_dir_unlink(victim, 1);
         if(result){
+		vfs_ncpurge(&victim->sv_v);
                 VOP_DECREF(&victim->sv_v);
                 return result;
         }       
@@ -1788,6 +2198,9 @@ sfs_rmdir(struct vnode *vv, const char *name){
                 victim->sv_dirty = 1;
         }
 
+	/* Forget its name, and the names in it */
+	vfs_ncpurge(&victim->sv_v);
+
         /* Discard the reference that sfs_lookonce got us */
         VOP_DECREF(&victim->sv_v);
 
@@ -1897,6 +2310,88 @@ static const struct vnode_ops sfs_dirops = {
 	sfs_lookparent,
 };
 
+////////////////////////////////////////////////////////////
+//
+// Table of loaded vnodes. Callers hold sfs_vnodes_lock.
+
+static
+struct sfs_vnode *
+sfs_vnlookup(struct sfs_fs *sfs, u_int32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	sv = sfs->sfs_vnodes[ino & (sfs->sfs_vnbuckets - 1)];
+	while (sv != NULL && sv->sv_ino != ino) {
+		sv = sv->sv_hashnext;
+	}
+	return sv;
+}
+
+/*
+ * Double the number of chains. If there isn't the memory, the chains
+ * just get longer.
+ */
+static
+void
+sfs_vngrow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **table, *sv, *next;
+	u_int32_t n = sfs->sfs_vnbuckets * 2;
+	u_int32_t i;
+
+	table = kmalloc(n * sizeof(struct sfs_vnode *));
+	if (table == NULL) {
+		return;
+	}
+	bzero(table, n * sizeof(struct sfs_vnode *));
+
+	for (i=0; i<sfs->sfs_vnbuckets; i++) {
+		for (sv = sfs->sfs_vnodes[i]; sv != NULL; sv = next) {
+			next = sv->sv_hashnext;
+			sv->sv_hashnext = table[sv->sv_ino & (n - 1)];
+			table[sv->sv_ino & (n - 1)] = sv;
+		}
+	}
+
+	kfree(sfs->sfs_vnodes);
+	sfs->sfs_vnodes = table;
+	sfs->sfs_vnbuckets = n;
+}
+
+static
+void
+sfs_vninsert(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **chain;
+
+	if (sfs->sfs_nvnodes >= 2 * sfs->sfs_vnbuckets) {
+		sfs_vngrow(sfs);
+	}
+
+	chain = &sfs->sfs_vnodes[sv->sv_ino & (sfs->sfs_vnbuckets - 1)];
+	sv->sv_hashnext = *chain;
+	*chain = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnremove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **p;
+
+	p = &sfs->sfs_vnodes[sv->sv_ino & (sfs->sfs_vnbuckets - 1)];
+	while (*p != NULL && *p != sv) {
+		p = &(*p)->sv_hashnext;
+	}
+	if (*p == NULL) {
+		panic("sfs: reclaim vnode %u not in vnode pool\n",
+		      sv->sv_ino);
+	}
+	*p = sv->sv_hashnext;
+	sfs->sfs_nvnodes--;
+}
+
 /*
  * Function to load a inode into memory as a vnode, or dig up one
  * that's already resident.
@@ -1907,38 +2402,30 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
 	struct sfs_vnode *sv;
+	struct sfs_buf *buf;
 	const struct vnode_ops *ops = NULL;
-	int i, num;
 	int result;
 
 	lock_acquire(sfs->sfs_vnodes_lock);
 
 	/* Look in the vnodes table */
-	num = array_getnum(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		sv = array_getguy(sfs->sfs_vnodes, i);
-
+	sv = sfs_vnlookup(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: Found inode %u in unallocated block\n",
 			      sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* May only be set when creating new objects */
-			assert(forcetype==SFS_TYPE_INVAL);
+		/* May only be set when creating new objects */
+		assert(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_v);
+		VOP_INCREF(&sv->sv_v);
 
-			lock_release(sfs->sfs_vnodes_lock);
+		lock_release(sfs->sfs_vnodes_lock);
 
-			*ret = sv;
-			return 0;
-		}
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
@@ -1956,15 +2443,19 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_rblock(sfs, &sv->sv_i, ino);
+	result = sfs_bread(sfs, ino, &buf);
 	if (result) {
 		kfree(sv);
 		lock_release(sfs->sfs_vnodes_lock);
 		return result;
 	}
+	memcpy(&sv->sv_i, buf->b_data, SFS_BLOCKSIZE);
+	sfs_brelse(buf);
 
-	/* Not dirty yet */
+	/* Not dirty yet, and not read from */
 	sv->sv_dirty = 0;
+	sv->sv_nextoff = 0;
+	sv->sv_rablock = 0;
 
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
@@ -2005,13 +2496,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = array_add(sfs->sfs_vnodes, sv);
-	if (result) {
-		VOP_KILL(&sv->sv_v);
-		kfree(sv);
-		lock_release(sfs->sfs_vnodes_lock);
-		return result;
-	}
+	sfs_vninsert(sfs, sv);
 
 	lock_release(sfs->sfs_vnodes_lock);
 
@@ -2056,6 +2541,12 @@ sfs_setup_root(struct sfs_fs *sfs)
 		return 0;
 	}
 
+	/* As in sfs_mkdir */
+	if (SFS_HAS(sfs, SFS_FEATURE_HASHDIR)) {
+		root_sv->sv_i.sfi_size = SFS_HDIR_BUCKETS * SFS_BLOCKSIZE;
+		root_sv->sv_dirty = 1;
+	}
+
 	result = sfs_dir_link(root_sv, ".", SFS_ROOT_LOCATION, NULL);
         if (result) {
                 VOP_DECREF(root_vv);
@@ -203,15 +203,16 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Mapped pages are read and written through VOP_READ and
+ * VOP_WRITE, which doesn't make sense for most devices (and mapping
+ * a raw disk would go behind the back of the swap code), so refuse.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return ENODEV;
 }
 
 /*
@@ -0,0 +1,348 @@
+/*
+ * VFS name cache.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+
+/*
+ * What looking up a name in a directory came up with: the vnode (a
+ * positive entry) or nothing (a negative entry). Filesystems check
+ * here before searching a directory, enter what the search found, and
+ * remove a name once they've created, unlinked or renamed it.
+ *
+ * Entries are hashed by directory and name. Each holds a reference to
+ * its directory and to its vnode, so neither is reclaimed (or its
+ * memory reused for another vnode) while it's cached; at most NC_SIZE
+ * entries are kept, and the least recently used one makes way for a
+ * new one (as it does whenever the VM is short of memory, so the cache
+ * doesn't grow then). Unmounting a filesystem first drops all of its entries.
+ *
+ * A lookup that misses hands back nc_gen, which goes up whenever a
+ * name is removed. If it's changed by the time the search is done the
+ * directory may have changed under it, and vfs_ncenter() leaves the
+ * result out.
+ *
+ * nc_lock protects everything here. Vnode references are dropped only
+ * after it's released, since dropping the last one reclaims the vnode.
+ */
+#define NC_SIZE		128
+#define NC_BUCKETS	64
+#define NC_NAMELEN	32	/* longer names aren't cached */
+
+struct ncentry {
+	struct vnode *nc_dir;
+	struct vnode *nc_vn;		/* NULL for a negative entry */
+	char nc_name[NC_NAMELEN];
+	struct ncentry *nc_hashnext;
+	struct ncentry *nc_lruprev;	/* LRU list, most recently used first */
+	struct ncentry *nc_lrunext;
+};
+
+static struct lock *nc_lock;
+static struct ncentry *nc_hash[NC_BUCKETS];
+static struct ncentry *nc_lruhead, *nc_lrutail;
+static u_int32_t nc_count;
+static u_int32_t nc_gen;
+
+static struct kmem_cache ncentry_cache =
+	KMEM_CACHE_INITIALIZER("ncentry", sizeof(struct ncentry));
+
+static struct {
+	u_int32_t hits;		/* lookups answered with a vnode */
+	u_int32_t neghits;	/* ...with ENOENT */
+	u_int32_t misses;	/* lookups that had to search the directory */
+	u_int32_t enters;	/* entries made */
+	u_int32_t stale;	/* results left out because nc_gen changed */
+	u_int32_t removes;	/* entries dropped because a name changed */
+	u_int32_t evictions;	/* entries dropped to make room */
+} ncstats;
+
+void
+vfs_ncbootstrap(void)
+{
+	nc_lock = lock_create("namecache");
+	if (nc_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Hash table and LRU list. Callers hold nc_lock.
+
+static
+unsigned
+nc_bucket(struct vnode *dir, const char *name)
+{
+	u_int32_t h = (u_int32_t) dir >> 4;
+
+	while (*name) {
+		h = h * 33 + (unsigned char) *name++;
+	}
+	return h % NC_BUCKETS;
+}
+
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+
+	for (nc = nc_hash[nc_bucket(dir, name)]; nc != NULL;
+	     nc = nc->nc_hashnext) {
+		if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+lru_remove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	else nc_lruhead = nc->nc_lrunext;
+	if (nc->nc_lrunext != NULL) nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	else nc_lrutail = nc->nc_lruprev;
+	nc->nc_lruprev = nc->nc_lrunext = NULL;
+}
+
+static
+void
+lru_add(struct ncentry *nc)
+{
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) nc_lruhead->nc_lruprev = nc;
+	else nc_lrutail = nc;
+	nc_lruhead = nc;
+}
+
+/*
+ * Take an entry out of the cache and put it on the list *DEAD, for
+ * nc_free() to finish off once nc_lock has been released.
+ */
+static
+void
+nc_unlink(struct ncentry *nc, struct ncentry **dead)
+{
+	struct ncentry **p;
+
+	for (p = &nc_hash[nc_bucket(nc->nc_dir, nc->nc_name)]; *p != nc;
+	     p = &(*p)->nc_hashnext) {
+		assert(*p != NULL);
+	}
+	*p = nc->nc_hashnext;
+	lru_remove(nc);
+	nc_count--;
+
+	nc->nc_hashnext = *dead;
+	*dead = nc;
+}
+
+/* Drop the references held by unlinked entries, and free them */
+static
+void
+nc_free(struct ncentry *dead)
+{
+	struct ncentry *next;
+
+	for (; dead != NULL; dead = next) {
+		next = dead->nc_hashnext;
+		if (dead->nc_vn != NULL) {
+			VOP_DECREF(dead->nc_vn);
+		}
+		VOP_DECREF(dead->nc_dir);
+		kmem_cache_free(&ncentry_cache, dead);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Look NAME up in DIR. Returns 1 if the cache knows the answer, and
+ * sets *RET to the vnode, with a reference for the caller, or to NULL
+ * if there's no such name. Returns 0 if it doesn't, and sets *GEN for
+ * vfs_ncenter().
+ */
+int
+vfs_nclookup(struct vnode *dir, const char *name, struct vnode **ret,
+	     u_int32_t *gen)
+{
+	struct ncentry *nc;
+
+	lock_acquire(nc_lock);
+	nc = strlen(name) < NC_NAMELEN ? nc_find(dir, name) : NULL;
+	if (nc == NULL) {
+		ncstats.misses++;
+		*gen = nc_gen;
+		lock_release(nc_lock);
+		return 0;
+	}
+
+	lru_remove(nc);
+	lru_add(nc);
+	if (nc->nc_vn != NULL) {
+		VOP_INCREF(nc->nc_vn);
+		ncstats.hits++;
+	}
+	else {
+		ncstats.neghits++;
+	}
+	*ret = nc->nc_vn;
+	lock_release(nc_lock);
+	return 1;
+}
+
+/*
+ * Remember that NAME in DIR is VN (or, if VN is NULL, that there's no
+ * such name), as a search begun after vfs_nclookup() returned GEN
+ * found.
+ */
+void
+vfs_ncenter(struct vnode *dir, const char *name, struct vnode *vn,
+	    u_int32_t gen)
+{
+	struct ncentry *nc, *dead = NULL;
+	unsigned b;
+
+	if (strlen(name) >= NC_NAMELEN) {
+		return;
+	}
+
+	/* Allocate first: it can write pages back through a filesystem */
+	nc = kmem_cache_alloc(&ncentry_cache);
+	if (nc == NULL) {
+		return;
+	}
+
+	lock_acquire(nc_lock);
+	if (gen != nc_gen || nc_find(dir, name) != NULL) {
+		if (gen != nc_gen) {
+			ncstats.stale++;
+		}
+		lock_release(nc_lock);
+		kmem_cache_free(&ncentry_cache, nc);
+		return;
+	}
+
+	if (nc_count >= NC_SIZE || (nc_count > 0 && vm_memory_low())) {
+		nc_unlink(nc_lrutail, &dead);
+		ncstats.evictions++;
+	}
+
+	VOP_INCREF(dir);
+	nc->nc_dir = dir;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_vn = vn;
+	strcpy(nc->nc_name, name);
+
+	b = nc_bucket(dir, name);
+	nc->nc_hashnext = nc_hash[b];
+	nc_hash[b] = nc;
+	lru_add(nc);
+	nc_count++;
+	ncstats.enters++;
+	lock_release(nc_lock);
+
+	nc_free(dead);
+}
+
+/*
+ * Forget NAME in DIR. Call after changing the directory.
+ */
+void
+vfs_ncremove(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc, *dead = NULL;
+
+	lock_acquire(nc_lock);
+	nc_gen++;
+	nc = strlen(name) < NC_NAMELEN ? nc_find(dir, name) : NULL;
+	if (nc != NULL) {
+		nc_unlink(nc, &dead);
+		ncstats.removes++;
+	}
+	lock_release(nc_lock);
+
+	nc_free(dead);
+}
+
+/*
+ * Forget every entry for names in VN, or naming VN (a directory that's
+ * being removed).
+ */
+void
+vfs_ncpurge(struct vnode *vn)
+{
+	struct ncentry *nc, *next, *dead = NULL;
+
+	lock_acquire(nc_lock);
+	nc_gen++;
+	for (nc = nc_lruhead; nc != NULL; nc = next) {
+		next = nc->nc_lrunext;
+		if (nc->nc_dir == vn || nc->nc_vn == vn) {
+			nc_unlink(nc, &dead);
+			ncstats.removes++;
+		}
+	}
+	lock_release(nc_lock);
+
+	nc_free(dead);
+}
+
+/*
+ * Forget everything on FS, so its vnodes can be reclaimed before it's
+ * unmounted.
+ */
+void
+vfs_ncpurgefs(struct fs *fs)
+{
+	struct ncentry *nc, *next, *dead = NULL;
+
+	lock_acquire(nc_lock);
+	nc_gen++;
+	for (nc = nc_lruhead; nc != NULL; nc = next) {
+		next = nc->nc_lrunext;
+		if (nc->nc_dir->vn_fs == fs) {
+			nc_unlink(nc, &dead);
+		}
+	}
+	lock_release(nc_lock);
+
+	nc_free(dead);
+}
+
+void
+vfs_ncprintstats(void)
+{
+	struct ncentry *nc;
+	u_int32_t lookups, neg = 0;
+
+	lock_acquire(nc_lock);
+	for (nc = nc_lruhead; nc != NULL; nc = nc->nc_lrunext) {
+		if (nc->nc_vn == NULL) neg++;
+	}
+	lookups = ncstats.hits + ncstats.neghits + ncstats.misses;
+
+	kprintf("VFS name cache:\n");
+	kprintf("    entries: %u of %u, %u of them negative\n",
+		nc_count, NC_SIZE, neg);
+	kprintf("    lookups: %u hits, %u negative hits, %u misses "
+		"(%u%% hit rate)\n",
+		ncstats.hits, ncstats.neghits, ncstats.misses,
+		lookups ? (ncstats.hits + ncstats.neghits) * 100 / lookups : 0);
+	kprintf("    entered: %u, left out as stale: %u\n",
+		ncstats.enters, ncstats.stale);
+	kprintf("    dropped: %u for changed names, %u to make room\n",
+		ncstats.removes, ncstats.evictions);
+	lock_release(nc_lock);
+}
@@ -75,6 +75,7 @@ vfs_bootstrap(void)
         }
 
 	vfs_initbootfs();
+	vfs_ncbootstrap();
 	devnull_create();
 }
 
@@ -510,6 +511,9 @@ vfs_unmount(const char *devname)
 	assert(kd->kd_rawname != NULL);
 	assert(kd->kd_device != NULL);
 
+	/* Let go of the vnodes the name cache is holding */
+	vfs_ncpurgefs(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto puke;
@@ -557,6 +561,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vfs_ncpurgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -2,12 +2,12 @@
 #define _ADDRSPACE_H_
 
 #include <vm.h>
+#include <kern/vmstat.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
 
 #define TWO_LEV_PAGE_TABLE_SIZE 	1024		// 2^10
-#define USER_HEAP_MAX			1048576 	// 1MB
 
 #define READ_ONLY	0
 #define WRITEABLE	1
@@ -21,34 +21,83 @@ struct region {
 
 
 
+/*
+ * A loadable segment of the executable, recorded by load_elf() so that
+ * load_page() doesn't have to read the ELF headers again on every
+ * fault.
+ */
+struct segment {
+	off_t offset;		/* where its data starts in the file */
+	vaddr_t vaddr;		/* where it goes in memory */
+	size_t filesz;		/* bytes of data in the file */
+	size_t memsz;		/* bytes in memory (the rest is zeros) */
+	int flags;		/* PF_R, PF_W, PF_X */
+};
+
+/* One for each of the code and data regions (see as_define_region) */
+#define AS_MAXSEGMENTS	2
+
+/*
+ * A region set up by mmap(). Pages are faulted in by vm_fault(): from
+ * the file at OFFSET + (va - base), or zero-filled if VN is NULL
+ * (MAP_ANON). MAP_SHARED pages live in the page cache, and changes
+ * are written back to the file; MAP_PRIVATE pages are the process's
+ * own once written (or from the start, if the mapping is writeable).
+ */
+struct mmap_region {
+	vaddr_t base;
+	vaddr_t top;
+	int prot;		/* PROT_READ, PROT_WRITE, PROT_EXEC */
+	int flags;		/* MAP_SHARED or MAP_PRIVATE, maybe MAP_ANON */
+	struct vnode *vn;	/* holds a reference; NULL if anonymous */
+	off_t offset;
+	struct mmap_region *next;
+};
+
 /* Bits for page table entry*/
 #define PTE_VALID		0x00000001
 #define PTE_MODIFY		0x00000002
 #define PTE_REFERENCE		0x00000004
 #define PTE_RW			0x00000008
 #define PTE_EXECUTABLE		0x00000010
+#define PTE_SWAPPED		0x00000020
 
+#define PTE_FLAGS		0x00000fff
+#define PTE_PERMS		(PTE_RW | PTE_EXECUTABLE)
+#define PTE_FRAME		0xfffff000
+#define PTE_SLOT_SHIFT		12
 
 /* 
- * Page table entry - data structure associated with the page table
- * entries within our page tables.
+ * Page table entry - one packed 32-bit word per page:
+ *
+ *    0                           never touched, no page yet
+ *    perms only                  was loaded from the page cache, which
+ *                                has since dropped it; as good as 0
+ *    paddr | PTE_VALID | ...     resident in the page at paddr
+ *    slot << PTE_SLOT_SHIFT |
+ *          PTE_SWAPPED | ...     swapped out to swap slot `slot'
+ *
+ * The low 12 bits hold the flags above: PTE_RW/PTE_EXECUTABLE say how
+ * the page may be used, PTE_REFERENCE that it was touched since the
+ * clock hand last went by, PTE_MODIFY that it may be mapped writeable
+ * right now (unshared and already dirty). The UTLB refill handler in
+ * exception.S reads these directly, so keep the two in step.
+ * (pte_t itself is in vm.h.)
  */
-struct page_table_entry {
-	paddr_t paddr;
-	int permission;
-	int valid;
-	int swap_entry;
-	/*
-	 * Add more here (valid bit, etc.) when necessary.
-	 */
-};	
+
+#define PTE_PADDR(pte)		((paddr_t) ((pte) & PTE_FRAME))
+#define PTE_SLOT(pte)		((int) ((pte) >> PTE_SLOT_SHIFT))
+#define PTE_MKVALID(paddr, perms)	((paddr) | PTE_VALID | (perms))
+#define PTE_MKSWAPPED(slot, perms)	\
+	(((pte_t) (slot) << PTE_SLOT_SHIFT) | PTE_SWAPPED | (perms))
+#define PTE_UNTOUCHED(pte)	(((pte) & (PTE_VALID | PTE_SWAPPED)) == 0)
 
 /* 
  * Page table - data structure associated with the page tables
- * pointed to by our page directory.
+ * pointed to by our page directory. Exactly one page in size.
  */
 struct page_table {
-	struct page_table_entry* entries[TWO_LEV_PAGE_TABLE_SIZE];
+	pte_t entries[TWO_LEV_PAGE_TABLE_SIZE];
 };
 
 
@@ -58,7 +107,18 @@ struct page_table {
  */
 
 struct addrspace {
-	struct page_table* page_directory[TWO_LEV_PAGE_TABLE_SIZE];
+	/*
+	 * TWO_LEV_PAGE_TABLE_SIZE entries, exactly one page, allocated
+	 * on its own so it's always in kseg0: the UTLB refill handler
+	 * reads it through curpagedir and can't take a TLB miss.
+	 */
+	struct page_table** page_directory;
+	/*
+	 * Nonzero entries in each page table, so that teardown can stop
+	 * once it's seen them all and empty tables can be freed. Only
+	 * changed by the thread that owns the address space (see pte_set()).
+	 */
+	u_int16_t* pt_used;
 	char* progname;
 	struct vnode* progfile;
 	/* Address space regions */
@@ -67,10 +127,38 @@ struct addrspace {
 	struct region* heap;
 	struct region* user_heap;
 	struct region* stack;
-	/* A flag for TLB stuff */
-	int done_loading_code_page; 
+	/* The executable's loadable segments */
+	struct segment segments[AS_MAXSEGMENTS];
+	int nsegments;
+	/*
+	 * mmap() regions, which are put below the stack's limit, each
+	 * USER_STACK_GUARD below the one before. mmap_base is the lowest
+	 * address in use there (the stack limit if there are none); the
+	 * heap has to stay a guard region short of it.
+	 */
+	struct mmap_region *mmaps;
+	vaddr_t mmap_base;
+	/* TLB address space ID, valid while asid_generation is current */
+	u_int32_t asid;
+	u_int32_t asid_generation;
+	/*
+	 * Paging statistics, for getvmstat(). vs_resident and vs_swapped
+	 * are kept by pte_set(); vs_freepages and vs_totalpages are unused.
+	 * The UTLB refill handler counts vs_tlbmisses through curtlbmisses,
+	 * so this has to be in kseg0 too: kmalloc() keeps anything under
+	 * a page there, which is why the big arrays above are separate.
+	 */
+	struct vmstat as_stats;
 };
 
+/*
+ * Bumped each time the address space IDs run out and the TLB is
+ * flushed. An address space whose asid_generation is older has nothing
+ * in the TLB.
+ */
+extern u_int32_t asid_generation;
+#define AS_IN_TLB(as)	((as)->asid_generation == asid_generation)
+
 /*
  * Functions in addrspace.c:
  *
@@ -103,6 +191,17 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_mmap   - add a mmap() region of LEN bytes mapping VN (or
+ *                nothing) from OFFSET. Hands back its address.
+ *
+ *    as_munmap - remove the mmap() regions in a range of addresses,
+ *                writing back anything they changed in a shared file.
+ *
+ *    as_msync  - write back what's been changed in the shared file
+ *                mappings in a range of addresses.
+ *
+ *    as_mmap_find - the mmap() region VA is in, or NULL.
  */
 
 struct addrspace *as_create(char *progname);
@@ -119,6 +218,13 @@ int		  as_prepare_load(struct addrspace *as);
 int		  as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+int               as_mmap(struct addrspace *as, size_t len, int prot,
+			  int flags, struct vnode *vn, off_t offset,
+			  vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t addr, size_t len);
+struct mmap_region *as_mmap_find(struct addrspace *as, vaddr_t va);
+
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
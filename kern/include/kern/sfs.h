@@ -12,6 +12,7 @@
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
 #define SFS_MAP_LOCATION   2            /* 1st block of the freemap */
 #define SFS_NOINO          0            /* inode # for free dir entry */
+#define SFS_DIRPERBLK      8            /* # dir entries per block */
 
 /* Number of bits in a block */
 #define SFS_BLOCKBITS (SFS_BLOCKSIZE * CHAR_BIT)
@@ -30,6 +31,32 @@
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/*
+ * Feature flags for sp_features (set by mksfs -h). A kernel or tool
+ * that finds a flag it doesn't know must leave the filesystem alone.
+ *
+ * SFS_FEATURE_DINDIRECT: inodes may have a double indirect block, so
+ * files can be bigger than SFS_NDIRECT+SFS_DBPERIDB blocks.
+ *
+ * SFS_FEATURE_HASHDIR: directories are hash tables of SFS_HDIR_BUCKETS
+ * blocks ("buckets") of entries, and their size is always that many
+ * blocks. A name hashes to a bucket (the djb2 hash: h = h*33 + c over
+ * its characters starting from 5381, mod SFS_HDIR_BUCKETS; "." and ".."
+ * hash to 0 and are the first two entries). Its entry goes in the first
+ * free slot of that bucket or the ones after it, wrapping around, and a
+ * search for it stops at a bucket that has a slot that's never been
+ * used. A removed entry is marked with SFS_HDIR_DELETED so searches
+ * go past it, unless its bucket still has a never-used slot (searches
+ * stop there anyway). Buckets nothing has been put in are holes. Needs
+ * SFS_FEATURE_DINDIRECT.
+ */
+#define SFS_FEATURE_DINDIRECT  0x00000001
+#define SFS_FEATURE_HASHDIR    0x00000002
+#define SFS_FEATURES           0x00000003   /* all of the above */
+
+#define SFS_HDIR_BUCKETS   2048         /* blocks in a hashed directory */
+#define SFS_HDIR_DELETED   0xff         /* sfd_name[0] of removed entry */
+
 /*
  * On-disk superblock
  */
@@ -37,7 +64,8 @@ struct sfs_super {
 	u_int32_t sp_magic;       /* Magic number, should be SFS_MAGIC */
 	u_int32_t sp_nblocks;     /* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];  /* Name of this volume */
-	u_int32_t reserved[118];
+	u_int32_t sp_features;    /* SFS_FEATURE_* flags */
+	u_int32_t reserved[117];
 };
 
 /*
@@ -49,7 +77,8 @@ struct sfs_inode {
 	u_int16_t sfi_linkcount;   /* Number of hard links to this file */
 	u_int32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	u_int32_t sfi_indirect;			/* Indirect block */
-	u_int32_t sfi_waste[128-3-SFS_NDIRECT]; /* unused space */
+	u_int32_t sfi_dindirect;		/* Double indirect block */
+	u_int32_t sfi_waste[128-4-SFS_NDIRECT]; /* unused space */
 };
 
 /*
@@ -34,6 +34,23 @@
 #define SEEK_CUR      1      /* Seek relative to current position in file */
 #define SEEK_END      2      /* Seek relative to end of file */
 
+/* Protection for mmap: PROT_NONE, or any of the others */
+#define PROT_NONE     0      /* Not accessible (not supported) */
+#define PROT_READ     1      /* Pages can be read */
+#define PROT_WRITE    2      /* Pages can be written */
+#define PROT_EXEC     4      /* Pages can be executed */
+
+/* Flags for mmap: choose one of these: */
+#define MAP_SHARED    1      /* Changes go to the file, and are seen by others */
+#define MAP_PRIVATE   2      /* Changes are private to this process */
+/* then or in any of these: */
+#define MAP_ANON     16      /* Not backed by a file: zero-filled (private only) */
+
+/* Flags for msync */
+#define MS_SYNC       1      /* Write back before returning */
+#define MS_ASYNC      2      /* Same as MS_SYNC here */
+#define MS_INVALIDATE 4      /* Ignored */
+
 /* The codes for ioctl are in kern/ioctl.h */
 /* The codes for stat/fstat/lstat are in kern/stat.h */
 
@@ -0,0 +1,24 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * Memory and paging statistics, for getvmstat(): of one process, or of
+ * the whole system. The counters run from when the process was started
+ * (exec or fork) or the system booted; the rest are current values.
+ */
+
+struct vmstat {
+	u_int32_t vs_tlbmisses;		/* TLB misses, refilled fast or not */
+	u_int32_t vs_minflt;		/* page faults handled without disk I/O */
+	u_int32_t vs_majflt;		/* page faults that waited for the disk */
+	u_int32_t vs_swapins;		/* pages read back from swap */
+	u_int32_t vs_swapouts;		/* pages written to swap */
+	u_int32_t vs_filereads;		/* pages read in from executables and mmap()ed files */
+	u_int32_t vs_zerofills;		/* zero-filled pages handed out */
+	u_int32_t vs_resident;		/* pages in memory (now) */
+	u_int32_t vs_swapped;		/* swap slots held (now) */
+	u_int32_t vs_freepages;		/* free pages in the system (now) */
+	u_int32_t vs_totalpages;	/* pages in the system (now) */
+};
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -89,8 +89,41 @@ u_int32_t random(void);
  */
 void *kmalloc(size_t sz);
 void kfree(void *ptr);
+void kheap_bootstrap(void);
 void kheap_printstats(void);
 
+/*
+ * Object caches, for structures the kernel allocates and frees often.
+ * Define one for each type with
+ *
+ *     static struct kmem_cache foo_cache =
+ *         KMEM_CACHE_INITIALIZER("foo", sizeof(struct foo));
+ *
+ * and use kmem_cache_alloc/kmem_cache_free in place of kmalloc/kfree.
+ * The cache keeps up to KMEM_MAGSIZE freed objects (its "magazine") to
+ * hand straight back out. Objects must be no bigger than 2048 bytes.
+ * kmalloc and kfree use caches of their own for each block size.
+ */
+#define KMEM_MAGSIZE 16
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;
+	unsigned kc_nmag;		/* objects in kc_mag */
+	void *kc_mag[KMEM_MAGSIZE];
+	unsigned kc_allocs;		/* calls to kmem_cache_alloc */
+	unsigned kc_hits;		/* ... served from kc_mag */
+	unsigned kc_frees;
+	struct kmem_cache *kc_next;	/* list of caches in use */
+	int kc_listed;
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size) \
+	{ (name), (size), 0, { NULL }, 0, 0, 0, NULL, 0 }
+
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *ptr);
+
 /*
  * C string functions. 
  *
@@ -18,21 +18,36 @@ struct sfs_vnode {
 	struct sfs_inode sv_i;		/* on-disk inode */
 	u_int32_t sv_ino;               /* inode number */
 	int sv_dirty;                   /* true if sv_i modified */
+	off_t sv_nextoff;               /* where the last read ended */
+	u_int32_t sv_rablock;           /* file block read-ahead has reached */
+	struct sfs_vnode *sv_hashnext;  /* next in its sfs_vnodes chain */
 };
 
+/*
+ * Loaded vnodes are hashed by inode number. The table starts out with
+ * SFS_VNODE_BUCKETS chains, and doubles whenever there are more than
+ * twice as many vnodes as chains.
+ */
+#define SFS_VNODE_BUCKETS	32
+
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	int sfs_superdirty;             /* true if superblock modified */
 	struct lock *sfs_super_lock;	/* lock for sfs_super and sfs_superdirty */
 	struct device *sfs_device;      /* device mounted on */
-	struct array *sfs_vnodes;       /* vnodes loaded into memory */
+	struct sfs_vnode **sfs_vnodes;  /* vnodes loaded into memory */
+	u_int32_t sfs_vnbuckets;        /* chains in sfs_vnodes (a power of 2) */
+	u_int32_t sfs_nvnodes;          /* vnodes in it */
 	struct lock *sfs_vnodes_lock;	/* lock for sfs_vnodes */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	int sfs_freemapdirty;           /* true if freemap modified */
 	struct lock *sfs_freemap_lock;	/* lock for sfs_freemap and sfs_freemapdirty */
 };
 
+/* Features of the on-disk format (SFS_FEATURE_* in kern/sfs.h) */
+#define SFS_HAS(sfs, feature)	(((sfs)->sfs_super.sp_features & (feature)) != 0)
+
 /*
  * Function for mounting a sfs (calls vfs_mount)
  */
@@ -52,9 +67,83 @@ int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 
+/*
+ * Clustering. Runs of up to SFS_CLUSTER blocks that are next to each
+ * other on disk go to or from the device in one request: whole blocks
+ * of files that aren't cached (sfs_rwblocks()), and dirty blocks the
+ * buffer cache writes back. Once a file is being read sequentially, up
+ * to SFS_READAHEAD blocks past where the last read ended are read into
+ * the buffer cache in the background (sfs_breadahead()).
+ */
+#define SFS_CLUSTER		16
+#define SFS_READAHEAD		32
+
+int sfs_rwblocks(struct sfs_fs *sfs, struct uio *uio, u_int32_t block,
+		 u_int32_t n);
+
+/* What sfs_rwblocks() has done, for "bc" */
+struct sfs_iostats {
+	u_int32_t requests;             /* device requests */
+	u_int32_t blocks;               /* blocks they moved */
+};
+extern struct sfs_iostats sfs_iostats;
+
+/*
+ * Buffer cache (sfs_cache.c). It holds up to 1/SFS_CACHE_DIV of the
+ * user pages' worth of blocks (but at least SFS_CACHE_MIN), fewer while
+ * the VM is short of memory.
+ */
+#define SFS_CACHE_DIV		16
+#define SFS_CACHE_MIN		16
+#define SFS_CACHE_BUCKETS	128
+
+/*
+ * A block in the buffer cache. Whoever sfs_bread(), sfs_bget() or
+ * sfs_bpeek() handed it to has it to themselves until they call
+ * sfs_brelse(), and sets b_dirty if they change b_data.
+ */
+struct sfs_buf {
+	struct sfs_fs *b_sfs;           /* filesystem it belongs to */
+	struct device *b_dev;           /* with b_block, what it's hashed by */
+	u_int32_t b_block;              /* block number */
+	void *b_data;                   /* SFS_BLOCKSIZE bytes */
+	int b_dirty;                    /* true if b_data modified */
+	int b_valid;                    /* true once b_data holds the block */
+	int b_busy;                     /* handed out (not on the LRU list) */
+	struct sfs_buf *b_hashnext;     /* next in hash chain */
+	struct sfs_buf *b_lruprev;      /* LRU list, most recently used first */
+	struct sfs_buf *b_lrunext;
+};
+
+/*
+ * sfs_bread reads the block in if it isn't cached. sfs_bget is for a
+ * caller about to overwrite the whole block, and doesn't: a block that
+ * isn't cached comes back zeroed. sfs_bpeek only hands back a block
+ * that's already cached, and sets *RET to NULL if it isn't; sfs_bcached
+ * just says whether it is. sfs_breadahead queues N blocks from BLOCK to
+ * be read into the cache, in one request, by the read-ahead thread.
+ */
+int sfs_cache_bootstrap(void);
+int sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+int sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+int sfs_bpeek(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+void sfs_brelse(struct sfs_buf *buf);
+int sfs_bcached(struct sfs_fs *sfs, u_int32_t block);
+void sfs_breadahead(struct sfs_fs *sfs, u_int32_t block, u_int32_t n);
+
+/* Forget a freed block; write back dirty blocks; drop them all at unmount */
+void sfs_binval(struct sfs_fs *sfs, u_int32_t block);
+int sfs_bflush(struct sfs_fs *sfs);
+void sfs_bpurge(struct sfs_fs *sfs);
+
+void sfs_cache_printstats(void);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
+/* Put a vnode's inode in the buffer cache, if it's changed */
+int sfs_sync_inode(struct sfs_vnode *sv);
+
 /* Setup root directory on first mount */
 int sfs_setup_root(struct sfs_fs *sfs);
 
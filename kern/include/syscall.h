@@ -40,5 +40,10 @@ int sys_sync(int *ret);
 int sys_fsync(int filehandle, int *ret);
 int sys_getdirentry(int filehandle, char *buf, size_t buflen, int *ret);
 int sys_dup2(int filehandle, int newhandle, int *ret);
+int sys___time(userptr_t secs, userptr_t nsecs, int *ret);
+int sys_mmap(struct trapframe *tf, int *ret);
+int sys_munmap(void *addr, size_t len, int *ret);
+int sys_msync(void *addr, size_t len, int flags, int *ret);
+int sys_getvmstat(pid_t pid, userptr_t buf, int *ret);
 
 #endif /* _SYSCALL_H_ */
@@ -39,10 +39,14 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int pagealloctest(int, char **);
+int fragtest(int, char **);
+int kvatlbtest(int, char **);
 int nettest(int, char **);
 
 /* Kernel menu system */
 void menu(char *argstr);
+int menu_runprog(int nargs, char **args);
 
 /* Routine for running userlevel test code. */
 int runprogram(char *progname, char **args, int argc);
@@ -85,6 +85,33 @@ int vfs_rename(char *oldpath, char *newpath);
 int vfs_chdir(char *path);
 int vfs_getcwd(struct uio *buf);
 
+/*
+ * Name cache (vfscache.c), for filesystems to look path components up
+ * in before searching a directory.
+ *
+ *    vfs_nclookup   - Look up NAME in DIR. Returns 1 if the answer is
+ *                     cached: *RESULT is the vnode (with a reference)
+ *                     or NULL if there's no such name. Returns 0 if
+ *                     it isn't, and sets *GEN.
+ *    vfs_ncenter    - Cache what a search of DIR for NAME found (VN,
+ *                     or NULL for nothing), given the GEN from the
+ *                     vfs_nclookup that missed.
+ *    vfs_ncremove   - Forget NAME in DIR, after creating, unlinking or
+ *                     renaming it.
+ *    vfs_ncpurge    - Forget every name in, or naming, a directory
+ *                     that's being removed.
+ *    vfs_ncpurgefs  - Forget everything on a filesystem (for unmount).
+ */
+
+int vfs_nclookup(struct vnode *dir, const char *name, struct vnode **result,
+		 u_int32_t *gen);
+void vfs_ncenter(struct vnode *dir, const char *name, struct vnode *vn,
+		 u_int32_t gen);
+void vfs_ncremove(struct vnode *dir, const char *name);
+void vfs_ncpurge(struct vnode *vn);
+void vfs_ncpurgefs(struct fs *fs);
+void vfs_ncprintstats(void);
+
 /*
  * Misc
  *
@@ -95,6 +122,8 @@ int vfs_getcwd(struct uio *buf);
  *                    bootfs-related structures. (Called from 
  *                    vfs_bootstrap.)
  *
+ *    vfs_ncbootstrap - Likewise, for the name cache.
+ *
  *    vfs_setbootfs - Set the filesystem that paths beginning with a
  *                    slash are sent to. If not set, these paths fail
  *                    with ENOENT. The argument should be the device
@@ -137,6 +166,7 @@ int vfs_getcwd(struct uio *buf);
 void vfs_bootstrap(void);
 
 void vfs_initbootfs(void);
+void vfs_ncbootstrap(void);
 int vfs_setbootfs(const char *fsname);
 void vfs_clearbootfs(void);
 
@@ -8,21 +8,150 @@
  */
 
 struct addrspace;
-struct page_table_entry;
+struct vnode;
+struct lock;
+
+/* Packed page table entry; the format is described in addrspace.h */
+typedef u_int32_t pte_t;
+
+/*
+ * An additional mapping of a shared physical page. The coremap entry
+ * of a page records its first mapping; every other address space
+ * sharing the page (after fork) hangs off it in a list of these.
+ */
+struct page_mapping {
+	struct addrspace *as;
+	vaddr_t va;
+	struct page_mapping *next;
+};
+
+/* Where they come from (vm.c) */
+extern struct kmem_cache mapping_cache;
 
 /* Flag set after VM has been initialized (vm_bootstrap()) */
 extern int vm_init_flag;
+
+/* Protects the coremap, and with it swap slots and the swap cache */
+extern struct lock *CoreMapLock;
 extern int TLB_replacement_counter;
 
+/*
+ * VM statistics. Bumped on the fault/fork paths, printed by
+ * vm_printstats() (the "vs" kernel menu command).
+ */
+struct vm_stats {
+	u_int32_t fork_pages_shared;	/* pages shared copy-on-write by as_copy() */
+	u_int32_t fork_pages_copied;	/* pages copied by as_copy() (swapped-out parent pages) */
+	u_int32_t cow_faults;		/* write faults on pages mapped copy-on-write */
+	u_int32_t cow_copies;		/* copy-on-write faults that had to copy the page */
+	u_int32_t faults;		/* calls to vm_fault() */
+	u_int32_t minor_faults;		/* user faults handled without disk I/O */
+	u_int32_t major_faults;		/* ...and that read from swap or a file */
+	u_int32_t evictions;		/* pages taken away from a user to satisfy an allocation */
+	u_int32_t swapouts;		/* pages written to swap */
+	u_int32_t swapins;		/* pages read back from swap */
+	u_int32_t swap_writes;		/* write requests to the swap device */
+	u_int32_t swap_clustered;	/* ...pages written along with an evicted one */
+	u_int32_t swap_reads;		/* read requests to the swap device */
+	u_int32_t swap_readaheads;	/* ...pages read along with a faulting one */
+	u_int32_t clock_second_chances;	/* referenced pages the clock hand skipped */
+	u_int32_t sync_evictions;	/* evictions done by a thread waiting for a page */
+	u_int32_t background_evictions;	/* evictions done by the pageout thread */
+	u_int32_t pageout_wakeups;	/* times the pageout thread was woken */
+	u_int32_t busy_waits;		/* times a thread waited for a page in transit */
+	u_int32_t page_tables;		/* page tables currently allocated (not a counter) */
+	u_int32_t tlb_slow_misses;	/* TLB misses passed on to vm_fault() */
+	u_int32_t tlb_modify_faults;	/* writes through read-only TLB entries */
+	u_int32_t exec_loads;		/* pages loaded from executables */
+	u_int32_t exec_readaheads;	/* ...of which loaded ahead of a fault */
+	u_int32_t file_reads;		/* pages read in from executables and mmap()ed files */
+	u_int32_t pagecache_hits;	/* code pages found in the page cache */
+	u_int32_t pagecache_misses;	/* code pages read in and added to it */
+	u_int32_t pagecache_evictions;	/* page cache pages evicted (unmapped everywhere) */
+	u_int32_t pagecache_pages;	/* pages in the page cache (not a counter) */
+	u_int32_t stack_pages;		/* stack pages touched for the first time */
+	u_int32_t stack_overflows;	/* faults past the stack limit or in the guard region */
+	u_int32_t heap_pages_freed;	/* pages given back by sbrk() shrinking the heap */
+	u_int32_t mmap_faults;		/* first touches of mmap() pages */
+	u_int32_t mmap_writebacks;	/* MAP_SHARED pages written back to their file */
+	u_int32_t teardown_ptes;	/* page table entries unmapped by as_destroy() */
+	u_int32_t pages_prezeroed;	/* free pages zeroed by the idle loop */
+	u_int32_t zero_hits;		/* anonymous pages that came from the pre-zeroed pool */
+	u_int32_t zero_misses;		/* ...and that had to be zeroed by the faulting thread */
+	u_int32_t as_switches;		/* as_activate() calls */
+	u_int32_t asid_rollovers;	/* TLB flushes because address space IDs ran out */
+	u_int32_t kva_allocs;		/* multi-page kernel allocations mapped in kseg2 */
+	u_int32_t kva_faults;		/* TLB misses on kseg2 addresses */
+};
+
+extern struct vm_stats vmstats;
+
+/*
+ * Used by the UTLB refill handler in exception.S: the page directory of
+ * the address space whose translations it may load (set by
+ * as_activate(), NULL if none), the number of misses it handled
+ * without calling vm_fault(), and where that address space counts its
+ * TLB misses (valid while curpagedir is set).
+ */
+extern struct page_table **curpagedir;
+extern u_int32_t tlb_fast_refills;
+extern u_int32_t *curtlbmisses;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
-/* The maximum size of a user process's stack - even this is generous */
-#define USER_STACK_MAX	262144
+/*
+ * The maximum size of a user process's stack. It grows down on demand,
+ * a page per first touch, anywhere within this much of the top. The
+ * USER_STACK_GUARD bytes below the lowest address it may grow to are
+ * kept clear of the heap, so a stack that overflows faults instead of
+ * running into it.
+ */
+#define USER_STACK_MAX		1048576		/* 1MB */
+#define USER_STACK_GUARD	65536
+
+/*
+ * Default limit on how far sbrk() lets a process's heap grow. It can
+ * be changed at the kernel menu ("hm"); the stack guard still applies.
+ */
+#define USER_HEAP_MAX		1048576		/* 1MB */
+extern size_t user_heap_max;
+
+/* Pages after a faulting executable page that get loaded along with it */
+#define EXEC_READAHEAD	4
+
+/* Raw disk we swap to; its size determines how much swap there is */
+#define	SWAP_DEVICE		"lhd0raw:"
+
+/*
+ * Most pages written to or read from swap in one request. How many
+ * are (swap_cluster, 1 for no clustering) can be changed at the kernel
+ * menu ("sc").
+ */
+#define SWAP_CLUSTER		8
+extern u_int32_t swap_cluster;
+
+/*
+ * The pageout thread is woken when fewer than 1/PAGEOUT_LOWAT_DIV of
+ * the user pages (but at least PAGEOUT_MIN) are free, and evicts until
+ * twice that many are.
+ */
+#define PAGEOUT_LOWAT_DIV	32
+#define PAGEOUT_MIN		4
+
+/* The idle loop keeps up to 1/ZEROPOOL_DIV of the user pages pre-zeroed */
+#define ZEROPOOL_DIV		8
 
-#define	SWAPTABLE_SIZE		2048
+/*
+ * Compressed swap cache (vm/zcache.c). When it's on, its pool takes up
+ * to 1/ZCACHE_DIV of the user pages, in ZCACHE_CHUNK-byte pieces; pages
+ * that don't compress to ZCACHE_MAXLEN bytes or less go to disk.
+ */
+#define ZCACHE_DIV		8
+#define ZCACHE_CHUNK		256
+#define ZCACHE_MAXLEN		(PAGE_SIZE / 2)
 
 /* Page states */
 #define PAGE_FREE	0
@@ -33,6 +162,7 @@ extern int TLB_replacement_counter;
 /* For alloc_page() and alloc-npages() */
 #define USER_ALLOC	0
 #define KERNEL_ALLOC	1
+#define USER_ZERO_ALLOC	2	/* USER_ALLOC, zero-filled */
 
 /* For free_pages() */
 #define USER_FREE	0
@@ -43,9 +173,11 @@ extern int TLB_replacement_counter;
 #define DATA_REGION	1
 #define HEAP_REGION	2
 #define STACK_REGION 	3
+#define MMAP_REGION	4
 
-/* Initialization function */
+/* Initialization functions */
 void vm_bootstrap(void);
+void swap_bootstrap(void);
 
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
@@ -53,18 +185,90 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(int npages);
 
-/* Allocate/free (a) page(s) of physical memory */
+/*
+ * Allocate/free (a) page(s) of physical memory. User pages come back
+ * busy (safe from eviction); call page_unbusy() once they're mapped
+ * and filled in.
+ */
 paddr_t page_alloc(int alloc_type, vaddr_t vaddr, struct addrspace *as);
+void page_unbusy(paddr_t paddr);
 paddr_t page_nalloc(int alloc_type, int npages);
 void page_free(int free_type, vaddr_t vaddr);
-void free_all_user_pages(struct addrspace *as);
+
+/* Zero a page for the pre-zeroed pool; called by the idle loop */
+int page_prezero(void);
+
+/* Copy-on-write sharing of user pages (see as_copy()) */
+int page_share(pte_t *pte, struct addrspace *as, vaddr_t vaddr,
+	       struct page_mapping *mapping);
+void page_unmap(pte_t *pte, struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Unmap the pages of AS in [start, end), e.g. when the heap shrinks;
+ * returns how many were resident. vm_msync writes back what AS changed
+ * in MAP_SHARED pages in [start, end); vm_sync_file does the same for
+ * every mapped page of a file, whoever has it mapped.
+ */
+u_int32_t vm_unmap(struct addrspace *as, vaddr_t start, vaddr_t end);
+int vm_msync(struct addrspace *as, vaddr_t start, vaddr_t end);
+int vm_sync_file(struct vnode *vn);
+
+int swapin_page(paddr_t paddr, int swap_entry);
+
+/*
+ * Compressed swap cache. The store/load/drop hooks are called by the
+ * swap code with CoreMapLock held.
+ */
+void zcache_bootstrap(u_int32_t nslots, u_int32_t maxpages);
+int zcache_enable(int on);
+int zcache_store(int slot, paddr_t paddr);
+int zcache_load(int slot, paddr_t paddr);
+int zcache_drop(int slot);
+void zcache_printstats(void);
 
 /* Page table functions */
-void write_pte(struct page_table_entry* pte, paddr_t paddr, int permission, int swap_entry);
 int create_page_table(struct addrspace* as, int page_dir_index);
+void destroy_page_table(struct addrspace* as, int page_dir_index);
+void pte_set(struct addrspace *as, vaddr_t vaddr, pte_t *pte, pte_t val);
+void tlb_flush_as(struct addrspace *as);
 
 /*flush a dirty page to disk*/
 void page_flush( int page_num);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Pages that needn't be physically contiguous, mapped together in
+ * kseg2 (for big kmallocs). kva_free() is what free_kpages() does
+ * with a kseg2 address.
+ */
+vaddr_t kva_alloc(int npages);
+void kva_free(vaddr_t addr);
+void page_set_kheap(vaddr_t kva, void *ref);
+void *page_kheap(vaddr_t kva);
+
+/* Print the counters in vmstats */
+void vm_printstats(void);
+
+/* System-wide numbers for getvmstat() */
+struct vmstat;
+void vm_getstats(struct vmstat *vs);
+
+/*
+ * For kernel caches that size themselves to memory (the SFS buffer
+ * cache): how many pages users can have, and whether free pages are
+ * down to where the pageout thread gets woken.
+ */
+u_int32_t vm_user_pages(void);
+int vm_memory_low(void);
+
+/*
+ * Page replacement policy used when memory runs out: "fifo" or "clock"
+ * (the default). vm_set_policy returns EINVAL for an unknown name.
+ */
+int vm_set_policy(const char *name);
+const char *vm_policy_name(void);
+
+/* Set swap_cluster; EINVAL unless it's 1 to SWAP_CLUSTER */
+int vm_set_swap_cluster(u_int32_t npages);
+
 #endif /* _VM_H_ */
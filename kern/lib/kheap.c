@@ -39,7 +39,16 @@ fill_deadbeef(void *vptr, size_t len)
 //    The free counts and addresses of the pages are maintained in
 //    another list.  Maintaining this table is a nuisance, because it
 //    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    make that work, but it would be painful.) The coremap entry of
+//    each page points back at its entry, so kfree can find it without
+//    searching.
+//
+//    In front of all that sit object caches (struct kmem_cache): one
+//    per block size, which kmalloc and kfree go through, plus any the
+//    rest of the kernel defines for structures it allocates and frees
+//    a lot. Each keeps a magazine of recently freed objects, which it
+//    hands out again without touching the pages' freelists. With one
+//    CPU, a magazine only needs interrupts off for a moment.
 //
 
 #undef  SLOW	/* consistency checks */
@@ -84,67 +93,65 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Pagerefs come a page of them at a time: 256, each managing 4k of
+ * kernel heap. The first page is in the kernel BSS, so there's one
+ * before there's anything to allocate pages with; after that, another
+ * page is allocated whenever they run out. (Those are never given
+ * back; it's only 1/256 of the heap at its largest.) Free ones are
+ * kept on freepagerefs, linked through next_samesize.
  */
 
 #define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
 static struct pageref pagerefs[NPAGEREFS];
+static struct pageref *freepagerefs;
+static unsigned npagerefpages, npagerefs_inuse;
+
+static
+void
+addpagerefs(struct pageref *prs)
+{
+	unsigned i;
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static u_int32_t pagerefs_inuse[INUSE_WORDS];
+	for (i=0; i<NPAGEREFS; i++) {
+		prs[i].next_samesize = freepagerefs;
+		freepagerefs = &prs[i];
+	}
+	npagerefpages++;
+}
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	u_int32_t k;
+	struct pageref *pr;
+	vaddr_t page;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
+	if (npagerefpages == 0) {
+		addpagerefs(pagerefs);
+	}
+
+	if (freepagerefs == NULL) {
+		page = alloc_kpages(1);
+		if (page == 0) {
+			/* ran out */
+			return NULL;
 		}
-		assert(0);
+		addpagerefs((struct pageref *)page);
 	}
 
-	/* ran out */
-	return NULL;
+	pr = freepagerefs;
+	freepagerefs = pr->next_samesize;
+	npagerefs_inuse++;
+	return pr;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	u_int32_t k;
-
-	j = p-pagerefs;
-	assert(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((u_int32_t)1) << (j%32);
-	assert((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	p->next_samesize = freepagerefs;
+	freepagerefs = p;
+	npagerefs_inuse--;
 }
 
 ////////////////////////////////////////
@@ -215,18 +222,20 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			assert(sc < NPAGEREFS);
+			assert(sc < npagerefs_inuse);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		assert(ac < NPAGEREFS);
+		assert(pr == page_kheap(PR_PAGEADDR(pr)) || !vm_init_flag);
+		assert(ac < npagerefs_inuse);
 		ac++;
 	}
 
 	assert(sc==ac);
+	assert(ac==npagerefs_inuse);
 }
 #else
 #define checksubpages() 
@@ -285,10 +294,30 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+////////////////////////////////////////
+
+static struct kmem_cache sizecaches[NSIZES] = {
+	KMEM_CACHE_INITIALIZER("kmalloc-16", 16),
+	KMEM_CACHE_INITIALIZER("kmalloc-32", 32),
+	KMEM_CACHE_INITIALIZER("kmalloc-64", 64),
+	KMEM_CACHE_INITIALIZER("kmalloc-128", 128),
+	KMEM_CACHE_INITIALIZER("kmalloc-256", 256),
+	KMEM_CACHE_INITIALIZER("kmalloc-512", 512),
+	KMEM_CACHE_INITIALIZER("kmalloc-1024", 1024),
+	KMEM_CACHE_INITIALIZER("kmalloc-2048", 2048),
+};
+
+/* Every cache that's been used, for kheap_printstats() */
+static struct kmem_cache *allcaches;
+
+////////////////////////////////////////
+
 void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	struct kmem_cache *kc;
+	unsigned hitrate;
 
 	/* print the whole thing with interrupts off */
 	int spl = splhigh();
@@ -299,6 +328,19 @@ kheap_printstats(void)
 		dumpsubpage(pr);
 	}
 
+	kprintf("%u pagerefs in use, %u pages of them\n",
+		npagerefs_inuse, npagerefpages);
+
+	kprintf("Object caches:\n");
+	kprintf("    %-16s %5s %9s %9s %8s %5s\n",
+		"name", "size", "allocs", "frees", "hit rate", "held");
+	for (kc = allcaches; kc != NULL; kc = kc->kc_next) {
+		hitrate = kc->kc_allocs ? kc->kc_hits * 100 / kc->kc_allocs : 0;
+		kprintf("    %-16s %5lu %9u %9u %7u%% %5u\n",
+			kc->kc_name, (unsigned long) kc->kc_size,
+			kc->kc_allocs, kc->kc_frees, hitrate, kc->kc_nmag);
+	}
+
 	splx(spl);
 }
 
@@ -430,6 +472,7 @@ subpage_kmalloc(size_t sz)
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
+	page_set_kheap(prpage, pr);
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -459,14 +502,50 @@ subpage_kmalloc(size_t sz)
 	goto doalloc;
 }
 
+/*
+ * Find the pageref for the page PTR is on, or NULL if it's not one of
+ * ours (so it's a multi-page allocation). Once the VM system is up, the
+ * coremap says; before that, we have to look.
+ */
 static
-int
-subpage_kfree(void *ptr)
+struct pageref *
+subpage_lookup(void *ptr)
+{
+	struct pageref *pr;
+	vaddr_t ptraddr = (vaddr_t)ptr;
+	int spl;
+
+	if (vm_init_flag) {
+		pr = page_kheap(ptraddr);
+		assert(pr == NULL || PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME));
+		return pr;
+	}
+
+	spl = splhigh();
+	for (pr = allbase; pr; pr = pr->next_all) {
+		/* check for corruption */
+		assert(PR_BLOCKTYPE(pr)<NSIZES);
+		checksubpage(pr);
+
+		if (ptraddr >= PR_PAGEADDR(pr) && ptraddr < PR_PAGEADDR(pr) + PAGE_SIZE) {
+			break;
+		}
+	}
+	splx(spl);
+
+	return pr;
+}
+
+/*
+ * Give block PTR back to page PR.
+ */
+static
+void
+subpage_kfree(struct pageref *pr, void *ptr)
 {
 	int spl;		// saved interrupt level
 	int blktype;		// index into sizes[] that we're using
 	vaddr_t ptraddr;	// same as ptr
-	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *fl;	// free list entry
@@ -478,24 +557,12 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		assert(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		splx(spl);
-		return -1;
-	}
+	/* check for corruption */
+	assert(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
 
 	offset = ptraddr - prpage;
 
@@ -529,6 +596,7 @@ subpage_kfree(void *ptr)
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
+		page_set_kheap(prpage, NULL);
 		free_kpages(prpage);
 		freepageref(pr);
 	}
@@ -536,7 +604,90 @@ subpage_kfree(void *ptr)
 	checksubpages();
 
 	splx(spl);
-	return 0;
+}
+
+/*
+ * Called by vm_bootstrap() once the coremap is up: point it at the
+ * pagerefs of the pages we got before.
+ */
+void
+kheap_bootstrap(void)
+{
+	struct pageref *pr;
+	int spl = splhigh();
+
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		page_set_kheap(PR_PAGEADDR(pr), pr);
+	}
+
+	splx(spl);
+}
+
+////////////////////////////////////////
+//
+// Object caches.
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *ptr;
+	int spl;
+
+	assert(kc->kc_size > 0 && kc->kc_size <= LARGEST_SUBPAGE_SIZE);
+
+	spl = splhigh();
+	if (!kc->kc_listed) {
+		kc->kc_next = allcaches;
+		allcaches = kc;
+		kc->kc_listed = 1;
+	}
+	kc->kc_allocs++;
+	if (kc->kc_nmag > 0) {
+		ptr = kc->kc_mag[--kc->kc_nmag];
+		kc->kc_hits++;
+		splx(spl);
+		return ptr;
+	}
+	splx(spl);
+
+	return subpage_kmalloc(kc->kc_size);
+}
+
+/*
+ * Put PTR in KC's magazine, or back on its page if the magazine's full.
+ * PR is its pageref.
+ */
+static
+void
+kmem_cache_put(struct kmem_cache *kc, struct pageref *pr, void *ptr)
+{
+	int spl;
+
+	assert(pr != NULL);
+	assert(sizes[PR_BLOCKTYPE(pr)] >= kc->kc_size);
+
+	/* Dangling pointers into it should stand out, as for kfree */
+	fill_deadbeef(ptr, kc->kc_size);
+
+	spl = splhigh();
+	kc->kc_frees++;
+	if (kc->kc_nmag < KMEM_MAGSIZE) {
+		kc->kc_mag[kc->kc_nmag++] = ptr;
+		splx(spl);
+		return;
+	}
+	splx(spl);
+
+	subpage_kfree(pr, ptr);
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	kmem_cache_put(kc, subpage_lookup(ptr), ptr);
 }
 
 //
@@ -549,9 +700,19 @@ kmalloc(size_t sz)
 		unsigned long npages;
 		vaddr_t address;
 
-		/* Round up to a whole number of pages. */
+		/*
+		 * Round up to a whole number of pages. More than one comes
+		 * from kseg2, so it needn't be physically contiguous, unless
+		 * it's too early for that or the area is full.
+		 */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
+		address = 0;
+		if (npages > 1 && vm_init_flag) {
+			address = kva_alloc(npages);
+		}
+		if (address==0) {
+			address = alloc_kpages(npages);
+		}
 		if (address==0) {
 			return NULL;
 		}
@@ -559,18 +720,24 @@ kmalloc(size_t sz)
 		return (void *)address;
 	}
 
-	return subpage_kmalloc(sz);
+	return kmem_cache_alloc(&sizecaches[blocktype(sz)]);
 }
 
 void
 kfree(void *ptr)
 {
+	struct pageref *pr;
+
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Is it on one of our subpage pages? If not, it's a big allocation.
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	pr = subpage_lookup(ptr);
+	if (pr != NULL) {
+		kmem_cache_put(&sizecaches[PR_BLOCKTYPE(pr)], pr, ptr);
+	} else {
 		assert((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
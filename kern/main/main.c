@@ -76,6 +76,7 @@ boot(void)
 	vfs_bootstrap();
 	dev_bootstrap();
 	vm_bootstrap();
+	swap_bootstrap();
 	kprintf_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
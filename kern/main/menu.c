@@ -197,6 +197,16 @@ common_prog(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Run a program the way the "p" command does, for tests that need a
+ * user process going.
+ */
+int
+menu_runprog(int nargs, char **args)
+{
+	return common_prog(nargs, args);
+}
+
 /*
  * Command for running an arbitrary userlevel program.
  */
@@ -431,6 +441,141 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for showing or changing the page replacement policy.
+ */
+static
+int
+cmd_vmpolicy(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: vp [fifo|clock]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2 && vm_set_policy(args[1])) {
+		kprintf("vp: unknown policy %s\n", args[1]);
+		return EINVAL;
+	}
+
+	kprintf("Page replacement policy: %s\n", vm_policy_name());
+	return 0;
+}
+
+/*
+ * Command for showing or changing the limit on user heap size.
+ */
+static
+int
+cmd_heapmax(int nargs, char **args)
+{
+	int size;
+
+	if (nargs > 2) {
+		kprintf("Usage: hm [bytes]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		size = atoi(args[1]);
+		if (size <= 0) {
+			kprintf("hm: bad size %s\n", args[1]);
+			return EINVAL;
+		}
+		user_heap_max = ROUNDUP(size, PAGE_SIZE);
+	}
+
+	kprintf("User heap limit: %u bytes\n", user_heap_max);
+	return 0;
+}
+
+/*
+ * Command for showing or changing how many pages go to or from swap
+ * in one request.
+ */
+static
+int
+cmd_swapcluster(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: sc [pages]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2 && vm_set_swap_cluster(atoi(args[1]))) {
+		kprintf("sc: cluster size must be 1-%d\n", SWAP_CLUSTER);
+		return EINVAL;
+	}
+
+	kprintf("Swap cluster: %u pages\n", swap_cluster);
+	return 0;
+}
+
+/*
+ * Command for showing the compressed swap cache's statistics, or
+ * turning it on or off.
+ */
+static
+int
+cmd_zcache(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "on") && strcmp(args[1], "off"))) {
+		kprintf("Usage: zc [on|off]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		result = zcache_enable(!strcmp(args[1], "on"));
+		if (result) {
+			kprintf("zc: %s\n", strerror(result));
+			return result;
+		}
+	}
+
+	zcache_printstats();
+	return 0;
+}
+
+static
+int
+cmd_namecache(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vfs_ncprintstats();
+
+	return 0;
+}
+
+#if OPT_SFS
+static
+int
+cmd_bufcache(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_cache_printstats();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -521,6 +666,9 @@ static const char *testmenu[] = {
 	"[qt]  Queue test                    ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] Page allocator benchmark      ",
+	"[km4] kmalloc fragmentation test    ",
+	"[km5] kseg2 TLB test                ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -564,6 +712,15 @@ static const char *mainmenu[] = {
 	"[1c] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+	"[vs] VM stats                       ",
+	"[vp] Page replacement policy        ",
+	"[hm] User heap limit                ",
+	"[sc] Swap cluster size              ",
+	"[zc] Compressed swap cache          ",
+	"[nc] VFS name cache stats           ",
+#if OPT_SFS
+	"[bc] SFS buffer cache stats         ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -620,6 +777,15 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "vs",		cmd_vmstats },
+	{ "vp",		cmd_vmpolicy },
+	{ "hm",		cmd_heapmax },
+	{ "sc",		cmd_swapcluster },
+	{ "zc",		cmd_zcache },
+	{ "nc",		cmd_namecache },
+#if OPT_SFS
+	{ "bc",		cmd_bufcache },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -627,6 +793,9 @@ static struct {
 	{ "qt",		queuetest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	pagealloctest },
+	{ "km4",	fragtest },
+	{ "km5",	kvatlbtest },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -2,10 +2,15 @@
  * Test code for kmalloc.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
 #include <thread.h>
+#include <clock.h>
+#include <vm.h>
 #include <test.h>
+#include <machine/spl.h>
+#include <machine/tlb.h>
 
 /*
  * Test kmalloc; allocate ITEMSIZE bytes NTRIES times, freeing
@@ -108,3 +113,263 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Page allocator benchmark. Allocates PAGEBATCH pages with
+ * alloc_kpages() and frees them again, PAGEROUNDS times, first one page
+ * at a time and then in runs of PAGERUN contiguous pages, and reports
+ * allocations per second for each.
+ */
+
+#define PAGEROUNDS 200
+#define PAGEBATCH  32
+#define PAGERUN    4
+
+static
+int
+pagebench(const char *what, int npages)
+{
+	vaddr_t batch[PAGEBATCH];
+	time_t s1, s2, secs;
+	u_int32_t ns1, ns2, nsecs, msecs;
+	int i, j;
+
+	gettime(&s1, &ns1);
+	for (i=0; i<PAGEROUNDS; i++) {
+		for (j=0; j<PAGEBATCH; j++) {
+			batch[j] = alloc_kpages(npages);
+			if (batch[j] == 0) {
+				kprintf("pagebench: alloc_kpages(%d) failed\n",
+					npages);
+				while (--j >= 0) {
+					free_kpages(batch[j]);
+				}
+				return ENOMEM;
+			}
+		}
+		for (j=0; j<PAGEBATCH; j++) {
+			free_kpages(batch[j]);
+		}
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+
+	msecs = secs * 1000 + nsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	kprintf("%s: %d allocations in %lu.%09lu seconds, %u allocations/sec\n",
+		what, PAGEROUNDS * PAGEBATCH, (unsigned long) secs,
+		(unsigned long) nsecs,
+		(PAGEROUNDS * PAGEBATCH * 1000) / msecs);
+	return 0;
+}
+
+int
+pagealloctest(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting page allocator benchmark...\n");
+	result = pagebench("1-page allocations", 1);
+	if (result) {
+		return result;
+	}
+	result = pagebench("4-page allocations", PAGERUN);
+	if (result) {
+		return result;
+	}
+	kprintf("page allocator benchmark done\n");
+
+	return 0;
+}
+
+/*
+ * Fragmentation stress test. Checkerboards physical memory by taking
+ * FRAGPAGES single pages and giving every other one back, so plenty is
+ * free but hardly any of it in runs of two or more; then kmallocs
+ * FRAGBATCH buffers of FRAGSIZE bytes, fills and checks them, and frees
+ * them again, FRAGROUNDS times. Multi-page kmallocs are mapped in kseg2
+ * and shouldn't have to evict anything to find contiguous pages, so
+ * this prints how many evictions there were.
+ */
+
+#define FRAGPAGES  128
+#define FRAGROUNDS 50
+#define FRAGBATCH  8
+#define FRAGSIZE   (3 * PAGE_SIZE + 100)
+
+static vaddr_t fragheld[FRAGPAGES];
+
+int
+fragtest(int nargs, char **args)
+{
+	char *bufs[FRAGBATCH];
+	unsigned nheld, round, i, j, evictions;
+	int result = 0;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting kmalloc fragmentation test...\n");
+
+	for (nheld = 0; nheld < FRAGPAGES; nheld++) {
+		fragheld[nheld] = alloc_kpages(1);
+		if (fragheld[nheld] == 0) {
+			break;
+		}
+	}
+	for (i = 0; i < nheld; i += 2) {
+		free_kpages(fragheld[i]);
+		fragheld[i] = 0;
+	}
+
+	evictions = vmstats.evictions;
+	for (round = 0; round < FRAGROUNDS && result == 0; round++) {
+		for (i = 0; i < FRAGBATCH; i++) {
+			bufs[i] = kmalloc(FRAGSIZE);
+			if (bufs[i] == NULL) {
+				kprintf("fragtest: kmalloc(%d) failed in round %u\n",
+					FRAGSIZE, round);
+				result = ENOMEM;
+				break;
+			}
+			for (j = 0; j < FRAGSIZE; j++) {
+				bufs[i][j] = (char)(round + i + j);
+			}
+		}
+		while (i-- > 0) {
+			for (j = 0; j < FRAGSIZE; j++) {
+				if (bufs[i][j] != (char)(round + i + j)) {
+					kprintf("fragtest: buffer %u corrupt at "
+						"byte %u in round %u\n", i, j, round);
+					result = EINVAL;
+					break;
+				}
+			}
+			kfree(bufs[i]);
+		}
+	}
+	evictions = vmstats.evictions - evictions;
+
+	for (i = 1; i < nheld; i += 2) {
+		free_kpages(fragheld[i]);
+		fragheld[i] = 0;
+	}
+
+	kprintf("fragtest: %u pages held apart, %u rounds of %d %d-byte "
+		"kmallocs, %u evictions\n", nheld / 2, round, FRAGBATCH,
+		FRAGSIZE, evictions);
+	if (result == 0) {
+		kprintf("kmalloc fragmentation test done\n");
+	}
+
+	return result;
+}
+
+/*
+ * kseg2 TLB test. Runs a user program (matmult unless another is given)
+ * while a second thread keeps knocking every kseg2 translation out of
+ * the TLB, and kmallocs multi-page buffers so kseg2 stays in use. If
+ * anything the UTLB refill handler reads through curpagedir or
+ * curtlbmisses were mapped in kseg2, the program's TLB misses would
+ * fault inside the refill handler; the thread also checks they're in
+ * kseg0 every time round.
+ */
+
+#define KVATLBSIZE (2 * PAGE_SIZE + 100)
+
+static volatile int kvatlb_done;
+static u_int32_t kvatlb_rounds, kvatlb_flushed, kvatlb_bad;
+
+#define IN_KSEG0(p) ((vaddr_t) (p) >= MIPS_KSEG0 && (vaddr_t) (p) < MIPS_KSEG1)
+
+static
+void
+kvatlbthread(void *sm, unsigned long junk)
+{
+	struct semaphore *sem = sm;
+	u_int32_t ehi, elo;
+	char *buf;
+	int i, spl;
+
+	(void)junk;
+
+	while (!kvatlb_done) {
+		spl = splhigh();
+		if (curpagedir != NULL &&
+		    (!IN_KSEG0(curpagedir) || !IN_KSEG0(curtlbmisses))) {
+			kvatlb_bad++;
+		}
+		for (i = 0; i < NUM_TLB; i++) {
+			TLB_Read(&ehi, &elo, i);
+			if ((elo & TLBLO_VALID) && (ehi & TLBHI_VPAGE) >= MIPS_KSEG2) {
+				TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+				kvatlb_flushed++;
+			}
+		}
+		splx(spl);
+
+		buf = kmalloc(KVATLBSIZE);
+		if (buf != NULL) {
+			for (i = 0; i < KVATLBSIZE; i += PAGE_SIZE / 4) {
+				buf[i] = (char) i;
+			}
+			kfree(buf);
+		}
+		kvatlb_rounds++;
+		thread_yield();
+	}
+	V(sem);
+}
+
+int
+kvatlbtest(int nargs, char **args)
+{
+	static char prog[] = "/testbin/matmult";
+	char *defargs[2] = { prog, NULL };
+	struct semaphore *sem;
+	int result;
+
+	sem = sem_create("kvatlbtest", 0);
+	if (sem == NULL) {
+		panic("kvatlbtest: sem_create failed\n");
+	}
+
+	kprintf("Starting kseg2 TLB test...\n");
+
+	kvatlb_done = 0;
+	kvatlb_rounds = kvatlb_flushed = kvatlb_bad = 0;
+	result = thread_fork("kvatlbtest", sem, 0, kvatlbthread, NULL);
+	if (result) {
+		panic("kvatlbtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+
+	/* Drop the leading "km5" */
+	if (nargs > 1) {
+		result = menu_runprog(nargs - 1, args + 1);
+	}
+	else {
+		result = menu_runprog(1, defargs);
+	}
+
+	kvatlb_done = 1;
+	P(sem);
+	sem_destroy(sem);
+
+	kprintf("kvatlbtest: %u rounds, %u kseg2 TLB entries knocked out, "
+		"%u with refill handler data outside kseg0\n",
+		kvatlb_rounds, kvatlb_flushed, kvatlb_bad);
+	if (result == 0 && kvatlb_bad > 0) {
+		result = EINVAL;
+	}
+	if (result == 0) {
+		kprintf("kseg2 TLB test done\n");
+	}
+
+	return result;
+}
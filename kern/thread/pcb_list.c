@@ -20,6 +20,10 @@ struct lock *pcb_list_lock;
 struct lock *pcb_fork_lock;
 struct lock *pid_avail_lock;
 
+/* One node per process; every fork and exit goes through here */
+static struct kmem_cache pcb_node_cache =
+	KMEM_CACHE_INITIALIZER("pcb_node", sizeof(struct pcb_node));
+
 pid_t acquire_pid(void){
 	int i;
 	lock_acquire(pid_avail_lock);
@@ -38,7 +42,7 @@ pid_t acquire_pid(void){
 struct pcb_node* insert_pcb_node(pid_t pid, struct thread *thread_id){
 	
 	// create and initialize a new node
-	struct pcb_node *new_node = kmalloc(sizeof(struct pcb_node));
+	struct pcb_node *new_node = kmem_cache_alloc(&pcb_node_cache);
 	if(new_node == NULL) return NULL;
 	new_node->thread_id = thread_id;
 	new_node->pid = pid;
@@ -81,7 +85,7 @@ void destroy_node(struct pcb_node *node_to_destroy){
 	else prev_node->next = curr_node->next;
 	curr_node->next = NULL;
 	cv_destroy(curr_node->exit_cv);
-	kfree(node_to_destroy);
+	kmem_cache_free(&pcb_node_cache, node_to_destroy);
 }
 
 
@@ -11,6 +11,7 @@
 #include <thread.h>
 #include <machine/spl.h>
 #include <queue.h>
+#include <vm.h>
 
 /*
  *  Scheduler data
@@ -87,11 +88,24 @@ scheduler_shutdown(void)
 struct thread *
 scheduler(void)
 {
+	int spl;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
 	while (q_empty(runqueue)) {
-		cpu_idle();
+		/*
+		 * Nothing to run. Zero a page for the VM system's pool
+		 * of pre-zeroed pages if it wants one, and take any
+		 * interrupt that came in meanwhile; idle once it's full.
+		 */
+		if (page_prezero()) {
+			spl = spl0();
+			splx(spl);
+		}
+		else {
+			cpu_idle();
+		}
 	}
 
 	// You can actually uncomment this to see what the scheduler's
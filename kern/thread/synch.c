@@ -11,6 +11,12 @@
 #include <machine/spl.h>
 #include <queue.h>
 
+/* Threads and processes come and go, and take these with them */
+static struct kmem_cache semaphore_cache =
+	KMEM_CACHE_INITIALIZER("semaphore", sizeof(struct semaphore));
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock));
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -22,14 +28,14 @@ sem_create(const char *namearg, int initial_count)
 
 	assert(initial_count >= 0);
 
-	sem = kmalloc(sizeof(struct semaphore));
+	sem = kmem_cache_alloc(&semaphore_cache);
 	if (sem == NULL) {
 		return NULL;
 	}
 
 	sem->name = kstrdup(namearg);
 	if (sem->name == NULL) {
-		kfree(sem);
+		kmem_cache_free(&semaphore_cache, sem);
 		return NULL;
 	}
 
@@ -57,7 +63,7 @@ sem_destroy(struct semaphore *sem)
 	 */
 
 	kfree(sem->name);
-	kfree(sem);
+	kmem_cache_free(&semaphore_cache, sem);
 }
 
 void 
@@ -104,14 +110,14 @@ lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(struct lock));
+	lock = kmem_cache_alloc(&lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->name = kstrdup(name);
 	if (lock->name == NULL) {
-		kfree(lock);
+		kmem_cache_free(&lock_cache, lock);
 		return NULL;
 	}
 	
@@ -129,7 +135,7 @@ lock_destroy(struct lock *lock)
 	assert(lock->held == 0);
 	assert(lock->current_holder == NULL);	
 	kfree(lock->name);
-	kfree(lock);
+	kmem_cache_free(&lock_cache, lock);
 }
 
 void
@@ -161,6 +167,22 @@ lock_release(struct lock *lock)
 	}
 }
 
+int
+lock_tryacquire(struct lock *lock)
+{
+	int spl, got = 0;
+
+	spl = splhigh();
+	if (!lock->held) {
+		lock->held = 1;
+		assert(lock->current_holder == NULL);
+		lock->current_holder = curthread;
+		got = 1;
+	}
+	splx(spl);
+	return got;
+}
+
 int
 lock_do_i_hold(struct lock *lock)
 {
@@ -176,19 +198,22 @@ struct cv {
 	struct queue *cv_threads_q;
 };
 
+static struct kmem_cache cv_cache =
+	KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv));
+
 struct cv *
 cv_create(const char *name)
 {
 	struct cv *cv;
 
-	cv = kmalloc(sizeof(struct cv));
+	cv = kmem_cache_alloc(&cv_cache);
 	if (cv == NULL) {
 		return NULL;
 	}
 
 	cv->name = kstrdup(name);
 	if (cv->name==NULL) {
-		kfree(cv);
+		kmem_cache_free(&cv_cache, cv);
 		return NULL;
 	}
 	//16 seemed like a reasonable number of threads waiting on a single CV
@@ -208,7 +233,7 @@ cv_destroy(struct cv *cv)
 	q_destroy(cv->cv_threads_q);
 	
 	kfree(cv->name);
-	kfree(cv);
+	kmem_cache_free(&cv_cache, cv);
 }
 
 void
@@ -93,6 +93,8 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
+	struct addrspace *as = curthread->t_vmspace;
+	struct segment *seg;
 	int result, i;
 	struct uio ku;
 
@@ -184,7 +186,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
-		result = as_define_region(curthread->t_vmspace,
+		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_flags & PF_R,
 					  ph.p_flags & PF_W,
@@ -192,6 +194,22 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		if (result) {
 			return result;
 		}
+
+		/* Remember where it is, for load_page() */
+		if (as->nsegments == AS_MAXSEGMENTS) {
+			kprintf("loadelf: too many segments\n");
+			return ENOEXEC;
+		}
+		seg = &as->segments[as->nsegments++];
+		seg->offset = ph.p_offset;
+		seg->vaddr = ph.p_vaddr;
+		seg->filesz = ph.p_filesz;
+		seg->memsz = ph.p_memsz;
+		seg->flags = ph.p_flags;
+		if (seg->filesz > seg->memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			seg->filesz = seg->memsz;
+		}
 	}
 
 	/*
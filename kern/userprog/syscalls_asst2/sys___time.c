@@ -0,0 +1,31 @@
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <syscall.h>
+
+/*
+ * The __time() syscall.
+ */
+
+int sys___time(userptr_t secs, userptr_t nsecs, int *ret){
+	time_t s;
+	u_int32_t ns;
+	unsigned long ns_out;
+	int err;
+
+	gettime(&s, &ns);
+
+	/* Either pointer may be NULL if the caller doesn't care */
+	if(secs != NULL){
+		err = copyout(&s, secs, sizeof(time_t));
+		if(err) return err;
+	}
+	if(nsecs != NULL){
+		ns_out = ns;
+		err = copyout(&ns_out, nsecs, sizeof(unsigned long));
+		if(err) return err;
+	}
+
+	*ret = (int) s;
+	return 0;
+}
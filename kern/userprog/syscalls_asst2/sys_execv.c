@@ -100,9 +100,16 @@ sys_execv(struct trapframe *tf)
 
 	/* Try.. */
 	struct addrspace *new_as = as_create(prog);
+	struct addrspace *old_as;
 
-	/* Destroy the current address space. */
-	as_destroy(curthread->t_vmspace);
+	/*
+	 * Destroy the current address space. Unhook it first, as
+	 * thread_exit does, so nobody looking at our t_vmspace (like
+	 * getvmstat) sees it half torn down.
+	 */
+	old_as = curthread->t_vmspace;
+	curthread->t_vmspace = NULL;
+	as_destroy(old_as);
 
 	/* Create a new address space. */
 	curthread->t_vmspace = new_as;//as_create(prog);
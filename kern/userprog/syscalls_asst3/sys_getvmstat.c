@@ -0,0 +1,54 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/vmstat.h>
+#include <thread.h>
+#include <curthread.h>
+#include <synch.h>
+#include <pcb_list.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <machine/spl.h>
+#include <syscall.h>
+
+/* 
+ * The getvmstat() syscall. PID 0 means the whole system; otherwise it
+ * has to be a process that hasn't exited. Its counters are copied with
+ * interrupts off: exit and exec take the address space away from the
+ * thread before tearing it down, so if it's there it's whole.
+ */
+
+int
+sys_getvmstat(pid_t pid, userptr_t buf, int *ret)
+{
+	struct vmstat sys, vs;
+	struct pcb_node *node;
+	struct addrspace *as = NULL;
+	int spl;
+
+	vm_getstats(&sys);
+
+	if(pid == 0){
+		vs = sys;
+	}
+	else{
+		lock_acquire(pcb_list_lock);
+		for(node = pcb_list_root; node != NULL; node = node->next){
+			if(node->pid == pid) break;
+		}
+		if(node != NULL && !node->exited){
+			spl = splhigh();
+			as = node->thread_id->t_vmspace;
+			if(as != NULL) vs = as->as_stats;
+			splx(spl);
+		}
+		lock_release(pcb_list_lock);
+
+		if(as == NULL) return EINVAL;
+		vs.vs_freepages = sys.vs_freepages;
+		vs.vs_totalpages = sys.vs_totalpages;
+	}
+
+	*ret = 0;
+	return copyout(&vs, buf, sizeof(vs));
+}
@@ -0,0 +1,72 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <machine/trapframe.h>
+#include <thread.h>
+#include <curthread.h>
+#include <addrspace.h>
+#include <vnode.h>
+#include <vm.h>
+#include <fd.h>
+#include <syscall.h>
+
+/* 
+ * The mmap() syscall:
+ *
+ *    void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+ *
+ * ADDR is only a hint, and we ignore it. The first four arguments come
+ * in a0-a3; FD and OFFSET are on the user stack, past the 16 bytes
+ * kept there for the others. Pages are faulted in as they're touched
+ * (see vm_fault()).
+ */
+
+int
+sys_mmap(struct trapframe *tf, int *ret)
+{
+	size_t len = tf->tf_a1;
+	int prot = tf->tf_a2, flags = tf->tf_a3;
+	int stackargs[2];
+	struct vnode *vn = NULL;
+	struct fd *file;
+	off_t offset;
+	vaddr_t addr;
+	int err, filehandle, mode;
+
+	err = copyin((const_userptr_t) (tf->tf_sp + 16), stackargs, sizeof(stackargs));
+	if(err) return err;
+	filehandle = stackargs[0];
+	offset = stackargs[1];
+
+	/* Error check */
+	if(len == 0 || prot == PROT_NONE) return EINVAL;
+	mode = flags & (MAP_SHARED | MAP_PRIVATE);
+	if(mode != MAP_SHARED && mode != MAP_PRIVATE) return EINVAL;
+
+	if(flags & MAP_ANON){
+		/* Nothing to share with, after fork or otherwise */
+		if(mode == MAP_SHARED) return EINVAL;
+		offset = 0;
+	}
+	else{
+		if(filehandle < 0 || filehandle >= MAX_FILES_PER_THREAD ||
+		   !(curthread->file_descriptors[filehandle])) return EBADF;
+		if(offset < 0 || (offset & ~PAGE_FRAME) != 0) return EINVAL;
+
+		/* Have to be able to read it, and write it to change it shared */
+		file = curthread->file_descriptors[filehandle];
+		if(file->rw_flags == O_WRONLY) return EINVAL;
+		if(mode == MAP_SHARED && (prot & PROT_WRITE) && file->rw_flags != O_RDWR) return EINVAL;
+
+		vn = file->file;
+		err = VOP_MMAP(vn);
+		if(err) return err;
+	}
+
+	err = as_mmap(curthread->t_vmspace, len, prot, flags, vn, offset, &addr);
+	if(err) return err;
+
+	*ret = (int) addr;
+	return 0;
+}
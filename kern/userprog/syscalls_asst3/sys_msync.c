@@ -0,0 +1,30 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <thread.h>
+#include <curthread.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <syscall.h>
+
+/* 
+ * The msync() syscall. Writes back the dirty MAP_SHARED pages in the
+ * range, always synchronously (MS_ASYNC is the same as MS_SYNC, and
+ * MS_INVALIDATE has nothing to do: there's only ever one copy of a
+ * shared page).
+ */
+
+int
+sys_msync(void *addr, size_t len, int flags, int *ret)
+{
+	int err;
+
+	if(flags & ~(MS_SYNC | MS_ASYNC | MS_INVALIDATE)) return EINVAL;
+
+	err = as_msync(curthread->t_vmspace, (vaddr_t) addr, len);
+	if(err) return err;
+
+	*ret = 0;
+	return 0;
+}
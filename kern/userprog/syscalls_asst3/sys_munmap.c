@@ -0,0 +1,25 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <thread.h>
+#include <curthread.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <syscall.h>
+
+/* 
+ * The munmap() syscall. Dirty MAP_SHARED pages go back to the file
+ * before the mapping goes away.
+ */
+
+int
+sys_munmap(void *addr, size_t len, int *ret)
+{
+	int err;
+
+	err = as_munmap(curthread->t_vmspace, (vaddr_t) addr, len);
+	if(err) return err;
+
+	*ret = 0;
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <types.h>
+#include <lib.h>
 #include <kern/errno.h>
 #include <thread.h>
 #include <curthread.h>
@@ -12,7 +13,7 @@
 
 void* sys_sbrk(intptr_t amount){
 	struct addrspace *as;
-	vaddr_t old_top;
+	vaddr_t old_top, new_top;
 
 	/* Align amount (so that MIPS won't get angry) */
 	if((amount % 4) != 0) amount = ((amount + 4) / 4) * 4;
@@ -23,19 +24,33 @@ void* sys_sbrk(intptr_t amount){
 	 * Error check. I just return NULL for any error at this point. I'll return whatever
 	 * the testers want us to return when I run the tests.
 	 */
-	if((as->user_heap->top + amount - as->user_heap->base) > USER_HEAP_MAX)	return (void*)-1;
+	if((as->user_heap->top + amount - as->user_heap->base) > user_heap_max)	return (void*)-1;
 	else if((as->user_heap->top + amount) < as->user_heap->base) return (void*)-2;
 
+	new_top = as->user_heap->top + amount;
+	if(new_top + USER_STACK_GUARD >= as->mmap_base){
+		/* Into the guard region below the mappings or stack */
+		return (void*)-1;
+	}
+
 	/* Alright, we're aligned and the amount is valid */
 	old_top = as->user_heap->top;
-	as->user_heap->top += amount;
+	as->user_heap->top = new_top;
 	
 	/* Adjust kernel heap top if necessary */
 	if(as->user_heap->top >= (as->heap->top + PAGE_SIZE)){
 		as->heap->top += ((as->user_heap->top - as->heap->top) / PAGE_SIZE) * PAGE_SIZE;
-		if(as->heap->top > as->stack->base){
-			/* Stack overflow */
-			return (void*)-1;
+	}
+	else if(amount < 0){
+		/*
+		 * Shrinking: give back the pages wholly above the new break
+		 * (including the one at heap->top, which vm_fault() lets the
+		 * heap grow into).
+		 */
+		new_top = ROUNDUP(as->user_heap->top, PAGE_SIZE);
+		if(new_top <= as->heap->top){
+			vmstats.heap_pages_freed += vm_unmap(as, new_top, as->heap->top + PAGE_SIZE);
+			as->heap->top = new_top;
 		}
 	}
 
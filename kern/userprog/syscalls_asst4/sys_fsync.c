@@ -4,6 +4,7 @@
 #include <kern/errno.h>
 #include <curthread.h>
 #include <thread.h>
+#include <vm.h>
 
 /*
  * The fsync() syscall.
@@ -20,6 +21,14 @@ int sys_fsync(int filehandle, int *ret){
 	}
 
 	file = curthread->file_descriptors[filehandle]->file;
+
+	/* Pages of it changed through shared mappings go first */
+	err = vm_sync_file(file);
+	if(err){
+		*ret = -1;
+		return err;
+	}
+
 	err = VOP_FSYNC(file);
 	if(err){
 		*ret = -1;
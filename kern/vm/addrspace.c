@@ -5,11 +5,15 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
 
 /* Address space related functions */
 
+u_int32_t asid_generation = 1;
+static u_int32_t asid_next;	/* next unused ID in this generation */
+
 struct addrspace *
 as_create(char *progname)
 {
@@ -19,16 +23,28 @@ as_create(char *progname)
 		return NULL;
 	}
 
+	/*
+	 * One page from alloc_kpages(), not kmalloc(), so the page
+	 * directory is never in kseg2 (see struct addrspace).
+	 */
+	as->page_directory = (struct page_table **) alloc_kpages(1);
+	as->pt_used = kmalloc(TWO_LEV_PAGE_TABLE_SIZE * sizeof(u_int16_t));
+	as->progname = kmalloc(strlen(progname) + 1);
+	if (as->page_directory == NULL || as->pt_used == NULL ||
+	    as->progname == NULL) {
+		goto fail;
+	}
+
 	/* Initialize everything */
 	int i, result;
 	for(i = 0; i < TWO_LEV_PAGE_TABLE_SIZE; i++) as->page_directory[i] = NULL;
+	bzero(as->pt_used, TWO_LEV_PAGE_TABLE_SIZE * sizeof(u_int16_t));
 
-	as->progname = kmalloc(strlen(progname) + 1);
 	strcpy(as->progname, progname);
 
 	/* Open our own copy of the file */
 	result = vfs_open(progname, O_RDONLY, &(as->progfile));
-	if(result) return NULL;
+	if(result) goto fail;
 
 	as->code = NULL;
 	as->data = NULL;
@@ -36,16 +52,39 @@ as_create(char *progname)
 	as->user_heap = NULL;
 	as->stack = NULL;
 
-	as->done_loading_code_page = 0;
+	as->nsegments = 0;
+	as->mmaps = NULL;
+	as->mmap_base = 0;
+	as->asid = 0;
+	as->asid_generation = 0;
+	bzero(&as->as_stats, sizeof(as->as_stats));
 
 	return as;
+
+ fail:
+	if (as->page_directory != NULL) free_kpages((vaddr_t) as->page_directory);
+	kfree(as->pt_used);
+	kfree(as->progname);
+	kfree(as);
+	return NULL;
 }
 
+/*
+ * Copy-on-write fork. Every resident page of OLD is shared with NEW:
+ * both page tables point at the same physical page, the coremap counts
+ * the extra mapping, and vm_fault() maps shared pages read-only so the
+ * first write to one (by either side) copies it in page_cow(). Pages
+ * that are swapped out are read back into a private page for NEW.
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	DEBUG(DB_VM, "In as_copy().\n");
 	struct addrspace *new;
+	pte_t *old_pte, *new_pte;
+	struct page_mapping *mapping;
+	struct mmap_region *om, **pm;
+	vaddr_t va;
 	int i, j;
 	int result;
 	paddr_t paddr;
@@ -54,55 +93,105 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	if (new==NULL) {
 		return ENOMEM;
 	}
+
+	/*
+	 * Run off the same vnode as OLD rather than our own copy: the
+	 * page cache goes by vnode, and the code pages we share with OLD
+	 * are in there under its one.
+	 */
+	vfs_close(new->progfile);
+	VOP_INCREF(old->progfile);
+	new->progfile = old->progfile;
 	
 	for(i = 0; i < TWO_LEV_PAGE_TABLE_SIZE; i++){
-		if(old->page_directory[i] != NULL){
-			result = create_page_table(new, i); /* <-Delete this line for copy-on-write */
-			if(result) return result; /* <-Delete this line for copy-on-write */
-			/* Add this for copy-on-write
-				new->page_directory[i] = old->page_directory[i];		 
-			*/
-			for(j = 0; j < TWO_LEV_PAGE_TABLE_SIZE; j++){
-				if(old->page_directory[i]->entries[j] != NULL){
-					/*
-					 * This is just rough, and will all be replaced when copy-on-write is written.
-					 */
-					new->page_directory[i]->entries[j] = kmalloc(sizeof(struct page_table_entry));
-					if(new->page_directory[i]->entries[j] == NULL) return ENOMEM;
-					paddr = page_alloc(USER_ALLOC, (vaddr_t) ((i << 22) | (j << 12)), new);	//added this to prevent duplicates
-					write_pte(new->page_directory[i]->entries[j], paddr, old->page_directory[i]->entries[j]->permission, -1);
-					memmove((void *)PADDR_TO_KVADDR(paddr),
-						(const void *)PADDR_TO_KVADDR(old->page_directory[i]->entries[j]->paddr),
-						PAGE_SIZE);
-					/* Delete above for copy-on-write */
-					/* Add this for copy on write
-						old->page_directory[i]->entries[j]->permission = READ_ONLY;
-						#as_activate called immediately after this in thread_fork, which will flush the TLB
-						#need to add our second mapping to the core map now (both 'new' and 'old' will be sharing
-						 the position in the core map). if invalid, get it out from disk and put it in the core map
-						 (instead of trying to edit things on disk.. just edit them in the core map.. instead of 
-						 making it really complicated, just add two (or even just one) extra addrspace field to 
-						 our core map pages), and write our 'new' addrspace to that field. that should be it#
-					*/
-				}
+		if(old->page_directory[i] == NULL) continue;
+
+		result = create_page_table(new, i);
+		if(result){
+			as_destroy(new);
+			return result;
+		}
+
+		for(j = 0; j < TWO_LEV_PAGE_TABLE_SIZE; j++){
+			old_pte = &old->page_directory[i]->entries[j];
+			new_pte = &new->page_directory[i]->entries[j];
+			if(PTE_UNTOUCHED(*old_pte)) continue;
+
+			va = (vaddr_t) ((i << 22) | (j << 12));
+			mapping = kmem_cache_alloc(&mapping_cache);
+			if(mapping == NULL){
+				as_destroy(new);
+				return ENOMEM;
+			}
+
+			/* Resident: just share it */
+			if(page_share(old_pte, new, va, mapping) == 0){
+				pte_set(new, va, new_pte, PTE_MKVALID(PTE_PADDR(*old_pte), *old_pte & PTE_PERMS));
+				vmstats.fork_pages_shared++;
+				continue;
+			}
+			kmem_cache_free(&mapping_cache, mapping);
+
+			/* Dropped from the page cache meanwhile; the child can fault it in */
+			if(PTE_UNTOUCHED(*old_pte)) continue;
+
+			/* Swapped out: give the child its own copy */
+			assert(*old_pte & PTE_SWAPPED);
+			paddr = page_alloc(USER_ALLOC, va, new);
+			if(paddr == 0){
+				as_destroy(new);
+				return ENOMEM;
+			}
+			pte_set(new, va, new_pte, PTE_MKVALID(paddr, *old_pte & PTE_PERMS));
+			result = swapin_page(paddr, PTE_SLOT(*old_pte));
+			page_unbusy(paddr);
+			if(result){
+				as_destroy(new);
+				return result;
 			}
+			vmstats.fork_pages_copied++;
 		}
 	}
 
+	/*
+	 * The pages we just shared are read-only from now on, but we may
+	 * still have writeable TLB entries for them.
+	 */
+	tlb_flush_as(old);
+
 	/* Deep copy all regions */
 	new->code = kmalloc(sizeof(struct region));
 	new->data = kmalloc(sizeof(struct region));
 	new->heap = kmalloc(sizeof(struct region));
 	new->user_heap = kmalloc(sizeof(struct region));
 	new->stack = kmalloc(sizeof(struct region));
+	if(new->code == NULL || new->data == NULL || new->heap == NULL ||
+	   new->user_heap == NULL || new->stack == NULL){
+		as_destroy(new);
+		return ENOMEM;
+	}
 	*(new->code) = *(old->code);
 	*(new->data) = *(old->data);
 	*(new->heap) = *(old->heap);
 	*(new->user_heap) = *(old->user_heap);
 	*(new->stack) = *(old->stack);
 
-	/* Will this work for copy-on-write? Yeah, won't even need to load code pages for copy-on-write */
-	new->done_loading_code_page = old->done_loading_code_page;	
+	for(i = 0; i < old->nsegments; i++) new->segments[i] = old->segments[i];
+	new->nsegments = old->nsegments;
+
+	/* The mappings go along too (their pages were shared above) */
+	for(om = old->mmaps, pm = &new->mmaps; om != NULL; om = om->next){
+		*pm = kmalloc(sizeof(struct mmap_region));
+		if(*pm == NULL){
+			as_destroy(new);
+			return ENOMEM;
+		}
+		**pm = *om;
+		(*pm)->next = NULL;
+		if(om->vn != NULL) VOP_INCREF(om->vn);
+		pm = &(*pm)->next;
+	}
+	new->mmap_base = old->mmap_base;
 	
 	*ret = new;
 	return 0;
@@ -111,16 +200,46 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
+	struct mmap_region *m;
+	pte_t *pte;
 	int i, j;
-	/* Free all memory */
+
+	/* Anything we changed in a shared mapping goes back to its file */
+	for (m = as->mmaps; m != NULL; m = m->next) {
+		if (m->vn != NULL && (m->flags & MAP_SHARED)) {
+			vm_msync(as, m->base, m->top);
+		}
+	}
+
+	/* Don't leave the UTLB refill handler walking freed page tables */
+	if (curpagedir == as->page_directory) {
+		curpagedir = NULL;
+		curtlbmisses = NULL;
+	}
+	/* Our TLB entries are no use to anyone; free up the slots */
+	tlb_flush_as(as);
+
+	/*
+	 * Drop our mappings (shared pages stay around for the other users).
+	 * Each page table's count of entries in use lets us stop as soon as
+	 * we've seen the last one, rather than looking at all of them.
+	 */
 	for(i = 0; i < TWO_LEV_PAGE_TABLE_SIZE; i++){
 		if(as->page_directory[i] != NULL){
-			for(j = 0; j < TWO_LEV_PAGE_TABLE_SIZE; j++){
-				if(as->page_directory[i]->entries[j] != NULL) kfree(as->page_directory[i]->entries[j]);
+			for(j = 0; j < TWO_LEV_PAGE_TABLE_SIZE && as->pt_used[i] > 0; j++){
+				pte = &as->page_directory[i]->entries[j];
+				if(*pte == 0) continue;
+				page_unmap(pte, as, (vaddr_t) ((i << 22) | (j << 12)));
+				vmstats.teardown_ptes++;
 			}
-			kfree(as->page_directory[i]);
+			destroy_page_table(as, i);
 		}
 	}
+	while ((m = as->mmaps) != NULL) {
+		as->mmaps = m->next;
+		if (m->vn != NULL) VOP_DECREF(m->vn);
+		kfree(m);
+	}
 	vfs_close(as->progfile);
 	kfree(as->progname);
 	kfree(as->code);
@@ -128,7 +247,8 @@ as_destroy(struct addrspace *as)
 	kfree(as->heap);
 	kfree(as->user_heap);
 	kfree(as->stack);
-	free_all_user_pages(as);
+	free_kpages((vaddr_t) as->page_directory);
+	kfree(as->pt_used);
 	kfree(as);
 }
 
@@ -137,13 +257,36 @@ as_activate(struct addrspace *as)
 {
 	int i, spl;
 
-	(void)as;
+	/* The refill handler can't take a TLB miss on either */
+	assert((vaddr_t) as->page_directory >= MIPS_KSEG0 &&
+	       (vaddr_t) as->page_directory < MIPS_KSEG1);
+	assert((vaddr_t) as >= MIPS_KSEG0 && (vaddr_t) as < MIPS_KSEG1);
 
 	spl = splhigh();
-	DEBUG(DB_VM, "TLB flush.\n");
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	curpagedir = as->page_directory;
+	curtlbmisses = &as->as_stats.vs_tlbmisses;
+	vmstats.as_switches++;
+
+	/*
+	 * TLB entries are tagged with their address space's ID, so they
+	 * can stay put across switches. An address space that doesn't have
+	 * an ID from the current generation gets the next one; when they
+	 * run out, flush the TLB and start a new generation.
+	 */
+	if (!AS_IN_TLB(as)) {
+		if (asid_next == NUM_TLB_PID) {
+			DEBUG(DB_VM, "TLB flush.\n");
+			for (i=0; i<NUM_TLB; i++) {
+				TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+			asid_generation++;
+			asid_next = 0;
+			vmstats.asid_rollovers++;
+		}
+		as->asid = asid_next++;
+		as->asid_generation = asid_generation;
 	}
+	TLB_SetPID(as->asid);
 
 	splx(spl);
 }
@@ -262,7 +405,138 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	as->stack = kmalloc(sizeof(struct region));
 	*stackptr = as->stack->base = as->stack->top = USERSTACK;
 	as->stack->permission = WRITEABLE;
+
+	/* No mappings yet; they go below the stack's limit */
+	as->mmap_base = as->stack->top - USER_STACK_MAX;
 	
 	return 0;
 }
 
+
+/*
+ * Add a mmap() region of LEN bytes with protection PROT and flags
+ * FLAGS (see kern/unistd.h), backed by VN from OFFSET (page-aligned),
+ * or by nothing if VN is NULL. The caller has checked the arguments.
+ * It goes USER_STACK_GUARD below the lowest thing already there, and
+ * has to stay that far above the heap. Nothing is read in until it's
+ * touched.
+ */
+int
+as_mmap(struct addrspace *as, size_t len, int prot, int flags,
+	struct vnode *vn, off_t offset, vaddr_t *ret)
+{
+	struct mmap_region *m;
+	vaddr_t top;
+
+	len = ROUNDUP(len, PAGE_SIZE);
+	top = as->mmap_base - USER_STACK_GUARD;
+	if (len > top || top - len < as->heap->top + USER_STACK_GUARD) {
+		return ENOMEM;
+	}
+
+	m = kmalloc(sizeof(struct mmap_region));
+	if (m == NULL) {
+		return ENOMEM;
+	}
+	m->base = top - len;
+	m->top = top;
+	m->prot = prot;
+	m->flags = flags;
+	m->vn = vn;
+	m->offset = offset;
+	if (vn != NULL) VOP_INCREF(vn);
+
+	m->next = as->mmaps;
+	as->mmaps = m;
+	as->mmap_base = m->base;
+
+	*ret = m->base;
+	return 0;
+}
+
+/*
+ * Remove every mmap() region of AS in [ADDR, ADDR + LEN). Changes to
+ * MAP_SHARED pages are written back first. Taking part of a region
+ * away isn't supported (EINVAL).
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct mmap_region *m, **pm;
+	vaddr_t end = addr + ROUNDUP(len, PAGE_SIZE);
+	int result = 0;
+
+	if ((addr & ~PAGE_FRAME) != 0 || len == 0 || end < addr) {
+		return EINVAL;
+	}
+	for (m = as->mmaps; m != NULL; m = m->next) {
+		if (m->top > addr && m->base < end &&
+		    (m->base < addr || m->top > end)) {
+			return EINVAL;
+		}
+	}
+
+	pm = &as->mmaps;
+	while ((m = *pm) != NULL) {
+		if (m->base < addr || m->top > end) {
+			pm = &m->next;
+			continue;
+		}
+		if (m->vn != NULL && (m->flags & MAP_SHARED)) {
+			if (vm_msync(as, m->base, m->top) && result == 0) {
+				result = EIO;
+			}
+		}
+		vm_unmap(as, m->base, m->top);
+		if (m->vn != NULL) VOP_DECREF(m->vn);
+		*pm = m->next;
+		kfree(m);
+	}
+
+	/* Let the space at the bottom be used again */
+	as->mmap_base = as->stack->top - USER_STACK_MAX;
+	for (m = as->mmaps; m != NULL; m = m->next) {
+		if (m->base < as->mmap_base) as->mmap_base = m->base;
+	}
+	return result;
+}
+
+/*
+ * Write back the dirty pages of the MAP_SHARED file mappings of AS in
+ * [ADDR, ADDR + LEN), which must be in user space. Only the part of
+ * each region inside the range is looked at.
+ */
+int
+as_msync(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct mmap_region *m;
+	vaddr_t end = addr + ROUNDUP(len, PAGE_SIZE);
+	int result;
+
+	if ((addr & ~PAGE_FRAME) != 0 || end < addr || end > USERTOP) {
+		return EINVAL;
+	}
+	for (m = as->mmaps; m != NULL; m = m->next) {
+		if (m->vn == NULL || !(m->flags & MAP_SHARED) ||
+		    m->top <= addr || m->base >= end) {
+			continue;
+		}
+		result = vm_msync(as, m->base > addr ? m->base : addr,
+				  m->top < end ? m->top : end);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+struct mmap_region *
+as_mmap_find(struct addrspace *as, vaddr_t va)
+{
+	struct mmap_region *m;
+
+	for (m = as->mmaps; m != NULL; m = m->next) {
+		if (va >= m->base && va < m->top) return m;
+	}
+	return NULL;
+}
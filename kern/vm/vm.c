@@ -13,6 +13,8 @@
 #include <uio.h>
 #include <elf.h>
 #include <vfs.h>
+#include <bitmap.h>
+#include <kern/stat.h>
 
 /*
  * Our VM System
@@ -32,308 +34,1235 @@ struct page {
      * for paging algorithm if user space page
      * if kernel page then using to tell how many pages were allocated :P
      */
-    u_int32_t number;   // FIFO paging, so a time stamp will be suffice
-};
+    u_int32_t number;   // allocation time stamp, for FIFO paging
 
+    /*
+     * Copy-on-write sharing. refcount is the number of address spaces
+     * mapping a user page: (as, va) above plus everyone on sharers.
+     * Pages with refcount > 1 are never chosen for eviction, unless
+     * they're in the page cache (below).
+     */
+    u_int32_t refcount;
+    struct page_mapping *sharers;
 
-/*Swap Page*/
-struct swap_page{
-	/* User address space of the page */
-	struct addrspace* as;
-	/* Virtual address of page	*/
-	vaddr_t va;
+    /*
+     * Set while the page is in transit: being read in from or written
+     * out to swap (CoreMapLock isn't held across the I/O), or just
+     * allocated and not filled in yet. Busy pages aren't evicted,
+     * shared or unmapped; anyone who needs one waits in page_wait().
+     */
+    u_int32_t busy;
+
+    /*
+     * Swap slot holding a copy of this page, or -1. A page keeps its slot
+     * while it's resident again, so it can be evicted without another
+     * write as long as it stays clean. Shared pages don't have one.
+     */
+    int swap_slot;
+
+    /*
+     * Page cache. A page of an executable's read-only code is shared by
+     * every address space running it, and found by the file it came
+     * from and its offset in there (file is NULL for everything else).
+     * So is a page of a file mmap()ed MAP_SHARED (or read-only), by
+     * everyone who maps it. Evicting one unmaps it everywhere, after
+     * writing it back to the file if it's dirty; whoever touches it
+     * next reads it in again. Executable pages are keyed with
+     * PAGECACHE_EXEC set in the offset, since they have zeros outside
+     * the segment's data where a mmap()ed page has the file's bytes.
+     */
+    struct vnode *file;
+    off_t offset;
+    u_int32_t cache_next;	/* next page on the same hash chain */
+
+    /*
+     * Links in the free page list, while state == PAGE_FREE. Free pages
+     * known to be all zeros (zeroed set) are on a list of their own.
+     */
+    u_int32_t free_next;
+    u_int32_t free_prev;
+    u_int32_t zeroed;
+
+    /* Kernel heap bookkeeping for a page kmalloc carves up (kheap.c) */
+    void *kheap;
 };
 
+/*
+ * Free pages are kept on a doubly linked list threaded through the
+ * coremap, so grabbing or releasing a page doesn't have to scan for
+ * one. Page 0 always holds the exception handlers and is never free,
+ * so index 0 doubles as the list terminator.
+ */
+#define NO_PAGE		0
+
+/*
+ * Anonymous pages (heap, stack, bss, MAP_ANON) have to be zero-filled
+ * when they're first touched. Rather than do that while the faulting
+ * thread waits, the idle loop zeroes free pages ahead of time (see
+ * page_prezero()), up to zero_pool_target of them, and keeps them on
+ * zero_list_head; page_alloc(USER_ZERO_ALLOC) takes from there first,
+ * and everyone else only once the other free pages run out.
+ */
+
 
 /*flag setup once VM setup*/
 int vm_init_flag = 0;
 struct lock * CoreMapLock;
 struct page * pages;
 u_int32_t page_num, first_free_page;
+u_int32_t free_list_head = NO_PAGE;
+u_int32_t free_page_count = 0;	/* including the zeroed ones */
+u_int32_t zero_list_head = NO_PAGE;
+u_int32_t zero_page_count = 0;
+u_int32_t zero_pool_target;
 u_int32_t page_counter = 0;
 u_int32_t global_lastaddr; // for debugging purposes
 int TLB_replacement_counter; // for debugging purposes
+struct vm_stats vmstats;
+struct page_table **curpagedir;
+u_int32_t tlb_fast_refills;
+u_int32_t *curtlbmisses;
+size_t user_heap_max = USER_HEAP_MAX;
+
+/* Page replacement policies */
+struct replacement_policy {
+	const char *name;
+	/* Pick a user page to evict; NO_PAGE if there isn't one */
+	u_int32_t (*select_victim)(void);
+};
+
+static u_int32_t fifo_select_victim(void);
+static u_int32_t clock_select_victim(void);
+
+static const struct replacement_policy policies[] = {
+	{ "fifo",	fifo_select_victim },
+	{ "clock",	clock_select_victim },
+};
+#define NPOLICIES	(sizeof(policies) / sizeof(policies[0]))
+
+static const struct replacement_policy *policy = &policies[1];
+static u_int32_t clock_hand;
+
+/* Pageout thread, and the free page counts it's woken at and aims for */
+static struct cv *pageout_cv;
+static u_int32_t pageout_lowat, pageout_hiwat;
+static void pageout_thread(void *, unsigned long);
+static pte_t *pte_lookup(struct addrspace *as, vaddr_t vaddr, int create);
+static paddr_t page_alloc_locked(int alloc_type, vaddr_t vaddr, struct addrspace *as);
+
+/*
+ * Page cache hash table: chains of coremap indices, by file and offset.
+ * Mappings let go of by pagecache_evict() wait on dead_mappings to be
+ * freed (by mappings_reap()) once CoreMapLock isn't held.
+ */
+#define PAGECACHE_BUCKETS	64
+#define PAGECACHE_EXEC		1
+static u_int32_t pagecache[PAGECACHE_BUCKETS];
+static struct page_mapping *dead_mappings;
+
+/* Every shared page has a page_mapping per extra address space */
+struct kmem_cache mapping_cache =
+	KMEM_CACHE_INITIALIZER("page_mapping", sizeof(struct page_mapping));
+
+/*
+ * Swapping variables. Swap slots are handed out from swapmap, one bit
+ * per page of the swap device; a page's slot is kept in its PTE. The
+ * bitmap is protected by CoreMapLock, SwapLock serializes device I/O.
+ *
+ * Swap I/O is clustered: a page being written out takes up to
+ * swap_cluster - 1 dirty pages that follow it in its address space
+ * along, into the slots that follow its own, and a page being read
+ * back in brings the pages after it in those slots in with it. A
+ * cluster goes through swap_buf (which SwapLock also protects), so
+ * it's a single request to the device.
+ */
+struct lock * SwapLock;
+struct vnode* swapfile;
+struct bitmap *swapmap;
+u_int32_t swap_slots, swap_slots_used;
+static u_int32_t swap_rotor;	/* where swap_alloc_run() looks next */
+static char *swap_buf;
+u_int32_t swap_cluster = 1;
+
+/*
+ * Kernel virtual memory in kseg2. Multi-page kmalloc()s get their
+ * pages from anywhere in physical memory and a run of addresses here
+ * to see them through, so they don't need (or evict for) a physically
+ * contiguous run. kva_map has an entry per page of the area, which
+ * kva_npages covers: it can't usefully be bigger than memory. It's
+ * kept right after the coremap. kseg2 misses come to vm_fault(), which
+ * loads the translation from here, possibly at splhigh or with
+ * CoreMapLock held, so the map is protected by turning interrupts off.
+ */
+#define KVA_BASE	MIPS_KSEG2
+#define KVA_VALID	0x1	/* frame filled in */
+#define KVA_INUSE	0x2	/* address allocated */
+#define KVA_LAST	0x4	/* last page of an allocation */
+static u_int32_t *kva_map;
+static u_int32_t kva_npages, kva_pages_used;
+static u_int32_t kva_rotor;	/* where kva_alloc() looks next */
+
+
+/*
+ * Free list maintenance. Callers hold CoreMapLock (or are vm_bootstrap()).
+ */
+static
+void
+freelist_remove(u_int32_t i)
+{
+	u_int32_t *head = pages[i].zeroed ? &zero_list_head : &free_list_head;
+
+	assert(pages[i].state == PAGE_FREE);
+
+	if (pages[i].free_prev != NO_PAGE) pages[pages[i].free_prev].free_next = pages[i].free_next;
+	else *head = pages[i].free_next;
+	if (pages[i].free_next != NO_PAGE) pages[pages[i].free_next].free_prev = pages[i].free_prev;
+
+	pages[i].free_next = pages[i].free_prev = NO_PAGE;
+	if (pages[i].zeroed) {
+		pages[i].zeroed = 0;
+		zero_page_count--;
+	}
+	free_page_count--;
+}
+
+/* Put free page I on the front of the free list, or the zeroed one if ZEROED */
+static
+void
+freelist_add(u_int32_t i, int zeroed)
+{
+	u_int32_t *head = zeroed ? &zero_list_head : &free_list_head;
+
+	assert(pages[i].state == PAGE_FREE);
+
+	pages[i].zeroed = zeroed;
+	pages[i].free_prev = NO_PAGE;
+	pages[i].free_next = *head;
+	if (*head != NO_PAGE) pages[*head].free_prev = i;
+	*head = i;
+	if (zeroed) zero_page_count++;
+	free_page_count++;
+}
+
+/*
+ * Page cache maintenance. Callers hold CoreMapLock.
+ */
+static
+u_int32_t *
+pagecache_bucket(struct vnode *file, off_t offset)
+{
+	return &pagecache[(((u_int32_t) file >> 4) ^ (offset / PAGE_SIZE)) % PAGECACHE_BUCKETS];
+}
+
+static
+u_int32_t
+pagecache_lookup(struct vnode *file, off_t offset)
+{
+	u_int32_t i;
+
+	for (i = *pagecache_bucket(file, offset); i != NO_PAGE; i = pages[i].cache_next) {
+		if (pages[i].file == file && pages[i].offset == offset) return i;
+	}
+	return NO_PAGE;
+}
+
+static
+void
+pagecache_insert(u_int32_t i, struct vnode *file, off_t offset)
+{
+	u_int32_t *bucket = pagecache_bucket(file, offset);
+
+	assert(pages[i].file == NULL);
+	pages[i].file = file;
+	pages[i].offset = offset;
+	pages[i].cache_next = *bucket;
+	*bucket = i;
+	vmstats.pagecache_pages++;
+}
+
+static
+void
+pagecache_remove(u_int32_t i)
+{
+	u_int32_t *pi;
+
+	for (pi = pagecache_bucket(pages[i].file, pages[i].offset); *pi != i;
+	     pi = &pages[*pi].cache_next) {
+		assert(*pi != NO_PAGE);
+	}
+	*pi = pages[i].cache_next;
+	pages[i].file = NULL;
+	pages[i].cache_next = NO_PAGE;
+	vmstats.pagecache_pages--;
+}
+
+/* Mark page I free, reset its coremap entry and put it on the free list */
+static
+void
+page_set_free(u_int32_t i)
+{
+	assert(pages[i].state != PAGE_FREE);
+	assert(pages[i].sharers == NULL);
+	assert(!pages[i].busy);
+
+	if (pages[i].file != NULL) pagecache_remove(i);
+
+	pages[i].state = PAGE_FREE;
+	pages[i].as = NULL;
+	pages[i].va = 0;
+	pages[i].number = 0;
+	pages[i].refcount = 0;
+	pages[i].swap_slot = -1;
+
+	freelist_add(i, 0);
+}
+
+/*
+ * Wait for busy page I to be done. Caller holds CoreMapLock, which is
+ * released while we sleep; anything looked up under it before may have
+ * changed by the time we return.
+ */
+static
+void
+page_wait(u_int32_t i)
+{
+	int spl;
+
+	assert(pages[i].busy);
+	vmstats.busy_waits++;
+
+	spl = splhigh();
+	lock_release(CoreMapLock);
+	thread_sleep(&pages[i]);
+	splx(spl);
+
+	lock_acquire(CoreMapLock);
+}
+
+/* Page I is done with its I/O; wake anyone waiting for it. Caller holds CoreMapLock. */
+static
+void
+page_unbusy_locked(u_int32_t i)
+{
+	int spl;
+
+	assert(pages[i].busy);
+	pages[i].busy = 0;
+
+	spl = splhigh();
+	thread_wakeup(&pages[i]);
+	splx(spl);
+}
+
+void
+page_unbusy(paddr_t paddr)
+{
+	lock_acquire(CoreMapLock);
+	page_unbusy_locked(paddr / PAGE_SIZE);
+	lock_release(CoreMapLock);
+}
+
+/*
+ * Wait until the page PTE maps, if any, isn't busy. Caller holds
+ * CoreMapLock (see page_wait()).
+ */
+static
+void
+pte_wait(pte_t *pte)
+{
+	while ((*pte & PTE_VALID) && pages[PTE_PADDR(*pte) / PAGE_SIZE].busy) {
+		page_wait(PTE_PADDR(*pte) / PAGE_SIZE);
+	}
+}
+
+/*
+ * Initializes virtual memory
+ * Creates a lock for coremap, checks how much space would be needed for coremap
+ * Allocates the space required for coremap, and initializes it
+ * Sets vm_init_flag to 1 showing that the vm is setup
+ */
+void
+vm_bootstrap(void)
+{
+	u_int32_t firstaddr, lastaddr, freeaddr;
+	CoreMapLock = lock_create("CoreMapLock");
+	SwapLock = lock_create("SwapLock");
+	//gets size of ram with lastaddr
+	ram_getsize(&firstaddr, &lastaddr);
+	//number of pages needed for coremap
+	page_num = lastaddr / PAGE_SIZE;
+	//sets up the coremap=pages pointer
+	pages = (struct page*)PADDR_TO_KVADDR(firstaddr);
+	//the kseg2 map goes after it
+	kva_npages = page_num;
+	kva_map = (u_int32_t *) (pages + page_num);
+	//to know which paddr is actually free
+	freeaddr = firstaddr + page_num * sizeof(struct page) + kva_npages * sizeof(u_int32_t);
+	u_int32_t i;
+	//setting up first free page
+	if (freeaddr % PAGE_SIZE == 0)
+		first_free_page = freeaddr / PAGE_SIZE;
+	else{
+		first_free_page = freeaddr / PAGE_SIZE + 1;
+	}
+
+	kprintf("Available memory to start: %dk\n"
+		"Total pages in coremap: %d\n"
+		"Available pages to start: %d\n"
+		"First free page to start: %d\n"
+		"First free paddr to start: 0x%x\n",
+		(lastaddr - freeaddr) / 1024, page_num, (lastaddr - freeaddr) / PAGE_SIZE, first_free_page, (paddr_t) (first_free_page * PAGE_SIZE));
+
+	/*
+	 *  Okay, looks good.
+	 *  pages - a pointer (virtual) to the start of our core map
+	 *  first_free_page - first available page above all the kernel code
+	 *  page_num - total number of pages in our core map
+	 */
+
+	//loop through coremap to initialize page structs
+	for (i = 0; i < page_num; i++){
+		if (i < first_free_page){
+			pages[i].state = PAGE_FIXED;
+			pages[i].va = PADDR_TO_KVADDR(i * PAGE_SIZE);
+		}
+		else{
+			pages[i].state = PAGE_FIXED;	/* page_set_free() below */
+			pages[i].va = 0;
+		}
+		pages[i].as = NULL;
+		pages[i].number = 0;
+		pages[i].refcount = 0;
+		pages[i].sharers = NULL;
+		pages[i].busy = 0;
+		pages[i].swap_slot = -1;
+		pages[i].file = NULL;
+		pages[i].cache_next = NO_PAGE;
+		pages[i].free_next = pages[i].free_prev = NO_PAGE;
+		pages[i].zeroed = 0;
+		pages[i].kheap = NULL;
+	}
+	for (i = 0; i < kva_npages; i++){
+		kva_map[i] = 0;
+	}
+	/* Build the free list backwards so low pages get handed out first */
+	for (i = page_num - 1; i >= first_free_page; i--){
+		page_set_free(i);
+	}
+	zero_pool_target = (page_num - first_free_page) / ZEROPOOL_DIV;
+
+	//set flag
+	vm_init_flag = 1;
+
+	//variables for debugging
+	global_lastaddr = lastaddr;
+	TLB_replacement_counter = 0;
+	bzero(&vmstats, sizeof(vmstats));
+
+	kheap_bootstrap();
+}
+
+/*
+ * Open the swap device, size the swap slot bitmap to fit it and start
+ * the pageout thread. Runs after vm_bootstrap(), once devices are
+ * attached and kmalloc works. Without a swap device we carry on, but
+ * can't evict dirty pages.
+ */
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, &swapfile);
+	if (result) {
+		kprintf("vm: no swap device %s: %s\n", SWAP_DEVICE, strerror(result));
+		swapfile = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swapfile, &st);
+	if (result) {
+		panic("vm: can't stat swap device %s: %s\n", SWAP_DEVICE, strerror(result));
+	}
+
+	swap_slots = st.st_size / PAGE_SIZE;
+	swapmap = bitmap_create(swap_slots);
+	if (swapmap == NULL) {
+		panic("vm: no memory for %u-page swap bitmap\n", swap_slots);
+	}
+
+	kprintf("vm: swapping to %s, %u pages (%uk)\n", SWAP_DEVICE,
+		swap_slots, swap_slots * PAGE_SIZE / 1024);
+
+	swap_buf = kmalloc(SWAP_CLUSTER * PAGE_SIZE);
+	if (swap_buf == NULL) {
+		kprintf("vm: no memory for swap clustering\n");
+	}
+	else swap_cluster = SWAP_CLUSTER;
+	zcache_bootstrap(swap_slots, (page_num - first_free_page) / ZCACHE_DIV);
+
+	/* Keep 1/32 to 1/16 of user memory free, but at least a few pages */
+	pageout_lowat = (page_num - first_free_page) / PAGEOUT_LOWAT_DIV;
+	if (pageout_lowat < PAGEOUT_MIN) pageout_lowat = PAGEOUT_MIN;
+	pageout_hiwat = 2 * pageout_lowat;
+
+	pageout_cv = cv_create("pageout");
+	if (pageout_cv == NULL) {
+		panic("vm: can't create pageout cv\n");
+	}
+	result = thread_fork("pageout", NULL, 0, pageout_thread, NULL);
+	if (result) {
+		panic("vm: can't start pageout thread: %s\n", strerror(result));
+	}
+}
+
+/*
+ * Find N free swap slots in a row, starting from where the last search
+ * left off, and mark them used. Returns 0 with the first in *SLOT, or
+ * ENOSPC. Caller holds CoreMapLock.
+ */
+static
+int
+swap_alloc_run(u_int32_t n, u_int32_t *slot)
+{
+	u_int32_t i, run, tries, start;
+
+	if (swapmap == NULL || n > swap_slots) {
+		return ENOSPC;
+	}
+
+	run = 0;
+	for (i = swap_rotor, tries = 0; tries < swap_slots + n; i++, tries++) {
+		if (i == swap_slots) {
+			/* Runs don't wrap around */
+			i = 0;
+			run = 0;
+		}
+		if (bitmap_isset(swapmap, i)) {
+			run = 0;
+			continue;
+		}
+		if (++run == n) {
+			start = i + 1 - n;
+			for (i = start; i < start + n; i++) {
+				bitmap_mark(swapmap, i);
+			}
+			swap_slots_used += n;
+			swap_rotor = (start + n) % swap_slots;
+			*slot = start;
+			return 0;
+		}
+	}
+	return ENOSPC;
+}
+
+/*
+ * Release swap slot SLOT, and its copy in the swap cache if it has
+ * one. Caller holds CoreMapLock.
+ */
+static
+void
+swap_free(int slot)
+{
+	assert(slot >= 0 && (u_int32_t) slot < swap_slots);
+	assert(bitmap_isset(swapmap, slot));
+
+	zcache_drop(slot);
+	bitmap_unmark(swapmap, slot);
+	swap_slots_used--;
+}
+
+void
+vm_printstats(void)
+{
+	u_int32_t misses = tlb_fast_refills + vmstats.tlb_slow_misses;
+	u_int32_t switches = vmstats.as_switches ? vmstats.as_switches : 1;
+
+	kprintf("VM statistics:\n");
+	kprintf("    free pages: %u of %u\n", free_page_count, page_num - first_free_page);
+	kprintf("    fork: pages shared copy-on-write: %u, pages copied: %u (%u bytes)\n",
+		vmstats.fork_pages_shared, vmstats.fork_pages_copied,
+		vmstats.fork_pages_copied * PAGE_SIZE);
+	kprintf("    copy-on-write faults: %u, pages copied on write: %u (%u bytes)\n",
+		vmstats.cow_faults, vmstats.cow_copies, vmstats.cow_copies * PAGE_SIZE);
+	kprintf("    faults: %u (%u minor, %u major), evictions: %u (policy %s, %u second chances)\n",
+		vmstats.faults, vmstats.minor_faults, vmstats.major_faults,
+		vmstats.evictions, policy->name, vmstats.clock_second_chances);
+	kprintf("    swap-outs: %u, swap-ins: %u\n", vmstats.swapouts, vmstats.swapins);
+	kprintf("    pages loaded from executables: %u (%u by read-ahead), pages read from files: %u\n",
+		vmstats.exec_loads, vmstats.exec_readaheads, vmstats.file_reads);
+	kprintf("    page cache: %u pages, %u hits, %u misses, %u evictions\n",
+		vmstats.pagecache_pages, vmstats.pagecache_hits,
+		vmstats.pagecache_misses, vmstats.pagecache_evictions);
+	kprintf("    evictions by faulting thread: %u, by pageout thread: %u (%u wakeups, free %u-%u)\n",
+		vmstats.sync_evictions, vmstats.background_evictions,
+		vmstats.pageout_wakeups, pageout_lowat, pageout_hiwat);
+	kprintf("    waits for pages in transit: %u\n", vmstats.busy_waits);
+	kprintf("    stack pages faulted in: %u, stack overflows: %u\n",
+		vmstats.stack_pages, vmstats.stack_overflows);
+	kprintf("    heap pages freed by sbrk: %u, PTEs unmapped at exit: %u\n",
+		vmstats.heap_pages_freed, vmstats.teardown_ptes);
+	kprintf("    mmap faults: %u, shared pages written back: %u\n",
+		vmstats.mmap_faults, vmstats.mmap_writebacks);
+	kprintf("    pre-zeroed pages: %u (target %u), zeroed while idle: %u, hits: %u, misses: %u\n",
+		zero_page_count, zero_pool_target, vmstats.pages_prezeroed,
+		vmstats.zero_hits, vmstats.zero_misses);
+	kprintf("    swap slots in use: %u of %u\n", swap_slots_used, swap_slots);
+	kprintf("    swap I/O requests: %u writes (%u pages along with a victim), %u reads (%u pages read ahead), cluster %u\n",
+		vmstats.swap_writes, vmstats.swap_clustered, vmstats.swap_reads,
+		vmstats.swap_readaheads, swap_cluster);
+	kprintf("    kseg2: %u of %u pages in use, %u allocations, %u TLB misses\n",
+		kva_pages_used, kva_npages, vmstats.kva_allocs, vmstats.kva_faults);
+	kprintf("    page tables: %u (%uk)\n", vmstats.page_tables,
+		vmstats.page_tables * sizeof(struct page_table) / 1024);
+	kprintf("    TLB misses: %u refilled by the fast path, %u passed to vm_fault; %u modify faults\n",
+		tlb_fast_refills, vmstats.tlb_slow_misses, vmstats.tlb_modify_faults);
+	kprintf("    address space switches: %u, ASID rollovers: %u, TLB misses per switch: %u.%02u\n",
+		vmstats.as_switches, vmstats.asid_rollovers,
+		misses / switches, (misses % switches) * 100 / switches);
+	kprintf("    TLB random replacements: %d\n", TLB_replacement_counter);
+}
+
+/*
+ * Fill in VS with the system-wide numbers. Resident pages are the user
+ * pages in the coremap, so a page shared by several processes counts
+ * once; swapped pages are the swap slots in use.
+ */
+void
+vm_getstats(struct vmstat *vs)
+{
+	u_int32_t i;
+
+	lock_acquire(CoreMapLock);
+	vs->vs_tlbmisses = tlb_fast_refills + vmstats.tlb_slow_misses;
+	vs->vs_minflt = vmstats.minor_faults;
+	vs->vs_majflt = vmstats.major_faults;
+	vs->vs_swapins = vmstats.swapins + vmstats.swap_readaheads;
+	vs->vs_swapouts = vmstats.swapouts;
+	vs->vs_filereads = vmstats.file_reads;
+	vs->vs_zerofills = vmstats.zero_hits + vmstats.zero_misses;
+	vs->vs_resident = 0;
+	for (i = first_free_page; i < page_num; i++) {
+		if (pages[i].state != PAGE_FREE && pages[i].state != PAGE_FIXED) {
+			vs->vs_resident++;
+		}
+	}
+	vs->vs_swapped = swap_slots_used;
+	vs->vs_freepages = free_page_count;
+	vs->vs_totalpages = page_num - first_free_page;
+	lock_release(CoreMapLock);
+}
+
+u_int32_t
+vm_user_pages(void)
+{
+	return page_num - first_free_page;
+}
+
+/*
+ * Unlocked, so only a hint, but that's all the caches that ask need.
+ */
+int
+vm_memory_low(void)
+{
+	return free_page_count < pageout_lowat;
+}
+
+int
+vm_set_policy(const char *name)
+{
+	u_int32_t i;
+
+	for (i = 0; i < NPOLICIES; i++) {
+		if (!strcmp(name, policies[i].name)) {
+			lock_acquire(CoreMapLock);
+			policy = &policies[i];
+			lock_release(CoreMapLock);
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+const char *
+vm_policy_name(void)
+{
+	return policy->name;
+}
+
+int
+vm_set_swap_cluster(u_int32_t npages)
+{
+	if (npages < 1 || npages > SWAP_CLUSTER || (npages > 1 && swap_buf == NULL)) {
+		return EINVAL;
+	}
+	lock_acquire(CoreMapLock);
+	swap_cluster = npages;
+	lock_release(CoreMapLock);
+	return 0;
+}
+
+int
+find_region (vaddr_t faultaddress, struct addrspace *as){
+	/* Lowest address the stack may grow down to */
+	vaddr_t stack_limit = as->stack->top - USER_STACK_MAX;
+
+	/* Determine our region, and fault if not a valid address */
+		if (faultaddress >= as->code->base && faultaddress < as->code->top) {
+			return CODE_REGION;
+		}
+		else if (faultaddress >= as->data->base && faultaddress < as->data->top) {
+			return DATA_REGION;
+		}
+		else if (faultaddress >= as->heap->base && faultaddress <= as->heap->top) {
+			/* Don't let the heap grow into the guard region below the mappings or stack */
+			if (faultaddress + USER_STACK_GUARD >= as->mmap_base) return -1;
+			return HEAP_REGION;
+		}
+		else if (faultaddress >= as->mmap_base && faultaddress < stack_limit) {
+			if (as_mmap_find(as, faultaddress) == NULL) return -1;
+			return MMAP_REGION;
+		}
+		else if (faultaddress >= stack_limit && faultaddress < as->stack->top) {
+			if (faultaddress < as->heap->top + USER_STACK_GUARD) return -1;
+			return STACK_REGION;
+		}
+		return -1;
+}
+
+
+/*
+ * Drop AS's TLB entry for VA, if it's there. Entries of any address
+ * space can be in the TLB, tagged with its ID (see as_activate()).
+ */
+static
+void
+tlb_invalidate(struct addrspace *as, vaddr_t va)
+{
+	int i, spl;
+
+	spl = splhigh();
+	if (AS_IN_TLB(as)) {
+		i = TLB_Probe(va | (as->asid << TLBHI_PID_SHIFT), 0);
+		if (i >= 0) {
+			TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	splx(spl);
+}
+
+/*
+ * Drop all of AS's TLB entries.
+ */
+void
+tlb_flush_as(struct addrspace *as)
+{
+	u_int32_t ehi, elo;
+	int i, spl;
+
+	spl = splhigh();
+	if (AS_IN_TLB(as)) {
+		for (i=0; i<NUM_TLB; i++) {
+			TLB_Read(&ehi, &elo, i);
+			if ((elo & TLBLO_VALID) && !(elo & TLBLO_GLOBAL) &&
+			    (ehi & TLBHI_PID) == (as->asid << TLBHI_PID_SHIFT)) {
+				TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+		}
+	}
+	splx(spl);
+}
+
+/* Page table entry of a page AS has mapped at VA */
+static
+pte_t *
+as_pte(struct addrspace *as, vaddr_t va)
+{
+	return &as->page_directory[va >> 22]->entries[(va & PAGE_TABLE_MASK) >> 12];
+}
+
+/* Page table entry mapping user page I (its first mapping, if shared) */
+static
+pte_t *
+page_pte(u_int32_t i)
+{
+	return as_pte(pages[i].as, pages[i].va);
+}
+
+/*
+ * Has user page I been used since we last asked? Checks (and clears)
+ * PTE_REFERENCE in every mapping of it, dropping the TLB entries so the
+ * next access through each of them faults and sets the bit again.
+ */
+static
+int
+page_referenced(u_int32_t i)
+{
+	struct page_mapping *pm;
+	pte_t *pte;
+	int referenced = 0;
+
+	pte = page_pte(i);
+	if (*pte & PTE_REFERENCE) {
+		*pte &= ~PTE_REFERENCE;
+		tlb_invalidate(pages[i].as, pages[i].va);
+		referenced = 1;
+	}
+	for (pm = pages[i].sharers; pm != NULL; pm = pm->next) {
+		pte = as_pte(pm->as, pm->va);
+		if (*pte & PTE_REFERENCE) {
+			*pte &= ~PTE_REFERENCE;
+			tlb_invalidate(pm->as, pm->va);
+			referenced = 1;
+		}
+	}
+	return referenced;
+}
+
+/*
+ * Evict page-cache page I: unmap it from everyone (their PTEs go back
+ * to untouched, so they'll find it in the cache again, or read it from
+ * the file) and free it. The PTEs keep their permission bits, so they
+ * stay nonzero; only the owner of a page table changes that (see
+ * pte_set()). The page must be clean. The
+ * page_mappings go on dead_mappings, since we hold CoreMapLock.
+ */
+static
+void
+pagecache_evict(u_int32_t i)
+{
+	struct page_mapping *pm;
+	pte_t *pte;
+
+	assert(pages[i].file != NULL && !pages[i].busy);
+	assert(pages[i].state == PAGE_CLEAN);
+
+	pte = page_pte(i);
+	pte_set(pages[i].as, pages[i].va, pte, *pte & PTE_PERMS);
+	tlb_invalidate(pages[i].as, pages[i].va);
+	while ((pm = pages[i].sharers) != NULL) {
+		pages[i].sharers = pm->next;
+		pte = as_pte(pm->as, pm->va);
+		pte_set(pm->as, pm->va, pte, *pte & PTE_PERMS);
+		tlb_invalidate(pm->as, pm->va);
+		pm->next = dead_mappings;
+		dead_mappings = pm;
+	}
+	pages[i].refcount = 0;
+
+	vmstats.evictions++;
+	vmstats.pagecache_evictions++;
+	page_set_free(i);
+}
+
+/* kfree the mappings pagecache_evict() left behind. Caller doesn't hold CoreMapLock. */
+static
+void
+mappings_reap(void)
+{
+	struct page_mapping *pm, *next;
+
+	lock_acquire(CoreMapLock);
+	pm = dead_mappings;
+	dead_mappings = NULL;
+	lock_release(CoreMapLock);
+
+	for (; pm != NULL; pm = next) {
+		next = pm->next;
+		kmem_cache_free(&mapping_cache, pm);
+	}
+}
+
+/*
+ * Write dirty page-cache page I (a MAP_SHARED page) back to its file.
+ * Every mapping of it is made read-only first, so a write while we're
+ * at it faults and dirties the page again. Only as much as is in the
+ * file is written; mapping a file doesn't make it any longer.
+ *
+ * Caller holds CoreMapLock. Like swapout_page(), it's released during
+ * the write, with the page busy.
+ */
+static
+int
+pagecache_writeback(u_int32_t i)
+{
+	struct page_mapping *pm;
+	struct stat st;
+	struct uio u;
+	size_t len;
+	int result;
+
+	assert(pages[i].file != NULL && pages[i].state == PAGE_DIRTY);
+	assert(!pages[i].busy);
+
+	pages[i].busy = 1;
+	pages[i].state = PAGE_CLEAN;
+	*page_pte(i) &= ~PTE_MODIFY;
+	tlb_invalidate(pages[i].as, pages[i].va);
+	for (pm = pages[i].sharers; pm != NULL; pm = pm->next) {
+		*as_pte(pm->as, pm->va) &= ~PTE_MODIFY;
+		tlb_invalidate(pm->as, pm->va);
+	}
+	lock_release(CoreMapLock);
+
+	result = VOP_STAT(pages[i].file, &st);
+	if (result == 0 && st.st_size > pages[i].offset) {
+		len = st.st_size - pages[i].offset;
+		if (len > PAGE_SIZE) len = PAGE_SIZE;
+		mk_kuio(&u, (void *) PADDR_TO_KVADDR(i * PAGE_SIZE), len,
+			pages[i].offset, UIO_WRITE);
+		result = VOP_WRITE(pages[i].file, &u);
+		if (result == 0 && u.uio_resid != 0) {
+			result = EIO;
+		}
+	}
+
+	lock_acquire(CoreMapLock);
+	page_unbusy_locked(i);
+	if (result) {
+		pages[i].state = PAGE_DIRTY;
+		return result;
+	}
+	vmstats.mmap_writebacks++;
+	return 0;
+}
+
+/*
+ * Write user page PAGE_NUM out to swap. A page that has no slot yet
+ * gets one; after that the slot stays with it (in the coremap while
+ * it's resident, in its PTE while it's not) until the page is unmapped
+ * or shared. Returns ENOSPC if swap is full or there isn't any.
+ *
+ * If the compressed swap cache takes the page, that's where its slot's
+ * contents live and there's no disk write. Otherwise the dirty pages
+ * right after it in its address space (if they're only mapped there)
+ * go to disk with it, in the same request, so they can be evicted
+ * without a write later and read back in along with it; they get new
+ * slots, in a row after its own. The write is skipped for them if
+ * there's no such run of free slots.
+ *
+ * CoreMapLock, which the caller holds, is released during the write,
+ * with the pages marked busy so nobody touches them meanwhile. Their
+ * TLB entries are dropped first so that their owner can't write to
+ * them behind our back.
+ */
+static
+int
+swapout_page(int page_num)
+{
+	struct addrspace *as = pages[page_num].as;
+	u_int32_t cluster[SWAP_CLUSTER];
+	u_int32_t n, k, slot;
+	struct uio u;
+	pte_t *pte;
+	int result;
+
+	if (pages[page_num].swap_slot < 0) {
+		if (swap_alloc_run(1, &slot)) {
+			return ENOSPC;
+		}
+		pages[page_num].swap_slot = slot;
+	}
+
+	*page_pte(page_num) &= ~PTE_MODIFY;
+	tlb_invalidate(as, pages[page_num].va);
+
+	if (zcache_store(pages[page_num].swap_slot, page_num * PAGE_SIZE) == 0) {
+		pages[page_num].state = PAGE_CLEAN;
+		return 0;
+	}
+
+	/* Going to disk anyway; find the pages to take along */
+	cluster[0] = page_num;
+	for (n = 1; n < swap_cluster; n++) {
+		pte = pte_lookup(as, pages[page_num].va + n * PAGE_SIZE, 0);
+		if (pte == NULL || !(*pte & PTE_VALID)) break;
+		k = PTE_PADDR(*pte) / PAGE_SIZE;
+		if (pages[k].state != PAGE_DIRTY || pages[k].busy ||
+		    pages[k].refcount != 1 || pages[k].file != NULL) break;
+		cluster[n] = k;
+	}
+	if (n > 1 && swap_alloc_run(n, &slot) == 0) {
+		for (k = 0; k < n; k++) {
+			if (pages[cluster[k]].swap_slot >= 0) swap_free(pages[cluster[k]].swap_slot);
+			pages[cluster[k]].swap_slot = slot + k;
+		}
+	}
+	else n = 1;
+
+	for (k = 0; k < n; k++) {
+		pages[cluster[k]].busy = 1;
+		if (k > 0) {
+			*page_pte(cluster[k]) &= ~PTE_MODIFY;
+			tlb_invalidate(as, pages[cluster[k]].va);
+		}
+	}
+	slot = pages[page_num].swap_slot;
+
+	lock_release(CoreMapLock);
+	lock_acquire(SwapLock);
+	if (n == 1) {
+		mk_kuio(&u, (void *) PADDR_TO_KVADDR(page_num * PAGE_SIZE), PAGE_SIZE,
+			slot * PAGE_SIZE, UIO_WRITE);
+	}
+	else {
+		for (k = 0; k < n; k++) {
+			memcpy(swap_buf + k * PAGE_SIZE,
+			       (void *) PADDR_TO_KVADDR(cluster[k] * PAGE_SIZE), PAGE_SIZE);
+		}
+		mk_kuio(&u, swap_buf, n * PAGE_SIZE, slot * PAGE_SIZE, UIO_WRITE);
+	}
+	result = VOP_WRITE(swapfile, &u);
+	lock_release(SwapLock);
+	lock_acquire(CoreMapLock);
+
+	for (k = 0; k < n; k++) {
+		page_unbusy_locked(cluster[k]);
+	}
+	if (result == 0 && u.uio_resid != 0) {
+		/* short write; problem with file? */
+		result = EIO;
+	}
+	if (result) {
+		return result;
+	}
+
+	for (k = 0; k < n; k++) {
+		pages[cluster[k]].state = PAGE_CLEAN;
+	}
+	as->as_stats.vs_swapouts += n;
+	vmstats.swapouts += n;
+	vmstats.swap_writes++;
+	vmstats.swap_clustered += n - 1;
+	return 0;
+}
+
+/*
+ * Read swap slot SWAP_ENTRY into the page at PADDR, which the caller
+ * has marked busy: from the compressed swap cache if it's there, or
+ * else from disk. Called without CoreMapLock.
+ */
+int
+swapin_page(paddr_t paddr, int swap_entry)
+{
+	struct uio u;
+	int result;
 
+	lock_acquire(CoreMapLock);
+	result = zcache_load(swap_entry, paddr);
+	lock_release(CoreMapLock);
+	if (result == 0) {
+		return 0;
+	}
 
-/* Swapping variables*/
-struct swap_page *SwapTable;
-struct lock * SwapTableLock;
-int swap_file_init = 0;		/* flag to setup once swap_file created*/
-struct vnode* swapfile;
+	mk_kuio(&u, (void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE, (swap_entry * PAGE_SIZE), UIO_READ);
 
+	lock_acquire(SwapLock);
+	result = VOP_READ(swapfile, &u);
+	lock_release(SwapLock);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		/* short read; problem with file? */
+		return EIO;
+	}
+	vmstats.swapins++;
+	vmstats.swap_reads++;
+	return 0;
+}
 
 /*
- * Initializes virtual memory
- * Creates a lock for coremap, checks how much space would be needed for coremap
- * Allocates the space required for coremap, and initializes it
- * Sets vm_init_flag to 1 showing that the vm is setup
+ * Swap read-ahead. The page at VA of AS is about to be read in from
+ * swap slot SLOT. Give each of the pages after it that went out to the
+ * slots after SLOT (see swapout_page()) a page to be read into in the
+ * same request: mapped, busy, and in RA. Only pages that are free
+ * anyway are used, as for exec_readahead(). Returns how many.
+ * Caller holds CoreMapLock.
  */
-void
-vm_bootstrap(void)
+static
+u_int32_t
+swap_readahead(struct addrspace *as, vaddr_t va, int slot, paddr_t *ra)
 {
-	u_int32_t firstaddr, lastaddr, freeaddr;
-	CoreMapLock = lock_create("CoreMapLock");
-	SwapTableLock = lock_create("SwapTableLock");
-	//gets size of ram with lastaddr
-	ram_getsize(&firstaddr, &lastaddr);
-	//number of pages needed for coremap
-	page_num = lastaddr / PAGE_SIZE;
-	//sets up the coremap=pages pointer
-	pages = (struct page*)PADDR_TO_KVADDR(firstaddr);
-	//to know which paddr is actually free
-	freeaddr = firstaddr + page_num * sizeof(struct page);
-	SwapTable = (struct swap_page*)PADDR_TO_KVADDR(freeaddr);
-	freeaddr +=  SWAPTABLE_SIZE * sizeof(struct swap_page);
-	u_int32_t i;
-	//setting up first free page
-	if (freeaddr % PAGE_SIZE == 0)
-		first_free_page = freeaddr / PAGE_SIZE;
-	else{
-		first_free_page = freeaddr / PAGE_SIZE + 1;
+	paddr_t paddr;
+	pte_t *pte;
+	u_int32_t n;
+
+	for (n = 0; n + 1 < swap_cluster; n++) {
+		va += PAGE_SIZE;
+		pte = pte_lookup(as, va, 0);
+		if (pte == NULL || !(*pte & PTE_SWAPPED) ||
+		    PTE_SLOT(*pte) != slot + (int) n + 1) break;
+		if (free_page_count <= pageout_lowat) break;
+
+		paddr = page_alloc_locked(USER_ALLOC, va, as);
+		if (paddr == 0) break;
+		pages[paddr / PAGE_SIZE].swap_slot = PTE_SLOT(*pte);
+		pte_set(as, va, pte, PTE_MKVALID(paddr, *pte & PTE_PERMS));
+		ra[n] = paddr;
 	}
+	return n;
+}
 
-	kprintf("Available memory to start: %dk\n"
-		"Total pages in coremap: %d\n"
-		"Available pages to start: %d\n"
-		"First free page to start: %d\n"
-		"First free paddr to start: 0x%x\n",
-		(lastaddr - freeaddr) / 1024, page_num, (lastaddr - freeaddr) / PAGE_SIZE, first_free_page, (paddr_t) (first_free_page * PAGE_SIZE));
+/*
+ * Read swap slots SLOT through SLOT + N - 1 into the (busy) pages at
+ * PADDRS, in one request. The first isn't in the compressed swap
+ * cache, or we wouldn't be here; if any of the others are, the copy
+ * there is the current one. Called without CoreMapLock.
+ */
+static
+int
+swapin_cluster(paddr_t *paddrs, u_int32_t n, int slot)
+{
+	struct uio u;
+	u_int32_t k;
+	int result;
 
-	/*
-	 *  Okay, looks good.
-	 *  pages - a pointer (virtual) to the start of our core map
-	 *  first_free_page - first available page above all the kernel code
-	 *  page_num - total number of pages in our core map
-	 */
+	if (n == 1) {
+		return swapin_page(paddrs[0], slot);
+	}
 
-	//loop through coremap to initialize page structs
-	for (i = 0; i < page_num; i++){
-		if (i < first_free_page){
-			pages[i].state = PAGE_FIXED;
-			pages[i].va = PADDR_TO_KVADDR(i * PAGE_SIZE);
-		}
-		else{
-			pages[i].state = PAGE_FREE;
-			pages[i].va = 0;
+	lock_acquire(SwapLock);
+	mk_kuio(&u, swap_buf, n * PAGE_SIZE, slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swapfile, &u);
+	if (result == 0 && u.uio_resid != 0) {
+		/* short read; problem with file? */
+		result = EIO;
+	}
+	if (result == 0) {
+		for (k = 0; k < n; k++) {
+			memcpy((void *) PADDR_TO_KVADDR(paddrs[k]), swap_buf + k * PAGE_SIZE, PAGE_SIZE);
 		}
-		pages[i].as = NULL;
-		pages[i].number = 0;
+	}
+	lock_release(SwapLock);
+	if (result) {
+		return result;
 	}
 
-	//loop through SwapTable to initialize it
-	for (i = 0; i < SWAPTABLE_SIZE; i++){
-		SwapTable[i].as = NULL;
-		SwapTable[i].va = 0;
-
+	lock_acquire(CoreMapLock);
+	for (k = 1; k < n; k++) {
+		zcache_load(slot + k, paddrs[k]);
 	}
-	//set flag
-	vm_init_flag = 1;
+	lock_release(CoreMapLock);
 
-	//variables for debugging
-	global_lastaddr = lastaddr;
-	TLB_replacement_counter = 0;
+	vmstats.swapins++;
+	vmstats.swap_reads++;
+	vmstats.swap_readaheads += n - 1;
+	return 0;
 }
 
-int
-find_region (vaddr_t faultaddress, struct addrspace *as){
-	/* Determine our region, and fault if not a valid address */
-		if (faultaddress >= as->code->base && faultaddress < as->code->top) {
-			return CODE_REGION;
-		}
-		else if (faultaddress >= as->data->base && faultaddress < as->data->top) {
-			return DATA_REGION;
-		}
-		else if (faultaddress >= as->heap->base && faultaddress <= as->heap->top) {
-			if (faultaddress == as->stack->base){
-				/* Should probably just return EFAULT here */
-				panic("Stack overflow - not yet supported.\n");
-			}
-			return HEAP_REGION;
-		}
-		else if (faultaddress >= (as->stack->base - PAGE_SIZE) && faultaddress < as->stack->top) {
-			return STACK_REGION;
-		}
-		return -1;
+/*
+ * Take user page PAGE_NUM away from its owner, whose PTE is left
+ * pointing at the page's swap slot, and free it. The page must have
+ * been written to swap already.
+ */
+static
+void
+evict_page(u_int32_t page_num){
+	pte_t *pte;
+
+	assert(pages[page_num].state == PAGE_CLEAN);
+	assert(pages[page_num].swap_slot >= 0);
+	tlb_invalidate(pages[page_num].as, pages[page_num].va);
+
+	pte = page_pte(page_num);
+	pte_set(pages[page_num].as, pages[page_num].va, pte,
+		PTE_MKSWAPPED(pages[page_num].swap_slot, *pte & PTE_PERMS));
+	pages[page_num].swap_slot = -1;
+
+	vmstats.evictions++;
+	page_set_free(page_num);
 }
 
+/*
+ * Pages shared copy-on-write are never evicted (see struct page), nor
+ * are busy ones; every other user page, including shared page-cache
+ * pages, is fair game.
+ */
+static
+int
+page_evictable(u_int32_t i)
+{
+	return (pages[i].state == PAGE_DIRTY || pages[i].state == PAGE_CLEAN) &&
+		(pages[i].refcount <= 1 || pages[i].file != NULL) && !pages[i].busy;
+}
 
+/*
+ * Evict evictable page I, writing it to swap (or back to its file)
+ * first if need be. Caller holds CoreMapLock, which is released while
+ * writing.
+ */
+static
 int
-swapout_page(int page_num, int *swap_entry ){
+page_evict(u_int32_t i)
+{
 	int result;
-	struct uio u;
-	struct addrspace *as;
-	int region;
-	vaddr_t va;
-	//this is only called from page_alloc or page_nalloc so assuming I have lock
-	as = pages[page_num].as;
-	va = pages[page_num].va;
-
-	lock_acquire(SwapTableLock);
-	//kprintf("In swapout\n");
-	if (!swap_file_init){
-		//first page to swap
-		//swapfile has no been opened yet
-		//kprintf("In swapout.....2\n");
-		int err = vfs_open("lhd0raw:", O_RDWR, &swapfile);
-		if (err != 0) {
-		    kprintf("In vfs_open error\n");
-		    return err;
-		}
-		//kprintf("In swapout.....3\n");
-		/*
-		 * Allocate the page in the first available space on the file
-		 */
-		//lock_acquire(SwapTableLock);
-		SwapTable->as = as;
-		SwapTable->va = va;
-		//lock_release(SwapTableLock);
-		/*
-		 * File IO
-		 */
-		//original uio for kernel
-		///*
-		mk_kuio(&u, PADDR_TO_KVADDR(page_num * PAGE_SIZE), PAGE_SIZE, 0, UIO_WRITE);
-		//*/
-		//uio for userspace addr
-		/*
-		region = find_region (va, as);
-		if ( region < 0) {
-				return EFAULT;
-		}
-
-		u.uio_iovec.iov_ubase = (userptr_t)va;
-		u.uio_iovec.iov_len = PAGE_SIZE;   // length of the memory space
-		u.uio_resid = PAGE_SIZE;          // amount to actually write
-		u.uio_offset = 0;
-		u.uio_segflg = (region == CODE_REGION) ? UIO_USERISPACE : UIO_USERSPACE;
-		u.uio_rw = UIO_WRITE;
-		u.uio_space = as;
-		*/
-		/*
-		u.uio_iovec.iov_kbase = (void *)PADDR_TO_KVADDR(page_num * PAGE_SIZE);
-		u.uio_iovec.iov_len = PAGE_SIZE;   // length of the memory space
-		u.uio_resid = PAGE_SIZE;          // amount to actually write
-		u.uio_offset = 0;
-		u.uio_segflg = UIO_SYSSPACE;
-		u.uio_rw = UIO_WRITE;
-		u.uio_space = NULL;
-		 */
-		result = VOP_WRITE(swapfile, &u);
-		if (result) {
-			return result;
-		}
-		//kprintf("In swapout.....5\n");
-		if (u.uio_resid != 0) {
-			/* short write; problem with file? */
-			kprintf("ELF: short write\n");
-			return EIO;
-		}
-		//kprintf("In swapout.....6\n");
-		*swap_entry = 0;
-		swap_file_init = 1;
-	}
-	else{
-		int i;
-		//lock_acquire(SwapTableLock);
-		//swap file already opened
-		for(i = 0; i < SWAPTABLE_SIZE; i++){
-			if (SwapTable[i].as == as && SwapTable[i].va == va)
-				break;
-		}
-		if (i == SWAPTABLE_SIZE){
-			//look for free page in disk
-			for(i = 0; i < SWAPTABLE_SIZE; i++){
-				if (SwapTable[i].as == NULL && SwapTable[i].va == 0){
-					SwapTable[i].as = as;
-					SwapTable[i].va = va;
-					break;
-				}
-			}
-		}
-		//lock_release(SwapTableLock);
-		if ( i ==  SWAPTABLE_SIZE)
-			panic("Ran out of pages in swap file.\n");
 
-		//original uio for kernel
-		///*
-		mk_kuio(&u, PADDR_TO_KVADDR(page_num * PAGE_SIZE), PAGE_SIZE, (i * PAGE_SIZE), UIO_WRITE);
-		//*/
-		//uio for userspace addr
-		/*
-		region = find_region (va, as);
-		if ( region < 0) {
-			return EFAULT;
-		}
-
-		u.uio_iovec.iov_ubase = (userptr_t)va;
-		u.uio_iovec.iov_len = PAGE_SIZE;   // length of the memory space
-		u.uio_resid = PAGE_SIZE;          // amount to actually write
-		u.uio_offset = (i * PAGE_SIZE);
-		u.uio_segflg = (region == CODE_REGION) ? UIO_USERISPACE : UIO_USERSPACE;
-		u.uio_rw = UIO_WRITE;
-		u.uio_space = as;
-		 */
-		/*
-		u.uio_iovec.iov_kbase = (void *)PADDR_TO_KVADDR(page_num * PAGE_SIZE);
-		u.uio_iovec.iov_len = PAGE_SIZE;   // length of the memory space
-		u.uio_resid = PAGE_SIZE;          // amount to actually write
-		u.uio_offset = (i * PAGE_SIZE);
-		u.uio_segflg = UIO_SYSSPACE;
-		u.uio_rw = UIO_WRITE;
-		u.uio_space = NULL;
-		 */
-		result = VOP_WRITE(swapfile, &u);
-		if (result) {
-			return result;
-		}
-		if (u.uio_resid != 0) {
-			/* short write; problem with file? */
-			kprintf("ELF: short write\n");
-			return EIO;
+	if (pages[i].file != NULL) {
+		if (pages[i].state == PAGE_DIRTY) {
+			result = pagecache_writeback(i);
+			if (result) return result;
 		}
+		pagecache_evict(i);
+		return 0;
+	}
+	if (pages[i].state == PAGE_DIRTY) {
+		result = swapout_page(i);
+		if (result) return result;
+	}
+	evict_page(i);
+	return 0;
+}
 
-		*swap_entry = i;
+/* FIFO: the user page that was allocated longest ago. */
+static
+u_int32_t
+fifo_select_victim(void)
+{
+	u_int32_t i;
+	u_int32_t page_selected = NO_PAGE;
+	u_int32_t page_time_min = 0xffffffff;
 
+	for (i = first_free_page; i < page_num; i++){
+		if (page_evictable(i) && pages[i].number < page_time_min){
+			page_time_min = pages[i].number;
+			page_selected = i;
+		}
 	}
+	return page_selected;
+}
 
-	lock_release(SwapTableLock);
-	pages[page_num].state = PAGE_CLEAN;
-	//(DB_VM, "In swapout end, swap_entry: %d, state: %d, as: %x, va: %x, page %d\n", *swap_entry, pages[page_num].state, as, va, page_num);
-	//kprintf("In swapout.....7\n");
+/*
+ * Clock (second chance): sweep the coremap, evicting the first page
+ * not referenced since the hand last passed it. A referenced page gets
+ * its PTE_REFERENCE bit cleared and its TLB entry dropped, so the next
+ * access faults into vm_fault() and sets the bit again. Two sweeps are
+ * enough: the first clears every bit it doesn't stop at.
+ */
+static
+u_int32_t
+clock_select_victim(void)
+{
+	u_int32_t i, n;
 
-	//kprintf("In swapout end, swap_entry: %d, state: %d, as: %d, va: %d\n", *swap_entry, pages[page_num].state, as, va);
-	return 0;
-}
+	if (clock_hand < first_free_page) clock_hand = first_free_page;
 
+	for (n = 0; n < 2 * (page_num - first_free_page); n++){
+		i = clock_hand;
+		if (++clock_hand >= page_num) clock_hand = first_free_page;
 
-void
-evict_page(int page_num, int swap_index){
-	//kprintf("In evict_page, swap_index: %d, page_num: %d\n", swap_index, page_num);
-	struct addrspace *as;
-	vaddr_t va;
-	int i = -1;
-	as = pages[page_num].as;
-	va = pages[page_num].va;
-	/* Search for the address in TLB*/
-	//kprintf("In evict.....1\n");
-	if (as == curthread->t_vmspace){
-		i = TLB_Probe(va,0);
-		//(DB_VM, "In evict page, TLB_PROBE %d\n", i);
-	}
-	if (i >= 0){
-		//kprintf("In evict.....i >= 0\n");
-		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		if (!page_evictable(i)) continue;
+
+		if (page_referenced(i)){
+			vmstats.clock_second_chances++;
+			continue;
+		}
+		return i;
 	}
-	//kprintf("In evict.....1\n");
-	int dir_index = va >> 22;
-	int pag_table_index = (va & PAGE_TABLE_MASK) >> 12;
-	as->page_directory[dir_index]->entries[pag_table_index]->swap_entry = swap_index;
-	as->page_directory[dir_index]->entries[pag_table_index]->valid = 0;
-	//kprintf("In evict.....2\n");
-	pages[page_num].state = PAGE_FREE;
-	pages[page_num].va = 0;
-	pages[page_num].as = NULL;
-	pages[page_num].number = 0;
+	return NO_PAGE;
 }
 
 
@@ -354,69 +1283,93 @@ getppages(unsigned long npages)
 }
 
 
-paddr_t
-page_alloc(int alloc_type, vaddr_t vaddr, struct addrspace *as)
+/*
+ * Free up one user page: ask the replacement policy for a victim,
+ * write it to swap if it's dirty, and evict it. Caller holds
+ * CoreMapLock, which is released while writing (see swapout_page()).
+ */
+static
+int
+page_reclaim(void)
 {
-		paddr_t addr;
+	u_int32_t victim;
 
-						//not sure if needs to be interrupts high
-						//but if there is a CS that uses a page that was chosen to be deleted
-						//Then I think problems would arise...
-						//Maybe just interrupts high while we choose and clear page would be good
-						//but I think the lock would take care of it since to access coremap
-						//the lock will always be required
-		lock_acquire(CoreMapLock);
-		u_int32_t i;
-		u_int32_t page_selected = 0;
-		// Not using this right now, and it's giving warnings.
-		u_int32_t page_time_min = 4294967295;		//I hope it gives a very large number :P		*/
-		int swap_index;
-		//DEBUG(DB_VM, "						In page_alloc, va x%x, as x%x type %d\n", vaddr, as, alloc_type);
-		for (i = first_free_page; i < page_num; i++){
-			if(pages[i].state == PAGE_FREE){
-				page_selected = i;
-				break;
-			}
-			/* Not thinking about swapping at all, for now */
+	victim = policy->select_victim();
+	if (victim == NO_PAGE) return ENOMEM;
 
-			else if (pages[i].number < page_time_min && pages[i].state != PAGE_FIXED){
-				page_time_min = pages[i].number;
-				page_selected = i;
-			}
+	return page_evict(victim);
+}
+
+/*
+ * The pageout thread. Woken by page_alloc() when free pages drop below
+ * pageout_lowat, it evicts pages (writing dirty ones to swap) until
+ * pageout_hiwat are free, so faults normally find a free page without
+ * waiting for the disk.
+ */
+static
+void
+pageout_thread(void *unused, unsigned long unused2)
+{
+	(void)unused;
+	(void)unused2;
+
+	lock_acquire(CoreMapLock);
+	for (;;) {
+		cv_wait(pageout_cv, CoreMapLock);
+		vmstats.pageout_wakeups++;
 
+		while (free_page_count < pageout_hiwat) {
+			if (page_reclaim()) break;
+			vmstats.background_evictions++;
 		}
-		if (i == page_num){		//if i == page_num then no free page found
-						//no free pages so must swap....
-			/* Not doing anything here, yet. Just panic, for now.. */
-			//panic("Ran out of pages. No swapping support yet.\n");
-			//kprintf("swapping starting, page selected %d\n", page_selected);
-			DEBUG(DB_VM, "					In page_alloc, need to swap page_selected # %d, va x%x, as x%x\n",
-					page_selected, pages[page_selected].va, pages[page_selected].as);
-			/*
-			 * If page is dirty then need to flush it to disk
-			 */
-			if (pages[page_selected].state == PAGE_FIXED) panic("EVERY SINGLE PAGE IS FIXED\n");
-			if (pages[page_selected].state == PAGE_DIRTY){
-				/*
-				 * need to create function to flush to disk
-				 * not sure how to do it now
-				 * TO BE DONE!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-				 */
-				//kprintf("Page dirty\n");
-				swapout_page(page_selected, &swap_index);
-				//page_flush(page_selected);
+
+		if (dead_mappings != NULL) {
+			lock_release(CoreMapLock);
+			mappings_reap();
+			lock_acquire(CoreMapLock);
+		}
+	}
+}
+
+/*
+ * Grab a page from the coremap, evicting one if we have to.
+ * Caller must hold CoreMapLock; note that evicting a dirty page lets
+ * go of it for a while. Returns 0 if we're out of memory (nothing
+ * evictable, or no room left in swap).
+ *
+ * User pages are handed out busy, so they can't be evicted before
+ * they're mapped and filled in. Call page_unbusy() when done.
+ * USER_ZERO_ALLOC is USER_ALLOC for a page that has to start out all
+ * zeros: it comes from the pre-zeroed pool if there's one there, and
+ * gets zeroed here if not.
+ */
+static
+paddr_t
+page_alloc_locked(int alloc_type, vaddr_t vaddr, struct addrspace *as)
+{
+		paddr_t addr;
+		u_int32_t page_selected;
+		int result, zeroed;
+		//DEBUG(DB_VM, "						In page_alloc, va x%x, as x%x type %d\n", vaddr, as, alloc_type);
+		while (free_list_head == NO_PAGE && zero_list_head == NO_PAGE){
+			/* No free pages, and the pageout thread hasn't kept up. Evict one ourselves. */
+			result = page_reclaim();
+			if (result){
+				DEBUG(DB_VM, "page_alloc: can't reclaim a page: %s\n", strerror(result));
+				return 0;
 			}
-			/*
-			 * If page is CLEAN then it means that it is updated to disk already
-			 */
-			evict_page(page_selected, swap_index);
-			/*
-			 * Now update page table or TLB to show that page_selected is no longer mapped to memory
-			 * PageTables are not setup yet so need to update...
-			 * Need function to update TLB and page table
-			 * TO BE DONE!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-			 */
-			//kprintf("Should be done with swapping....\n");
+			vmstats.sync_evictions++;
+		}
+
+		/* Leave the zeroed pages for whoever needs zeros, if we can */
+		if (alloc_type == USER_ZERO_ALLOC)
+			page_selected = (zero_list_head != NO_PAGE) ? zero_list_head : free_list_head;
+		else
+			page_selected = (free_list_head != NO_PAGE) ? free_list_head : zero_list_head;
+		zeroed = pages[page_selected].zeroed;
+		freelist_remove(page_selected);
+		if (free_page_count < pageout_lowat && pageout_cv != NULL){
+			cv_signal(pageout_cv, CoreMapLock);
 		}
 
 		/*
@@ -435,19 +1388,31 @@ page_alloc(int alloc_type, vaddr_t vaddr, struct addrspace *as)
 			pages[page_selected].va = PADDR_TO_KVADDR(addr);
 			pages[page_selected].state = PAGE_FIXED;
 			pages[page_selected].number = 1;
+			pages[page_selected].refcount = 0;
 
 			DEBUG(DB_VM, "Just gave page at: 0x%x to kernel: 0x%x virtual address: 0x%x\n"
 				     "Pages left (before we need to start swapping): %d.\n", 
 				addr, (u_int32_t) pages[page_selected].as, pages[page_selected].va, ((global_lastaddr - addr)/4096) - 1);
 		}
 		else{
-			/* alloc_type should be USER_ALLOC, then. Nothing else is supported. */
-			assert(alloc_type == USER_ALLOC);
+			/* alloc_type should be USER_ALLOC or USER_ZERO_ALLOC, then. Nothing else is supported. */
+			assert(alloc_type == USER_ALLOC || alloc_type == USER_ZERO_ALLOC);
 			assert(pages[page_selected].as != NULL);
+
+			if (alloc_type == USER_ZERO_ALLOC) {
+				if (zeroed) vmstats.zero_hits++;
+				else {
+					vmstats.zero_misses++;
+					bzero((void *) PADDR_TO_KVADDR(addr), PAGE_SIZE);
+				}
+			}
 			
 			pages[page_selected].va = vaddr;
 			pages[page_selected].state = PAGE_DIRTY;
 			pages[page_selected].number = page_counter;
+			pages[page_selected].refcount = 1;
+			pages[page_selected].sharers = NULL;
+			pages[page_selected].busy = 1;
 			page_counter++;
 			
 			DEBUG(DB_VM, "Just gave page at: 0x%x to user: 0x%x virtual address: 0x%x\n"
@@ -462,44 +1427,114 @@ page_alloc(int alloc_type, vaddr_t vaddr, struct addrspace *as)
 			kprintf("index %d, va %h, as %h, state %d, number %d\n",test_i,pages[test_i].va,pages[test_i].as, pages[test_i].state, pages[test_i].number);
 		}
 		*/
-		lock_release(CoreMapLock);
 
 		return addr;
 }
 
+paddr_t
+page_alloc(int alloc_type, vaddr_t vaddr, struct addrspace *as)
+{
+	paddr_t addr;
+
+	lock_acquire(CoreMapLock);
+	addr = page_alloc_locked(alloc_type, vaddr, as);
+	lock_release(CoreMapLock);
+
+	return addr;
+}
+
+/*
+ * Zero a free page for the pre-zeroed pool, if it's short. Called by
+ * the scheduler's idle loop, with interrupts off and no current thread,
+ * so it can't sleep waiting for CoreMapLock: if somebody has it, there's
+ * nothing to do this time. The page comes off the free list busy while
+ * it's zeroed with interrupts on, and goes onto the zeroed list after.
+ * Does one page at a time, so the idle loop can take interrupts in
+ * between. Returns 1 if it zeroed one, 0 if there was nothing to do.
+ */
+int
+page_prezero(void)
+{
+	u_int32_t i;
+	int spl, result;
+
+	assert(curspl>0);
+
+	if (!vm_init_flag || !lock_tryacquire(CoreMapLock)) return 0;
+	if (zero_page_count >= zero_pool_target || free_list_head == NO_PAGE) {
+		lock_release(CoreMapLock);
+		return 0;
+	}
+
+	i = free_list_head;
+	freelist_remove(i);
+	pages[i].busy = 1;
+	lock_release(CoreMapLock);
+
+	spl = spl0();
+	bzero((void *) PADDR_TO_KVADDR(i * PAGE_SIZE), PAGE_SIZE);
+	splx(spl);
+
+	/* No thread has run since, so nobody can have taken the lock */
+	result = lock_tryacquire(CoreMapLock);
+	assert(result);
+	pages[i].busy = 0;
+	freelist_add(i, 1);
+	vmstats.pages_prezeroed++;
+	lock_release(CoreMapLock);
+
+	return 1;
+}
+
 
 paddr_t
 page_nalloc(int alloc_type, int npages)
 {
+	paddr_t base_addr;
+	u_int32_t i, run, page_selected = 0;
+	int subpage_index, all_free_flag, fixed_flag;
+	u_int32_t combined_pages_time;
+	u_int32_t pages_time_min;
+	u_int32_t last_page = (page_num - npages + 1);
+	int result;
 
-		paddr_t base_addr;
+	lock_acquire(CoreMapLock);
 
-						//not sure if needs to be interrupts high
-						//but if there is a CS that uses a page that was chosen to be deleted
-						//Then I think problems would arise...
-						//Maybe just interrupts high while we choose and clear page would be good
-						//but I think the lock would take care of it since to access coremap
-						//the lock will always be required
-		lock_acquire(CoreMapLock);
-		int i, subpage_index, all_free_flag, fixed_flag;
-		int page_selected = 0;
-		u_int32_t combined_pages_time;
-		u_int32_t pages_time_min = 4294967295;		//I hope it gives a very large number :P
-		int last_page = (page_num - npages + 1);
-		int swap_index;
+	/* 
+	 * This only looks for n pages *in a row* (kernel allocations need to be
+	 * physically contiguous). First look for a run of free pages in a single
+	 * pass over the coremap.
+	 */
+	for (;;){
+		run = 0;
+		for (i = first_free_page; i < page_num; i++){
+			if (pages[i].state != PAGE_FREE || pages[i].busy){
+				run = 0;
+				continue;
+			}
+			if (++run == (u_int32_t) npages){
+				page_selected = i - npages + 1;
+				break;
+			}
+		}
+		if (i < page_num) break;
 
-		/* 
-		 * Right now, this only looks for n pages *in a row*. For user level mallocs,
-		 * it doesn't necessarily need to be this way (can allocate a bunch of random
-		 * pages, not necessarily back to back, as long as we set things up in the
-		 * page table correctly). We need to add user-level support.
+		/*
+		 * No free run. Find the window of npages with no fixed, busy or
+		 * copy-on-write shared pages whose user pages are the oldest, and
+		 * evict them.
 		 */
-		for (i = first_free_page; i < last_page; i++){	//taking into account npages needed
+		page_selected = 0;
+		pages_time_min = 4294967295;
+		for (i = first_free_page; i < last_page; i++){
 			combined_pages_time = 0;
 			fixed_flag = 0;		//flag to tell if there was a fixed page
 			all_free_flag = 1;	//flag to tell if all the pages were free
 			for (subpage_index = 0; subpage_index < npages; subpage_index++){
-				if (pages[i + subpage_index].state == PAGE_FIXED){
+				if (pages[i + subpage_index].state == PAGE_FIXED ||
+				    (pages[i + subpage_index].refcount > 1 &&
+				     pages[i + subpage_index].file == NULL) ||
+				    pages[i + subpage_index].busy){
 					fixed_flag = 1;
 					break;
 				}
@@ -509,53 +1544,32 @@ page_nalloc(int alloc_type, int npages)
 				}
 			}
 			if(!fixed_flag){
-				if(all_free_flag){
-					page_selected = i;
-					break;
-				}
-				else if (combined_pages_time < pages_time_min){
+				assert(!all_free_flag);
+				if (combined_pages_time < pages_time_min){
 					pages_time_min = combined_pages_time;
 					page_selected = i;
 				}
 			}
 		}
-	if (i == last_page){		//if i == last_num then no free page group found
-
-		/* Not doing anything here, yet. Just panic, for now.. */
-		//panic("Ran out of pages. No swapping support yet.\n");
+		if (page_selected == 0){
+			DEBUG(DB_VM, "page_nalloc: no run of %d pages to evict\n", npages);
+			lock_release(CoreMapLock);
+			return 0;
+		}
 
+		/*
+		 * swapout_page() lets go of CoreMapLock while it writes, so the
+		 * window can change under us; only touch pages that are still
+		 * evictable, and go round again to check we got the whole run.
+		 */
 		for (subpage_index = 0; subpage_index < npages; subpage_index++){
-
-			/*
-			 * If page is dirty then need to flush it to disk
-			 */
-			if (pages[page_selected + subpage_index].state == PAGE_DIRTY){
-			/*
-			 * need to create function to flush to disk
-			 * not sure how to do it now
-			 * TO BE DONE!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-			 */
-				swapout_page((page_selected + subpage_index), &swap_index);
-			//page_flush(page_selected);
-			}
-			if (pages[page_selected + subpage_index].state == PAGE_CLEAN){
-			/*
-			 * If page is CLEAN then it means that it is updated to disk already
-			 */
-				evict_page((page_selected + subpage_index), swap_index);
-			/*
-			 * Now update page table or TLB to show that page_selected is no longer mapped to memory
-			 * PageTables are not setup yet so need to update...
-			 * Need function to update TLB and page table
-			 * TO BE DONE!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-			 */
-			//function to unload AS or something like that...
-
-			//function to set as invalid in TLB & point to Disk where stored
-
-			//function to set page invalid in PageTable and point to Disk where stored
-
-			//function to zero the Page
+			i = page_selected + subpage_index;
+			if (!page_evictable(i)) continue;
+			result = page_evict(i);
+			if (result){
+				/* Whatever we evicted so far just stays free */
+				lock_release(CoreMapLock);
+				return 0;
 			}
 		}
 	}
@@ -565,14 +1579,16 @@ page_nalloc(int alloc_type, int npages)
 
 	if(alloc_type == KERNEL_ALLOC){
 		for (subpage_index = 0; subpage_index < npages; subpage_index++){
+			freelist_remove(page_selected + subpage_index);
 			pages[page_selected + subpage_index].as = curthread->t_vmspace;
 			pages[page_selected + subpage_index].number = npages;
 			pages[page_selected + subpage_index].state = PAGE_FIXED;
+			pages[page_selected + subpage_index].refcount = 0;
 			pages[page_selected + subpage_index].va = PADDR_TO_KVADDR(base_addr + (subpage_index * PAGE_SIZE));	
 		}
 		DEBUG(DB_VM, "Just gave %d pages at base addr: 0x%x to kernel: 0x%x virtual address: 0x%x\n"
 			     "Pages left (before we need to start swapping): %d.\n", 
-				npages, base_addr, (u_int32_t) pages[page_selected].as, pages[page_selected].va, ((global_lastaddr - base_addr)/4096) - 				npages);
+				npages, base_addr, (u_int32_t) pages[page_selected].as, pages[page_selected].va, free_page_count);
 	} else {
 		/* DON'T NEED THIS! USER MALLOC ONLY EVER CALLS PAGE_ALLOC */
 	
@@ -580,8 +1596,6 @@ page_nalloc(int alloc_type, int npages)
 		assert(alloc_type == USER_ALLOC);
 		/* Panic for now */
 		panic("User alloc_npages() not support yet.\n");
-
-		/* Don't forget to deal with page counter in here, for swapping purposes */	
 	}
 
 	lock_release(CoreMapLock);
@@ -606,22 +1620,193 @@ alloc_kpages(int npages)
 	return PADDR_TO_KVADDR(pa);
 }
 
-/* Free all user pages of the address space. */
+/*
+ * Add a copy-on-write mapping of the page PTE points to for address
+ * space AS at VADDR. MAPPING is preallocated by the caller, since we
+ * can't kmalloc while holding CoreMapLock. Returns 0 if the page was
+ * shared, or -1 if it got swapped out on us in the meantime (in which
+ * case MAPPING was not used).
+ */
+int
+page_share(pte_t *pte, struct addrspace *as, vaddr_t vaddr,
+	   struct page_mapping *mapping)
+{
+	u_int32_t i;
+
+	lock_acquire(CoreMapLock);
+	pte_wait(pte);
+	if (!(*pte & PTE_VALID)) {
+		lock_release(CoreMapLock);
+		return -1;
+	}
+
+	i = PTE_PADDR(*pte) / PAGE_SIZE;
+	assert(pages[i].state != PAGE_FREE && pages[i].state != PAGE_FIXED);
+	assert(pages[i].refcount >= 1);
+
+	mapping->as = as;
+	mapping->va = vaddr;
+	mapping->next = pages[i].sharers;
+	pages[i].sharers = mapping;
+	pages[i].refcount++;
+	*pte &= ~PTE_MODIFY;
+
+	/*
+	 * Swap slots belong to a single mapping, so give this one up; the
+	 * page can't be dropped unwritten any more. (Except page-cache
+	 * pages, which never go to swap.)
+	 */
+	if (pages[i].file == NULL) {
+		if (pages[i].swap_slot >= 0) {
+			swap_free(pages[i].swap_slot);
+			pages[i].swap_slot = -1;
+		}
+		pages[i].state = PAGE_DIRTY;
+	}
+
+	lock_release(CoreMapLock);
+	return 0;
+}
+
+/*
+ * Remove (as, vaddr) from the list of mappings of page I, and hand back
+ * the page_mapping that is no longer needed (if any) so the caller can
+ * kfree it after dropping CoreMapLock. If the first mapping goes away,
+ * the next sharer takes its place in the coremap entry.
+ */
+static
+struct page_mapping *
+page_drop_mapping(u_int32_t i, struct addrspace *as, vaddr_t vaddr)
+{
+	struct page_mapping **pm, *dead;
+
+	assert(lock_do_i_hold(CoreMapLock));
+	assert(pages[i].refcount >= 1);
+	pages[i].refcount--;
+
+	if (pages[i].as == as && pages[i].va == vaddr) {
+		dead = pages[i].sharers;
+		if (dead != NULL) {
+			pages[i].as = dead->as;
+			pages[i].va = dead->va;
+			pages[i].sharers = dead->next;
+		}
+		return dead;
+	}
+
+	for (pm = &pages[i].sharers; *pm != NULL; pm = &(*pm)->next) {
+		if ((*pm)->as == as && (*pm)->va == vaddr) {
+			dead = *pm;
+			*pm = dead->next;
+			return dead;
+		}
+	}
+
+	panic("page_drop_mapping: page %u not mapped by 0x%x at 0x%x\n",
+	      i, (u_int32_t) as, vaddr);
+	return NULL;
+}
+
+/*
+ * Release AS's mapping of the page PTE points to (address space
+ * teardown), along with its swap slot if it has one. The page is
+ * freed once nobody maps it any more.
+ */
 void
-free_all_user_pages(struct addrspace *as)
+page_unmap(pte_t *pte, struct addrspace *as, vaddr_t vaddr)
 {
+	struct page_mapping *dead = NULL;
+	u_int32_t i;
+
 	lock_acquire(CoreMapLock);
-	int i;
-	/* Find them in the coremap */
-	for (i = first_free_page; i < (int) page_num; i++){
-		if((pages[i].as) == as && (pages[i].va <= 0x80000000) && (pages[i].state != PAGE_FREE)){
-			/* Free it (if it isn't already free) */
-			pages[i].state = PAGE_FREE;
-			DEBUG(DB_VM, "Just freed page at physical addr: 0x%x from user: 0x%x virtual address: 0x%x\n", 
-					(i * PAGE_SIZE), (u_int32_t) pages[i].as, pages[i].va);
+	pte_wait(pte);
+	if (*pte & PTE_VALID) {
+		i = PTE_PADDR(*pte) / PAGE_SIZE;
+		dead = page_drop_mapping(i, as, vaddr);
+		if (pages[i].refcount == 0) {
+			DEBUG(DB_VM, "Just freed page at physical addr: 0x%x from user: 0x%x virtual address: 0x%x\n",
+				(i * PAGE_SIZE), (u_int32_t) as, vaddr);
+			if (pages[i].swap_slot >= 0) swap_free(pages[i].swap_slot);
+			page_set_free(i);
 		}
 	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(*pte));
+	}
+	pte_set(as, vaddr, pte, 0);
 	lock_release(CoreMapLock);
+
+	kmem_cache_free(&mapping_cache, dead);
+}
+
+/*
+ * Resolve a write to a copy-on-write page. If somebody else still maps
+ * the page, copy it into a fresh page for AS; otherwise AS is the last
+ * user and simply takes the page over. Updates PTE and returns the
+ * physical address AS should now map writeable, or 0 if out of memory.
+ *
+ * Caller holds CoreMapLock, and must free whatever's left in *DEAD
+ * once it has let go of it.
+ */
+static
+paddr_t
+page_cow(pte_t *pte, struct addrspace *as, vaddr_t vaddr,
+	 struct page_mapping **dead)
+{
+	paddr_t old, new;
+	u_int32_t i;
+
+	assert(*pte & PTE_VALID);
+	old = PTE_PADDR(*pte);
+	i = old / PAGE_SIZE;
+	assert(!pages[i].busy);
+	vmstats.cow_faults++;
+
+	if (pages[i].refcount > 1) {
+		/*
+		 * Allocating may let go of CoreMapLock. Keep the old page busy
+		 * meanwhile, so the other users can't unmap it or evict it.
+		 */
+		pages[i].busy = 1;
+		new = page_alloc_locked(USER_ALLOC, vaddr, as);
+		if (new == 0) {
+			page_unbusy_locked(i);
+			return 0;
+		}
+		memmove((void *) PADDR_TO_KVADDR(new),
+			(const void *) PADDR_TO_KVADDR(old), PAGE_SIZE);
+		page_unbusy_locked(i);
+		*dead = page_drop_mapping(i, as, vaddr);
+		*pte = new | (*pte & PTE_FLAGS);
+		page_unbusy_locked(new / PAGE_SIZE);
+		vmstats.cow_copies++;
+	}
+	else {
+		assert(pages[i].as == as && pages[i].va == vaddr);
+		new = old;
+	}
+
+	return new;
+}
+
+/*
+ * Should the user page at PADDR go in the TLB writeable? Not while it
+ * is shared copy-on-write (writes have to fault into page_cow()), and
+ * not while it's clean: the first write must come back through here so
+ * the page gets marked dirty again. FAULTTYPE is the access that
+ * faulted; a write dirties the page. (A page-cache page mapped
+ * writeable is MAP_SHARED, so everyone writes to the same page.)
+ */
+static
+int
+page_writeable(paddr_t paddr, int faulttype)
+{
+	u_int32_t i = paddr / PAGE_SIZE;
+
+	if (pages[i].refcount > 1 && pages[i].file == NULL) return 0;
+
+	if (faulttype != VM_FAULT_READ) pages[i].state = PAGE_DIRTY;
+	return pages[i].state == PAGE_DIRTY;
 }
 
 void
@@ -630,7 +1815,7 @@ page_free(int free_type, vaddr_t vaddr){
 	 * Will start by supporting only kernel frees, and will add user frees when malloc() and
 	 * free() are implemented 
 	 */
-	int i, j;
+	int i, j, n;
 	lock_acquire(CoreMapLock);
 	if(free_type == KERNEL_FREE){
 		/* Our vaddr better be a kernel virtual address */
@@ -647,11 +1832,9 @@ page_free(int free_type, vaddr_t vaddr){
 			 * our coremap. Free them all.
 			 */
 			
-			/* Find it in the coremap */
-			for (i = first_free_page; i < (int) page_num; i++){
-				if(pages[i].va == vaddr) break;
-			}
-			if(i == (int) page_num){
+			/* Kernel pages are direct-mapped, so its coremap index is its paddr */
+			i = (vaddr - MIPS_KSEG0) / PAGE_SIZE;
+			if(i >= (int) page_num || pages[i].state != PAGE_FIXED || pages[i].va != vaddr){
 				/* 
 				 * It wasn't even in the core map. Kernel is trying to free an
 				 * address that was never even allocated. Do nothing. 
@@ -659,12 +1842,13 @@ page_free(int free_type, vaddr_t vaddr){
 				lock_release(CoreMapLock);
 				return;
 			}
-			for(j = i; j < (i + (int) pages[i].number); j++){
-				/* Free them */
-				pages[j].state = PAGE_FREE;
-			}
 			DEBUG(DB_VM, "Just freed %d pages at base addr: 0x%x from kernel: 0x%x virtual address: 0x%x\n", 
 					(int) pages[i].number, (i * PAGE_SIZE), (u_int32_t) pages[i].as, pages[i].va);
+			n = pages[i].number;
+			for(j = i; j < i + n; j++){
+				/* Free them */
+				page_set_free(j);
+			}
 		}
 	} else {
 		assert(free_type == USER_FREE);
@@ -674,10 +1858,115 @@ page_free(int free_type, vaddr_t vaddr){
 	return;
 }
 
+/*
+ * Allocate NPAGES pages of kernel memory at consecutive addresses in
+ * kseg2, backed by whatever frames page_alloc() finds, wherever they
+ * are. Returns 0 if there's no room left in the area or no memory.
+ * Freed with free_kpages().
+ */
+vaddr_t
+kva_alloc(int npages)
+{
+	u_int32_t i, run, tries, start;
+	paddr_t pa;
+	int spl;
+
+	assert(vm_init_flag);
+	assert(npages > 0);
+
+	/* Find and claim a run of addresses first... */
+	spl = splhigh();
+	run = 0;
+	start = kva_npages;
+	for (i = kva_rotor, tries = 0; tries < kva_npages + npages; i++, tries++) {
+		if (i == kva_npages) {
+			/* Runs don't wrap around */
+			i = 0;
+			run = 0;
+		}
+		if (kva_map[i] & KVA_INUSE) {
+			run = 0;
+			continue;
+		}
+		if (++run == (u_int32_t) npages) {
+			start = i + 1 - npages;
+			break;
+		}
+	}
+	if (start == kva_npages) {
+		splx(spl);
+		return 0;
+	}
+	for (i = start; i < start + npages; i++) {
+		kva_map[i] = KVA_INUSE;
+	}
+	kva_map[start + npages - 1] |= KVA_LAST;
+	kva_pages_used += npages;
+	kva_rotor = (start + npages) % kva_npages;
+	splx(spl);
+
+	/* ...then the frames, one at a time, which may mean evicting */
+	for (i = start; i < start + npages; i++) {
+		pa = page_alloc(KERNEL_ALLOC, 0, NULL);
+		if (pa == 0) {
+			kva_free(KVA_BASE + start * PAGE_SIZE);
+			return 0;
+		}
+		spl = splhigh();
+		kva_map[i] |= pa | KVA_VALID;
+		splx(spl);
+	}
+
+	vmstats.kva_allocs++;
+	return KVA_BASE + start * PAGE_SIZE;
+}
+
+/*
+ * Free a kva_alloc() allocation starting at VADDR: drop its pages'
+ * translations from the TLB and give the frames back.
+ */
+void
+kva_free(vaddr_t vaddr)
+{
+	u_int32_t i, ent;
+	int spl, slot;
+
+	assert(vaddr >= KVA_BASE && vaddr % PAGE_SIZE == 0);
+	i = (vaddr - KVA_BASE) / PAGE_SIZE;
+	assert(i < kva_npages);
+	assert(i == 0 || !(kva_map[i-1] & KVA_INUSE) || (kva_map[i-1] & KVA_LAST));
+
+	do {
+		assert(i < kva_npages);
+
+		spl = splhigh();
+		ent = kva_map[i];
+		assert(ent & KVA_INUSE);
+		kva_map[i] = 0;
+		kva_pages_used--;
+		slot = TLB_Probe(KVA_BASE + i * PAGE_SIZE, 0);
+		if (slot >= 0) {
+			TLB_Write(TLBHI_INVALID(slot), TLBLO_INVALID(), slot);
+		}
+		splx(spl);
+
+		/* A failed kva_alloc() may not have got this far */
+		if (ent & KVA_VALID) {
+			page_free(KERNEL_FREE, PADDR_TO_KVADDR(ent & PAGE_FRAME));
+		}
+		i++;
+	} while (!(ent & KVA_LAST));
+}
+
 /* Free some kernel-space virtual pages */
 void
 free_kpages(vaddr_t vaddr)
 {
+	if (vaddr >= KVA_BASE) {
+		kva_free(vaddr);
+		return;
+	}
+
 	/* 
 	 * Okay, this will have pretty similar structure to alloc_kpages, we're just freeing
 	 * now, not allocating.
@@ -685,123 +1974,369 @@ free_kpages(vaddr_t vaddr)
 
  	/* If vm_init_flag is set, we have our core map set up and are managing all the memory */  
 
-	if(vm_init_flag) page_free(KERNEL_FREE, vaddr);
+	if(vm_init_flag) page_free(KERNEL_FREE, vaddr);
+
+	/* 
+	 * If not, we're still very early in boot(). Too much of a hassle to even deal with it,
+	 * so I'll just do nothing (memory will be wasted, but it won't be much, if any).
+	 */
+}
+
+/*
+ * The kernel heap keeps a pointer to its own bookkeeping for each page
+ * it splits into small blocks, so kfree() can go straight to it. These
+ * don't need CoreMapLock: only the heap touches the field, and it does
+ * so with interrupts off. Addresses outside KSEG0 aren't ours. Until
+ * the coremap is up there's nowhere to put it; kheap_bootstrap() fills
+ * in those pages afterwards.
+ */
+void
+page_set_kheap(vaddr_t kva, void *ref)
+{
+	u_int32_t i;
+
+	if (!vm_init_flag) {
+		return;
+	}
+	assert(kva >= MIPS_KSEG0 && kva < MIPS_KSEG1);
+	i = (kva - MIPS_KSEG0) / PAGE_SIZE;
+	assert(i < page_num);
+	pages[i].kheap = ref;
+}
+
+void *
+page_kheap(vaddr_t kva)
+{
+	u_int32_t i;
+
+	if (!vm_init_flag || kva < MIPS_KSEG0 || kva >= MIPS_KSEG1) {
+		return NULL;
+	}
+	i = (kva - MIPS_KSEG0) / PAGE_SIZE;
+	if (i >= page_num) {
+		return NULL;
+	}
+	return pages[i].kheap;
+}
+
+/*
+ * Fill the page at PADDR with what belongs at VA in AS's executable,
+ * going by the segment table load_elf() recorded: file data where a
+ * segment has some, zeros everywhere else. The page is written through
+ * its kernel address, so it needn't be mapped yet; the caller keeps it
+ * busy meanwhile, and doesn't hold CoreMapLock.
+ */
+static
+int
+load_page(struct addrspace *as, vaddr_t va, paddr_t paddr)
+{
+	struct segment *seg;
+	struct uio ku;
+	char *kva = (char *) PADDR_TO_KVADDR(paddr);
+	vaddr_t start, end;
+	int i, result;
+
+	bzero(kva, PAGE_SIZE);
+
+	for (i = 0; i < as->nsegments; i++) {
+		seg = &as->segments[i];
+
+		/* The part of the segment's file data that lands in this page */
+		start = (seg->vaddr > va) ? seg->vaddr : va;
+		end = seg->vaddr + seg->filesz;
+		if (end > va + PAGE_SIZE) end = va + PAGE_SIZE;
+		if (start >= end) continue;
+
+		mk_kuio(&ku, kva + (start - va), end - start,
+			seg->offset + (start - seg->vaddr), UIO_READ);
+		result = VOP_READ(as->progfile, &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("ELF: short read on segment - file truncated?\n");
+			return ENOEXEC;
+		}
+	}
+
+	vmstats.exec_loads++;
+	return 0;
+}
+
+/*
+ * Does the page at VA in AS have any of the executable's file data in
+ * it? If not, it's all bss, and just needs zeroing.
+ */
+static
+int
+exec_page_has_data(struct addrspace *as, vaddr_t va)
+{
+	struct segment *seg;
+	int i;
+
+	for (i = 0; i < as->nsegments; i++) {
+		seg = &as->segments[i];
+		if (seg->vaddr < va + PAGE_SIZE && seg->vaddr + seg->filesz > va) return 1;
+	}
+	return 0;
+}
+
+/*
+ * Page cache key for the page at VA in AS's executable (its offset in
+ * the file, with PAGECACHE_EXEC set), if it's a page of read-only
+ * segment data that can go in the page cache; -1 if not. (ELF
+ * segments start at the same offset within a page in the file as in
+ * memory, so whole pages of the file line up with whole pages of
+ * memory.)
+ */
+static
+off_t
+exec_page_offset(struct addrspace *as, vaddr_t va)
+{
+	struct segment *seg;
+	off_t offset;
+	int i;
+
+	for (i = 0; i < as->nsegments; i++) {
+		seg = &as->segments[i];
+		if (va + PAGE_SIZE <= seg->vaddr || va >= seg->vaddr + seg->memsz) continue;
+		if (seg->flags & PF_W) return -1;
+		offset = seg->offset - (off_t) (seg->vaddr - va);
+		return (offset < 0) ? -1 : (offset | PAGECACHE_EXEC);
+	}
+	return -1;
+}
+
+/*
+ * First touch of page VA of AS, whose PTE is still untouched, for a
+ * page that comes from FILE. If OFFSET isn't -1 the page goes in the
+ * page cache under (FILE, OFFSET): it's shared with whoever has it
+ * already, or read in and left there for the next one. Otherwise AS
+ * gets a page of its own. Either way, FILL(AS, VA, paddr) reads it in.
+ * MAPPING is a preallocated page_mapping for a cache hit; it's set to
+ * NULL if it was used (and without one, the page isn't cached).
+ *
+ * Caller holds CoreMapLock, which is released while we wait for or do
+ * the disk I/O. Returns 0 with the page mapped and not busy, or an
+ * error.
+ */
+static
+int
+file_page_map(struct addrspace *as, vaddr_t va, pte_t *pte, int perms,
+	      struct vnode *file, off_t offset,
+	      int (*fill)(struct addrspace *, vaddr_t, paddr_t),
+	      struct page_mapping **mapping)
+{
+	struct page_mapping *pm;
+	paddr_t paddr;
+	u_int32_t i;
+	int result;
+
+	assert(PTE_UNTOUCHED(*pte));
+	if (*mapping == NULL) {
+		offset = -1;
+	}
+
+	for (;;) {
+		if (offset >= 0) {
+			i = pagecache_lookup(file, offset);
+			if (i != NO_PAGE && pages[i].busy) {
+				/* Somebody's reading it in; wait and look again */
+				page_wait(i);
+				continue;
+			}
+			if (i != NO_PAGE) {
+				pm = *mapping;
+				*mapping = NULL;
+				pm->as = as;
+				pm->va = va;
+				pm->next = pages[i].sharers;
+				pages[i].sharers = pm;
+				pages[i].refcount++;
+				pte_set(as, va, pte, PTE_MKVALID(i * PAGE_SIZE, perms));
+				vmstats.pagecache_hits++;
+				return 0;
+			}
+		}
+
+		paddr = page_alloc_locked(USER_ALLOC, va, as);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		i = paddr / PAGE_SIZE;
+
+		/* Allocating may have let go of the lock; did someone beat us to it? */
+		if (offset >= 0 && pagecache_lookup(file, offset) != NO_PAGE) {
+			page_unbusy_locked(i);
+			page_set_free(i);
+			continue;
+		}
+		break;
+	}
+
+	if (offset >= 0) {
+		pagecache_insert(i, file, offset);
+		vmstats.pagecache_misses++;
+	}
+	pte_set(as, va, pte, PTE_MKVALID(paddr, perms));
+
+	/*
+	 * Fill it in before anyone can use it. Like a swap-in, the page
+	 * stays busy and the lock is dropped for the disk I/O.
+	 */
+	lock_release(CoreMapLock);
+	result = fill(as, va, paddr);
+	lock_acquire(CoreMapLock);
+
+	page_unbusy_locked(i);
+	if (result) {
+		pte_set(as, va, pte, 0);
+		page_set_free(i);
+		return result;
+	}
+
+	/* A page-cache page is the same as the file until somebody writes to it */
+	if (offset >= 0) pages[i].state = PAGE_CLEAN;
+	as->as_stats.vs_filereads++;
+	vmstats.file_reads++;
+	return 0;
+}
+
+/*
+ * First touch of anonymous page VA of AS (heap, stack, bss or a
+ * MAP_ANON mapping), whose PTE is still untouched: map a zero-filled
+ * page there. Caller holds CoreMapLock.
+ */
+static
+int
+anon_page_map(struct addrspace *as, vaddr_t va, pte_t *pte, int perms)
+{
+	paddr_t paddr;
+
+	assert(PTE_UNTOUCHED(*pte));
+
+	paddr = page_alloc_locked(USER_ZERO_ALLOC, va, as);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	pte_set(as, va, pte, PTE_MKVALID(paddr, perms));
+	page_unbusy_locked(paddr / PAGE_SIZE);
+	as->as_stats.vs_zerofills++;
+	return 0;
+}
+
+/*
+ * First touch of page VA of AS's code or data region (region REGION).
+ * Code pages come from the page cache if someone else running the
+ * same executable has them already; anything else is read from the
+ * executable into a new page, except for bss pages, which are just
+ * zeroed. See file_page_map().
+ */
+static
+int
+exec_page_map(struct addrspace *as, vaddr_t va, int region, pte_t *pte,
+	      int perms, struct page_mapping **mapping)
+{
+	off_t offset;
+
+	if (region == DATA_REGION && !exec_page_has_data(as, va)) {
+		return anon_page_map(as, va, pte, perms);
+	}
 
-	/* 
-	 * If not, we're still very early in boot(). Too much of a hassle to even deal with it,
-	 * so I'll just do nothing (memory will be wasted, but it won't be much, if any).
-	 */
+	offset = (region == CODE_REGION) ? exec_page_offset(as, va) : -1;
+	return file_page_map(as, va, pte, perms, as->progfile, offset,
+			     load_page, mapping);
 }
 
+/*
+ * Fill the page at PADDR with what belongs at VA in AS's mmap() region
+ * there: the file's data, or zeros past the end of the file. Called
+ * like load_page().
+ */
 static
 int
-load_page(vaddr_t faultaddr, int region){
-	struct vnode *v;
-	int result, i;
-	Elf_Ehdr eh;
-	Elf_Phdr ph;
+mmap_load_page(struct addrspace *as, vaddr_t va, paddr_t paddr)
+{
+	struct mmap_region *m = as_mmap_find(as, va);
 	struct uio ku;
+	char *kva = (char *) PADDR_TO_KVADDR(paddr);
 
-	/* 
-	 * This will always be happening from our own thread. ie. using 
-	 * curthread should be okay.
-	 */
-	v = curthread->t_vmspace->progfile;
-
-	/* The rest is pretty much copying and pasting from loadelf.c.. */
-
-	mk_kuio(&ku, &eh, sizeof(eh), 0, UIO_READ);
-	result = VOP_READ(v, &ku);
-	if (result) {
-		return result;
-	}
+	assert(m != NULL && m->vn != NULL);
+	bzero(kva, PAGE_SIZE);
 
-	if (ku.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on header - file truncated?\n");
-		return ENOEXEC;
-	}
+	mk_kuio(&ku, kva, PAGE_SIZE, m->offset + (off_t) (va - m->base), UIO_READ);
+	return VOP_READ(m->vn, &ku);
+}
 
-	/* 
-	 * We've already verified this .elf file is okay in loadelf(), so skip
-	 * the error checking.
-	 */
+/*
+ * First touch of page VA of AS's mmap() region M. Anonymous pages are
+ * just zero-filled. File pages come from the page cache if they're
+ * MAP_SHARED or read-only, so everyone mapping the file sees the same
+ * page; a writeable MAP_PRIVATE page is read into a page of AS's own.
+ * Called like exec_page_map().
+ */
+static
+int
+mmap_page_map(struct addrspace *as, vaddr_t va, struct mmap_region *m,
+	      pte_t *pte, int perms, struct page_mapping **mapping)
+{
+	off_t offset = -1;
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		mk_kuio(&ku, &ph, sizeof(ph), offset, UIO_READ);
+	vmstats.mmap_faults++;
 
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
+	if (m->vn == NULL) {
+		return anon_page_map(as, va, pte, perms);
+	}
 
-		if (ku.uio_resid != 0) {
-			// short read; problem with executable?
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
+	if ((m->flags & MAP_SHARED) || !(m->prot & PROT_WRITE)) {
+		offset = m->offset + (off_t) (va - m->base);
+	}
+	return file_page_map(as, va, pte, perms, m->vn, offset,
+			     mmap_load_page, mapping);
+}
 
-		switch (ph.p_type) {
-		    case PT_NULL:  continue;
-		    case PT_PHDR: continue;
-		    case PT_MIPS_REGINFO: continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
+/*
+ * Read-ahead for executables. Having just loaded the page at VA of
+ * region REG (REGION) from the executable, load the next few untouched
+ * pages of the region as well, so that a program starting up doesn't
+ * take a fault (and a trip to the disk) for every page. Only pages
+ * that are free anyway are used; nothing is evicted to make room. They
+ * aren't marked referenced until they're actually used, so if they
+ * never are, the clock hand takes them back first.
+ */
+static
+void
+exec_readahead(struct addrspace *as, vaddr_t va, struct region *reg,
+	       int region, int perms)
+{
+	struct page_mapping *mapping = NULL;
+	pte_t *pte;
+	int n, result;
+
+	for (n = 0; n < EXEC_READAHEAD; n++) {
+		va += PAGE_SIZE;
+		if (va >= reg->top) break;
+
+		pte = pte_lookup(as, va, 1);
+		if (pte == NULL) break;
+		if (region == CODE_REGION && mapping == NULL) {
+			mapping = kmem_cache_alloc(&mapping_cache);
+			if (mapping == NULL) break;
 		}
 
-		/* 
-		 * Now check: is our faultaddr in the range of this segment?
-		 * If so, this is the segment to load from, else try again.
-		 */
-		if(faultaddr >= ph.p_vaddr && faultaddr <= (ph.p_vaddr + ph.p_memsz)){
-			/* We're in the right segment */
-			if(ph.p_memsz > PAGE_SIZE){
-				/*
-				 * We're loading into pages of memory (of size PAGE_SIZE, obviously),
-				 * so don't want to try to load any more than PAGE_SIZE bytes in. We
-				 * kind of have to break this segment down into further segments, and
-				 * then load the correct piece in. I'll probably change all of this 
-				 * when I introduce 'regions' in our address space.
-				 */
-
-				/* 
-			 	 * This assert is an assumption I'm making, but I don't think it necessarily needs to be true.
-			 	 * If it ever causes problems, let me know and I'll change this code. I think it's like this:
-				 * filesz is the actual number of bytes stored in the file, memsz is the amount of virtual
-				 * memory the running program expects to see. I'm pretty sure I can just take this assertion	
-				 * out and it would be fine.
-			 	 */
-				//assert(ph.p_filesz == ph.p_memsz);
-
-				ph.p_offset += (faultaddr - ph.p_vaddr);
-				if(faultaddr > (ph.p_vaddr + ph.p_filesz)) ph.p_filesz = 0;
-				else if((ph.p_filesz - (faultaddr - ph.p_vaddr)) < PAGE_SIZE){
-					ph.p_filesz -= (faultaddr - ph.p_vaddr);
-				}
-				else ph.p_filesz = PAGE_SIZE;
-			}
-			result = load_segment(v, ph.p_offset, faultaddr, 
-				      PAGE_SIZE, ph.p_filesz,
-				      ph.p_flags & PF_X);
-			if(result) return result;
+		lock_acquire(CoreMapLock);
+		if (!PTE_UNTOUCHED(*pte) || free_page_count <= pageout_lowat) {
+			lock_release(CoreMapLock);
 			break;
 		}
+		result = exec_page_map(as, va, region, pte, perms, &mapping);
+		lock_release(CoreMapLock);
+		if (result) break;
+		vmstats.exec_readaheads++;
 	}
 
-	if(region == CODE_REGION) curthread->t_vmspace->done_loading_code_page = 1;
-	return 0;
-}
-
-void
-write_pte(struct page_table_entry* pte, paddr_t paddr, int permission, int swap_entry){
-	pte->paddr = paddr;
-	pte->permission = permission;
-	pte->valid = 1;
-	pte->swap_entry = swap_entry;
+	kmem_cache_free(&mapping_cache, mapping);
 }
 
 int
@@ -812,78 +2347,272 @@ create_page_table(struct addrspace* as, int page_dir_index)
 	as->page_directory[page_dir_index] = kmalloc(sizeof(struct page_table));
 	if(as->page_directory[page_dir_index] == NULL) return ENOMEM;
 	
-	int i;
-	for(i = 0; i < TWO_LEV_PAGE_TABLE_SIZE; i++) as->page_directory[page_dir_index]->entries[i] = NULL;
+	/* All entries start out 0: not mapped */
+	bzero(as->page_directory[page_dir_index], sizeof(struct page_table));
+	as->pt_used[page_dir_index] = 0;
+	vmstats.page_tables++;
 
 	return 0;
 }
 
+/* Free a page table. Whatever its entries mapped must be unmapped already. */
+void
+destroy_page_table(struct addrspace* as, int page_dir_index)
+{
+	assert(as->pt_used[page_dir_index] == 0);
+	kfree(as->page_directory[page_dir_index]);
+	as->page_directory[page_dir_index] = NULL;
+	vmstats.page_tables--;
+}
+
+/*
+ * Find the page table entry for VADDR. If the page table it goes in
+ * hasn't been created yet, return NULL, or create it if CREATE is set
+ * (returning NULL if we're out of memory).
+ */
 static
-struct page_table_entry*
-create_page_table_entry(struct addrspace* as, vaddr_t vaddr)
+pte_t *
+pte_lookup(struct addrspace* as, vaddr_t vaddr, int create)
 {
-	int result;
-	/* 
-	 * Has the necessary page table even been created in our page
-	 * directory yet? If not, create it.
-	 */
 	int page_dir_index = vaddr >> 22;
+	int page_table_index = (vaddr & PAGE_TABLE_MASK) >> 12;
+
 	if(as->page_directory[page_dir_index] == NULL){
-		result = create_page_table(as, (int) page_dir_index);
-		if(result) return NULL;
-	};
+		if(!create) return NULL;
+		if(create_page_table(as, page_dir_index)) return NULL;
+	}
 
-	/*
-	 * Create the page table entry.
-	 */
-	int page_table_index = (vaddr & PAGE_TABLE_MASK) >> 12;
-	as->page_directory[page_dir_index]->entries[page_table_index] = kmalloc(sizeof(struct page_table_entry));
-	return as->page_directory[page_dir_index]->entries[page_table_index];
+	return &as->page_directory[page_dir_index]->entries[page_table_index];
+}
+
+/*
+ * Set AS's page table entry PTE (for VADDR) to VAL, keeping count of
+ * the entries in use in its page table, and of its resident and
+ * swapped-out pages. Only the thread that owns AS makes entries zero
+ * or nonzero (eviction just changes what a nonzero entry says), so the
+ * first count needs no locking. The others change on eviction too, so
+ * they're updated with interrupts off.
+ */
+void
+pte_set(struct addrspace *as, vaddr_t vaddr, pte_t *pte, pte_t val)
+{
+	int spl;
+
+	if (*pte == 0 && val != 0) as->pt_used[vaddr >> 22]++;
+	else if (*pte != 0 && val == 0) as->pt_used[vaddr >> 22]--;
+
+	spl = splhigh();
+	if (*pte & PTE_VALID) as->as_stats.vs_resident--;
+	else if (*pte & PTE_SWAPPED) as->as_stats.vs_swapped--;
+	if (val & PTE_VALID) as->as_stats.vs_resident++;
+	else if (val & PTE_SWAPPED) as->as_stats.vs_swapped++;
+	*pte = val;
+	splx(spl);
+}
+
+/*
+ * Unmap whatever AS has in [START, END) (page-aligned), freeing the
+ * pages and swap slots nobody else uses, and free any page tables that
+ * end up empty. For shrinking the heap and munmap(); AS is the current
+ * address space. Returns how many resident pages it unmapped.
+ */
+u_int32_t
+vm_unmap(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	u_int32_t resident = 0;
+	vaddr_t va;
+	pte_t *pte;
+	int i;
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		i = va >> 22;
+		if (as->page_directory[i] == NULL) {
+			/* Nothing in this page table; skip to the next one */
+			va = ((va >> 22) << 22) + (TWO_LEV_PAGE_TABLE_SIZE - 1) * PAGE_SIZE;
+			continue;
+		}
+		pte = as_pte(as, va);
+		if (*pte != 0) {
+			if (*pte & PTE_VALID) resident++;
+			page_unmap(pte, as, va);
+			tlb_invalidate(as, va);
+		}
+		if (as->pt_used[i] == 0) destroy_page_table(as, i);
+	}
+	return resident;
+}
+
+/*
+ * Write back the dirty MAP_SHARED pages AS maps in [START, END)
+ * (page-aligned, in user space). Anything else there is left alone.
+ */
+int
+vm_msync(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	vaddr_t va;
+	pte_t *pte;
+	u_int32_t i;
+	int result = 0;
+
+	assert(start <= end && end <= USERTOP);
+
+	lock_acquire(CoreMapLock);
+	for (va = start; va < end && result == 0; va += PAGE_SIZE) {
+		pte = pte_lookup(as, va, 0);
+		if (pte == NULL) continue;
+		pte_wait(pte);
+		if (!(*pte & PTE_VALID)) continue;
+
+		i = PTE_PADDR(*pte) / PAGE_SIZE;
+		if (pages[i].file != NULL && pages[i].state == PAGE_DIRTY) {
+			result = pagecache_writeback(i);
+		}
+	}
+	lock_release(CoreMapLock);
+	return result;
+}
+
+/*
+ * Write back every dirty page of VN in the page cache, whoever has it
+ * mapped (for fsync()). Writing one back lets go of CoreMapLock, so
+ * look through the bucket again afterwards.
+ */
+int
+vm_sync_file(struct vnode *vn)
+{
+	u_int32_t b, i;
+	int result = 0;
+
+	lock_acquire(CoreMapLock);
+	for (b = 0; b < PAGECACHE_BUCKETS && result == 0; b++) {
+		i = pagecache[b];
+		while (i != NO_PAGE && result == 0) {
+			if (pages[i].file != vn || pages[i].state != PAGE_DIRTY) {
+				i = pages[i].cache_next;
+			}
+			else if (pages[i].busy) {
+				page_wait(i);
+				i = pagecache[b];
+			}
+			else {
+				result = pagecache_writeback(i);
+				i = pagecache[b];
+			}
+		}
+	}
+	lock_release(CoreMapLock);
+	return result;
+}
+
+/*
+ * Put the entry EHI/ELO in the TLB. If there's already one for its
+ * address (a read-only copy-on-write mapping being upgraded) replace
+ * it, else take an empty slot, else shove it in randomly. Called at
+ * splhigh.
+ */
+static
+void
+tlb_write_entry(u_int32_t ehi, u_int32_t elo)
+{
+	u_int32_t oldhi, oldlo;
+	int i;
+
+	i = TLB_Probe(ehi, 0);
+	if (i < 0) {
+		for (i=0; i<NUM_TLB; i++) {
+			TLB_Read(&oldhi, &oldlo, i);
+			if (!(oldlo & TLBLO_VALID)) break;
+		}
+	}
+
+	//DEBUG(DB_VM, "VM: 0x%x -> 0x%x, index %d\n", ehi, elo, i);
+	if (i < NUM_TLB) {
+		TLB_Write(ehi, elo, i);
+	}
+	else {
+		TLB_replacement_counter++;
+		TLB_Random(ehi, elo);
+	}
 }
 
+/*
+ * Load a translation for VADDR in AS (the current address space) into
+ * the TLB.
+ */
 static
-struct page_table_entry*
-check_page_table(struct addrspace* as, vaddr_t faultaddr)
+void
+tlb_load(struct addrspace *as, vaddr_t vaddr, paddr_t paddr, int writeable)
 {
-	/* 
-	 * Has the necessary page table even been created in our page
-	 * directory yet? Check.
-	 */
-	int page_dir_index = faultaddr >> 22;
-	if(as->page_directory[page_dir_index] == NULL) return NULL;
+	u_int32_t elo;
 
-	/*
-	 * Okay, it has. All entries initialized to NULL, so returns 
-	 * NULL if the actual entry isn't in there yet.
-	 */
-	int page_table_index = (faultaddr & PAGE_TABLE_MASK) >> 12;
-	return as->page_directory[page_dir_index]->entries[page_table_index];
+	assert(AS_IN_TLB(as));
+
+	elo = paddr | TLBLO_VALID;
+	if (writeable) elo |= TLBLO_DIRTY;
+
+	tlb_write_entry(vaddr | (as->asid << TLBHI_PID_SHIFT), elo);
+}
+
+/*
+ * A kernel access to kseg2 missed in the TLB: load the translation from
+ * kva_map. Entries are global, so they're good in every address space.
+ * This can happen with interrupts off or CoreMapLock held, so it mustn't
+ * sleep.
+ */
+static
+int
+kva_fault(int faulttype, vaddr_t faultaddress)
+{
+	u_int32_t i, ent;
+	int spl;
+
+	i = (faultaddress - KVA_BASE) / PAGE_SIZE;
+	if (faulttype == VM_FAULT_READONLY || i >= kva_npages) {
+		/* Always mapped writeable; and beyond the area is a bug */
+		return EFAULT;
+	}
+
+	spl = splhigh();
+	ent = kva_map[i];
+	if (!(ent & KVA_VALID)) {
+		splx(spl);
+		return EFAULT;
+	}
+	tlb_write_entry(faultaddress,
+			(ent & PAGE_FRAME) | TLBLO_VALID | TLBLO_DIRTY | TLBLO_GLOBAL);
+	vmstats.kva_faults++;
+	splx(spl);
+
+	return 0;
 }
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	paddr_t paddr;
-	int i, result;
-	u_int32_t ehi, elo;
+	int result;
 	struct addrspace *as;
-	struct page_table_entry* pte;
+	pte_t *pte;
+	struct page_mapping *dead = NULL, *newmap = NULL;
+	struct mmap_region *mmap = NULL;
 	int spl;
-	int region, permission;
-	int first_time, done_before, done_after, just_wrote_code_page; /* Flags for TLB and on-demand paging stuff */
+	int region, permission, perms, writeable;
+	int first_time; /* Flag for on-demand paging stuff */
 	int swap_index = -1;
+	paddr_t ra[SWAP_CLUSTER];	/* pages read in from swap */
+	u_int32_t k, nra;
+	pte_t *ra_pte;
+	u_int32_t filereads;
+	int major = 0;	/* read it in from swap */
 
 	/* Bad idea to kprintf in here apparently..
 	kprintf("in vm_fault.. frame we're faulting on: 0x%x\n", faultaddress);
 	*/
 
-	spl = splhigh();
+	vmstats.faults++;
 	
 	/* Initialize all flags */
 	first_time = 0;	
-	done_before = 0;
-	done_after = 0;
-	just_wrote_code_page = 0;
 
 	faultaddress &= PAGE_FRAME;
 
@@ -896,10 +2625,13 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		break;
 	    default:
 		DEBUG(DB_VM, "User mode fault 1: %x\n", as);
-		splx(spl);
 		return EINVAL;
 	}
 
+	if (faultaddress >= KVA_BASE) {
+		return kva_fault(faulttype, faultaddress);
+	}
+
 	as = curthread->t_vmspace;
 	if (as == NULL) {
 		/*
@@ -911,6 +2643,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
+	/* Only this thread updates these two (eviction counts vs_swapouts) */
+	if(faulttype != VM_FAULT_READONLY) as->as_stats.vs_tlbmisses++;
+	filereads = as->as_stats.vs_filereads;
+
 	/* Error check */
 	assert(as->code != NULL);
 	assert(as->data != NULL);
@@ -928,212 +2664,215 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	if ( region < 0) {
 		DEBUG(DB_VM, "User mode fault 3: %x\n", as);
-		splx(spl);
+		if (faultaddress < as->stack->top &&
+		    faultaddress >= as->stack->top - USER_STACK_MAX - USER_STACK_GUARD) {
+			vmstats.stack_overflows++;
+		}
 		return EFAULT;
 	}
 
-	if(region == CODE_REGION) permission = READ_ONLY;
+	if(region == MMAP_REGION){
+		mmap = as_mmap_find(as, faultaddress);
+		permission = (mmap->prot & PROT_WRITE) ? WRITEABLE : READ_ONLY;
+	}
+	else if(region == CODE_REGION) permission = READ_ONLY;
 	else permission = WRITEABLE;
+	perms = (permission == WRITEABLE) ? PTE_RW : PTE_EXECUTABLE;
 
 	if(permission == READ_ONLY && faulttype == VM_FAULT_READONLY){
 		/* This is a real READ_ONLY fault (not copy-on-write) */
 		DEBUG(DB_VM, "User mode fault 4: %x\n", as);
-		splx(spl);
 		return EFAULT;
 	}
 
-	pte = check_page_table(as, faultaddress);
-	if(pte == NULL){
+	/*
+	 * Only this thread touches our page tables, apart from eviction
+	 * (which, under CoreMapLock, marks the PTE of a resident page
+	 * swapped). So the page table can be created up front, without
+	 * the lock; kmalloc may need CoreMapLock itself.
+	 */
+	pte = pte_lookup(as, faultaddress, 1);
+	if(pte == NULL) {
+		DEBUG(DB_VM, "User mode fault 5: %x\n", as);
+		return ENOMEM;
+	}
+
+	/* A code or file page we haven't had yet may be in the page cache; we'd need a mapping for it */
+	if(PTE_UNTOUCHED(*pte) &&
+	   (region == CODE_REGION || (region == MMAP_REGION && mmap->vn != NULL))){
+		newmap = kmem_cache_alloc(&mapping_cache);
+		if(newmap == NULL) return ENOMEM;
+	}
+
+	/*
+	 * From here on, hold CoreMapLock so the page can't be evicted out
+	 * from under us before it's in the TLB. If the page is in transit
+	 * (being written out to swap, say), wait for it first.
+	 */
+	lock_acquire(CoreMapLock);
+	pte_wait(pte);
+
+	if(*pte & PTE_VALID){
+		if(faulttype == VM_FAULT_READONLY && pages[PTE_PADDR(*pte) / PAGE_SIZE].file == NULL){
+			/* A write to a copy-on-write page. Get our own copy if it's still shared. */
+			paddr = page_cow(pte, as, faultaddress, &dead);
+			if(paddr == 0){
+				lock_release(CoreMapLock);
+				return ENOMEM;
+			}
+		}
+		else paddr = PTE_PADDR(*pte);
+	}
+	else if(!(*pte & PTE_SWAPPED)){
 		/* 
 		 * The address is not yet mapped, and therefore has not
-		 * yet been loaded into memory. Create the page table entry,
-		 * grab a page from memory, write the mapping, and set the 
-		 * first_time flag.
+		 * yet been loaded into memory. Code and data come from the
+		 * executable, and mmap()ed pages from their file (or the
+		 * page cache); otherwise grab a page from memory and write
+		 * the mapping. Either way, set the first_time flag.
 		 */
-
- 		pte = create_page_table_entry(as, faultaddress);
-		if(pte == NULL) {
-			DEBUG(DB_VM, "User mode fault 5: %x\n", as);
-			splx(spl);			
-			return ENOMEM;
+		if(region == CODE_REGION || region == DATA_REGION || region == MMAP_REGION){
+			if(region == MMAP_REGION) result = mmap_page_map(as, faultaddress, mmap, pte, perms, &newmap);
+			else result = exec_page_map(as, faultaddress, region, pte, perms, &newmap);
+			if(result){
+				DEBUG(DB_VM, "User mode fault 8: %x\n", as);
+				lock_release(CoreMapLock);
+				kmem_cache_free(&mapping_cache, newmap);
+				return result;
+			}
+			paddr = PTE_PADDR(*pte);
+		}
+		else{
+			/* Heap or stack: a fresh page of zeros */
+			result = anon_page_map(as, faultaddress, pte, perms);
+			if(result){
+				lock_release(CoreMapLock);
+				return result;
+			}
+			paddr = PTE_PADDR(*pte);
 		}
-		paddr = page_alloc(USER_ALLOC, faultaddress, as);
-		write_pte(pte, paddr, permission, -1);
 		first_time = 1;
 	}
-	else if (pte->valid)
-		paddr = pte->paddr;
 	else{
-			//not valid PTE but not NULL, so it must have been swapped
-			swap_index = pte->swap_entry;		//index of swap saved as address
-			/*
-			lock_acquire(SwapTableLock);
-			if (SwapTable[swap_index].as != as || SwapTable[swap_index].va != faultaddress)
-				panic("SwapTable does not match to value in page table");
-			lock_release(SwapTableLock);
-			*/
-			//DEBUG(DB_VM, "swapped page requested back %d\n", swap_index);
-			//panic("swapped page requested back %d\n", swap_index);
-			paddr = page_alloc(USER_ALLOC, faultaddress, as);		//allocate a page
-			write_pte(pte, paddr, permission, swap_index);
+		/*
+		 * It's been swapped. If it's in the compressed swap cache,
+		 * that's quick. Otherwise read it back in, along with the
+		 * pages swapped out after it, with the new pages busy and
+		 * without holding CoreMapLock across the disk I/O. The
+		 * pages keep their swap slots.
+		 */
+		swap_index = PTE_SLOT(*pte);
+		paddr = page_alloc_locked(USER_ALLOC, faultaddress, as);		//allocate a page
+		if(paddr == 0){
+			lock_release(CoreMapLock);
+			return ENOMEM;
+		}
+		pages[paddr / PAGE_SIZE].swap_slot = swap_index;
+		pte_set(as, faultaddress, pte, PTE_MKVALID(paddr, perms));
+
+		if(zcache_load(swap_index, paddr) == 0){
 			/*
-			 * File IO will be needed
+			 * Rather than keep a second copy in the cache while
+			 * it's resident, let the slot go; it's compressed
+			 * again if it's evicted again.
 			 */
-			struct uio u;
-			//DEBUG(DB_VM, "swapped page request paddr %x\n", paddr);
+			swap_free(swap_index);
+			pages[paddr / PAGE_SIZE].swap_slot = -1;
+			page_unbusy_locked(paddr / PAGE_SIZE);
+		}
+		else{
+			ra[0] = paddr;
+			nra = 1 + swap_readahead(as, faultaddress, swap_index, &ra[1]);
 
-			mk_kuio(&u, PADDR_TO_KVADDR(paddr), PAGE_SIZE, (swap_index * PAGE_SIZE), UIO_READ);
-			/*
-			u.uio_iovec.iov_ubase = (userptr_t)faultaddress;
-			u.uio_iovec.iov_len = PAGE_SIZE;   // length of the memory space
-			u.uio_resid = PAGE_SIZE;          // amount to actually read
-			u.uio_offset = (swap_index * PAGE_SIZE);
-			u.uio_segflg = (region == CODE_REGION) ? UIO_USERISPACE : UIO_USERSPACE;
-			u.uio_rw = UIO_READ;
-			u.uio_space = curthread->t_vmspace;
-			*/
-			lock_acquire(SwapTableLock);
-			result = VOP_READ(swapfile, &u);
-			lock_release(SwapTableLock);
+			lock_release(CoreMapLock);
+			result = swapin_cluster(ra, nra, swap_index);
+			lock_acquire(CoreMapLock);
+
+			for (k = 0; k < nra; k++) {
+				page_unbusy_locked(ra[k] / PAGE_SIZE);
+				if (result) {
+					ra_pte = (k == 0) ? pte : pte_lookup(as, faultaddress + k * PAGE_SIZE, 0);
+					pte_set(as, faultaddress + k * PAGE_SIZE, ra_pte,
+						PTE_MKSWAPPED(swap_index + k, *ra_pte & PTE_PERMS));
+					pages[ra[k] / PAGE_SIZE].swap_slot = -1;
+					page_set_free(ra[k] / PAGE_SIZE);
+				}
+				else {
+					/* Same as what's in its swap slot, so no need to write it out again until it changes */
+					pages[ra[k] / PAGE_SIZE].state = PAGE_CLEAN;
+				}
+			}
 			if (result) {
 				DEBUG(DB_VM, "User mode fault 6: %x\n", as);
-				splx(spl);
+				lock_release(CoreMapLock);
 				return result;
 			}
-			if (u.uio_resid != 0) {
-				/* short read; problem with file? */
-				DEBUG(DB_VM, "User mode fault 7: %x\n", as);
-				splx(spl);
-				return EIO;
-			}
-			//DEBUG(DB_VM, "Seems swapin went fine\n");
+			as->as_stats.vs_swapins += nra;
+			major = 1;
+		}
 	}
 
-
-
-	if(region == CODE_REGION && first_time) as->done_loading_code_page = 0;
+	/*
+	 * Tell the clock hand this page is in use. That also lets the UTLB
+	 * refill handler reload it without coming here.
+	 */
+	*pte |= PTE_REFERENCE;
 
 	/* make sure it's page-aligned */
 	assert((paddr & PAGE_FRAME)==paddr);
 
 	/* 
 	 * Alright, at this point we should have it mapped. Put it in the TLB. 
-	 * First set up 'ehi' and 'elo'.
+	 * A page is writeable if its region is, except that pages that are
+	 * shared copy-on-write or clean stay read-only so that writes come
+	 * back to us.
 	 */
-	
-	/* Look for an empty spot in the TLB */
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		/* Most of the time, we'll do : */
-		if(pte->permission == READ_ONLY) elo = paddr | TLBLO_VALID;
-		else elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		/* But, : */
-		if((pte->permission == READ_ONLY) && !as->done_loading_code_page){
-			/* We're writing the *code* (normally read-only) into memory */
-			elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-			/* Make it writeable, write to it, then flush the TLB immediately (below) */
-		}
-		/* If copy on write: */
-		if(faulttype == VM_FAULT_READONLY){
-			/* We already returned EFAULT if it was an 'actual' READ_ONLY fault */
-			panic("Copy-on-write not yet supported. We shouldn't have even gotten here.\n");
-			/* Add this for copy on write
-				# both us and the guy we copied from are sharing the page table and memory
-				# okay, core map entry now has two addrspace fields (swap page entry will need
-				  both as well.. page_alloc will need to be edited to take in both addrspace
-				  fields as arguments, rather than just using curthread->t_vmspace). #
-				# now, two addrspace fields in core map, get them. if their page directories
-				  at the index of interest are identical, we'll need to create a new page table, 
-				  copy all *read_only* entries over (other entries may have been created in between..
-				  we don't wanna copy those), make entry of faultaddress WRITEABLE for both, allocate
-				  a new (unshared page) for us in the core map, and set up the mapping. else, if their
-				  page directory index is not identical, just make entries WRITEABLE and set the mapping,
-				  but may need an additional flag here because page table could have been created for
-				  another fault not to do with any of our copied-on-write addresses.. holy shit.. this 
-				  might be too much work to even be worth it #
-			*/
-		}
-		//DEBUG(DB_VM, "VM: 0x%x -> 0x%x, index %d\n", faultaddress, paddr, i);
-		TLB_Write(ehi, elo, i);
-		break;
-	}
+	writeable = (*pte & PTE_RW) && page_writeable(paddr, faulttype);
 
-	/* If none empty, shove it in randomly (for now) */
-	if(i == NUM_TLB){
-		//DEBUG(DB_VM, "TLB full, replacing randomly.\n");
-		TLB_replacement_counter++;
-		ehi = faultaddress;
-		/* Most of the time, we'll do : */
-		if(pte->permission == READ_ONLY) elo = paddr | TLBLO_VALID;
-		else elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		/* But, : */
-		if((pte->permission == READ_ONLY) && !as->done_loading_code_page){
-			/* We're writing the *code* (normally read-only) into memory */
-			elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-			/* Make it writeable, write to it, then flush the TLB immediately (below) */
-		}
-		/* If copy on write: */
-		if(faulttype == VM_FAULT_READONLY){
-			/* We already returned EFAULT if it was an 'actual' READ_ONLY fault */
-			panic("Copy-on-write not yet supported. We shouldn't have even gotten here.\n");
-		}
-		TLB_Random(ehi, elo);
+	/* PTE_MODIFY tells the refill handler whether to map it writeable */
+	if(writeable) *pte |= PTE_MODIFY;
+	else *pte &= ~PTE_MODIFY;
+
+	spl = splhigh();
+	tlb_load(as, faultaddress, paddr, writeable);
+	splx(spl);
+
+	/* Major if we read it from swap or its file (not if someone else did) */
+	if(major || as->as_stats.vs_filereads != filereads){
+		as->as_stats.vs_majflt++;
+		vmstats.major_faults++;
+	}
+	else{
+		as->as_stats.vs_minflt++;
+		vmstats.minor_faults++;
 	}
 
-	/* 
-	 * Okay, at this point, we've done a lot of the work. 
-	 * 
-	 * If we're dealing with a TLB_WRITE fault, we don't need to load anything.
-	 * The memory has been allocated, and the mapping has been set up. Our user 
-	 * process should now be able to write to the address which caused the fault.
-	 *
-	 * If it's a TLB_READ fault, we need to load the data (most likely instructions
-	 * or data from the .text or .data sections of the .elf file) into the page of
-	 * memory we just allocated and mapped.
-	 */
+	lock_release(CoreMapLock);
+	kmem_cache_free(&mapping_cache, dead);
+	kmem_cache_free(&mapping_cache, newmap);
+	if(dead_mappings != NULL) mappings_reap();
 
-	if((region == CODE_REGION || region == DATA_REGION) && first_time){
-		done_before = as->done_loading_code_page;
-		result = load_page(faultaddress, region);
-		if(result){
-			DEBUG(DB_VM, "User mode fault 8: %x\n", as);
-			splx(spl);
-			return result;
-		}
-		done_after = as->done_loading_code_page;
-		just_wrote_code_page = done_after - done_before;
-		if(just_wrote_code_page){
-			DEBUG(DB_VM, "VM: Just wrote code page: 0x%x, addrspace: 0x%x\n", faultaddress, (u_int32_t) as);
-			/* Flush the TLB */
-			//DEBUG(DB_VM, "TLB flush.\n", faultaddress, (u_int32_t) as);
-			for (i=0; i<NUM_TLB; i++) 
-				TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	/* Starting on a part of the executable; the next pages are likely wanted too */
+	if(first_time && region == CODE_REGION) exec_readahead(as, faultaddress, as->code, region, perms);
+	if(first_time && region == DATA_REGION) exec_readahead(as, faultaddress, as->data, region, perms);
+
+	if(region == STACK_REGION && first_time){
+		/*
+		 * The stack grows lazily: any page within USER_STACK_MAX of
+		 * the top gets mapped when it's first touched (find_region()
+		 * checked the limit). Keep track of how far down it's got.
+		 */
+		vmstats.stack_pages++;
+		if(faultaddress < as->stack->base){
+			as->stack->base = faultaddress;
+			DEBUG(DB_VM, "VM: Stack of addrspace: 0x%x just grew down to base: 0x%x\n", (u_int32_t) as, as->stack->base);
 		}
 	}
-	if((region == HEAP_REGION || region == STACK_REGION) && first_time){
-		if((faultaddress >= as->heap->top) && (faultaddress < as->stack->base)){
-			if(region == STACK_REGION){			
-				/* Move our stack base around as necessary */
-				assert((as->stack->base - faultaddress) == PAGE_SIZE);
-				as->stack->base = faultaddress;
-				/* Kill the process if it's stack gets too large */
-				if((as->stack->top - as->stack->base) > USER_STACK_MAX) return EFAULT;
-				DEBUG(DB_VM, "VM: Stack of addrspace: 0x%x just grew down to base: 0x%x\n", (u_int32_t) as, as->stack->base);
-			}
-			else{
-				/* Move our heap top around as necessary */
-				assert(region == HEAP_REGION);
-				assert(faultaddress == as->heap->top);
-				as->heap->top = faultaddress + PAGE_SIZE;
-				DEBUG(DB_VM, "VM: Heap of addrspace: 0x%x just grew up to top: 0x%x\n", (u_int32_t) as, as->heap->top);
-			}
-		}
+	if(region == HEAP_REGION && first_time && faultaddress == as->heap->top){
+		/* Move our heap top around as necessary */
+		as->heap->top = faultaddress + PAGE_SIZE;
+		DEBUG(DB_VM, "VM: Heap of addrspace: 0x%x just grew up to top: 0x%x\n", (u_int32_t) as, as->heap->top);
 	}
 	
-	splx(spl);
 	return 0;
 }
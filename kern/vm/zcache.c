@@ -0,0 +1,405 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+
+/*
+ * Compressed swap cache.
+ *
+ * A pool of kernel pages, carved up into ZCACHE_CHUNK-byte chunks,
+ * that sits in front of the swap disk. A page being swapped out is
+ * compressed into the pool if it compresses well and there's room,
+ * instead of being written to disk, and swapping it back in just
+ * decompresses it. A page that doesn't fit spills to disk as usual.
+ *
+ * Copies are kept by swap slot, so the PTE of a swapped page doesn't
+ * care where its page went. A slot has at most one current copy: if
+ * there's one here, that's it, and whatever is on disk is stale.
+ *
+ * The cache is off until it's turned on at the kernel menu ("zc on"),
+ * which allocates the pool. Turning it off again just stops new pages
+ * going in; the ones already there stay until they're swapped in or
+ * freed.
+ *
+ * Everything here is protected by CoreMapLock; the hooks called by
+ * vm.c (zcache_store(), zcache_load(), zcache_drop()) expect it to be
+ * held.
+ */
+
+/*
+ * Compressed format: a sequence of runs of 32-bit words, each starting
+ * with a tag byte whose top two bits give the kind of run and the rest
+ * its length less one (so runs are 1 to ZC_MAXRUN words long).
+ */
+#define ZC_ZERO		0x00	/* that many zero words */
+#define ZC_REPEAT	0x40	/* one word, repeated that many times */
+#define ZC_LITERAL	0x80	/* that many words, as they are */
+#define ZC_TAGMASK	0xc0
+#define ZC_MAXRUN	64
+#define ZC_MINREPEAT	3	/* shorter repeats go in literal runs */
+#define ZC_NWORDS	(PAGE_SIZE / sizeof(u_int32_t))
+
+/* No chunk; ends chunk lists */
+#define ZC_NONE		0xffff
+
+static int zcache_on;
+
+/* Sizes, from zcache_bootstrap() */
+static u_int32_t zc_nslots, zc_maxpages;
+
+/* The pool: its pages, and a chunk list for each swap slot and for free chunks */
+static vaddr_t *zc_pages;
+static u_int32_t zc_npages, zc_nchunks;
+static u_int16_t *zc_next;	/* per chunk: next chunk in the same list */
+static u_int16_t zc_free;	/* free chunks */
+static u_int32_t zc_nfree;
+static u_int16_t *zc_first;	/* per swap slot: first chunk of its copy, or ZC_NONE */
+static u_int16_t *zc_len;	/* per swap slot: compressed length of its copy */
+
+/* Compression happens here before it's copied into the pool */
+static unsigned char zc_buf[PAGE_SIZE];
+
+static struct {
+	u_int32_t stores;	/* pages compressed into the cache */
+	u_int32_t rejects;	/* pages that didn't compress well enough */
+	u_int32_t spills;	/* pages that went to disk because the pool was full */
+	u_int32_t hits;		/* swap-ins satisfied from the cache */
+	u_int32_t pages;	/* pages in the cache now (not a counter) */
+	u_int32_t bytes;	/* their compressed size (not a counter) */
+} zcstats;
+
+static
+void *
+zc_chunk(u_int32_t c)
+{
+	u_int32_t perpage = PAGE_SIZE / ZCACHE_CHUNK;
+
+	assert(c < zc_nchunks);
+	return (void *) (zc_pages[c / perpage] + (c % perpage) * ZCACHE_CHUNK);
+}
+
+/* Are there ZC_MINREPEAT copies of the same word at W[I]? */
+static
+int
+zc_repeat_at(const u_int32_t *w, u_int32_t i)
+{
+	return i + ZC_MINREPEAT <= ZC_NWORDS && w[i] == w[i+1] && w[i] == w[i+2];
+}
+
+/*
+ * Compress the page W into OUT. Returns the compressed length, or 0 if
+ * it would take more than MAX bytes.
+ */
+static
+size_t
+zc_compress(const u_int32_t *w, unsigned char *out, size_t max)
+{
+	u_int32_t i = 0, n;
+	size_t len = 0;
+
+	while (i < ZC_NWORDS) {
+		for (n = 0; i + n < ZC_NWORDS && n < ZC_MAXRUN && w[i+n] == 0; n++);
+		if (n > 0) {
+			if (len + 1 > max) return 0;
+			out[len++] = ZC_ZERO | (n - 1);
+			i += n;
+			continue;
+		}
+
+		if (zc_repeat_at(w, i)) {
+			for (n = 1; i + n < ZC_NWORDS && n < ZC_MAXRUN && w[i+n] == w[i]; n++);
+			if (len + 1 + sizeof(u_int32_t) > max) return 0;
+			out[len++] = ZC_REPEAT | (n - 1);
+			memcpy(out + len, &w[i], sizeof(u_int32_t));
+			len += sizeof(u_int32_t);
+			i += n;
+			continue;
+		}
+
+		/* Literals, up to the next zero or repeated word */
+		for (n = 1; i + n < ZC_NWORDS && n < ZC_MAXRUN &&
+			     w[i+n] != 0 && !zc_repeat_at(w, i+n); n++);
+		if (len + 1 + n * sizeof(u_int32_t) > max) return 0;
+		out[len++] = ZC_LITERAL | (n - 1);
+		memcpy(out + len, &w[i], n * sizeof(u_int32_t));
+		len += n * sizeof(u_int32_t);
+		i += n;
+	}
+	return len;
+}
+
+/* Decompress LEN bytes at IN into the page W. Returns EINVAL if they're garbage. */
+static
+int
+zc_decompress(const unsigned char *in, size_t len, u_int32_t *w)
+{
+	u_int32_t i = 0, k, n, x;
+	size_t pos = 0;
+	int tag;
+
+	while (pos < len) {
+		tag = in[pos] & ZC_TAGMASK;
+		n = (in[pos] & ~ZC_TAGMASK) + 1;
+		pos++;
+		if (i + n > ZC_NWORDS) return EINVAL;
+
+		switch (tag) {
+		    case ZC_ZERO:
+			bzero(&w[i], n * sizeof(u_int32_t));
+			break;
+		    case ZC_REPEAT:
+			memcpy(&x, in + pos, sizeof(u_int32_t));
+			pos += sizeof(u_int32_t);
+			for (k = 0; k < n; k++) w[i+k] = x;
+			break;
+		    case ZC_LITERAL:
+			memcpy(&w[i], in + pos, n * sizeof(u_int32_t));
+			pos += n * sizeof(u_int32_t);
+			break;
+		    default:
+			return EINVAL;
+		}
+		i += n;
+	}
+	return (i == ZC_NWORDS && pos == len) ? 0 : EINVAL;
+}
+
+/*
+ * Called by swap_bootstrap() once it knows how many swap slots there
+ * are. The pool may grow to MAXPAGES pages, once it's turned on.
+ */
+void
+zcache_bootstrap(u_int32_t nslots, u_int32_t maxpages)
+{
+	zc_nslots = nslots;
+	zc_maxpages = maxpages;
+	if (zc_maxpages * (PAGE_SIZE / ZCACHE_CHUNK) >= ZC_NONE) {
+		zc_maxpages = (ZC_NONE - 1) / (PAGE_SIZE / ZCACHE_CHUNK);
+	}
+}
+
+/*
+ * Allocate the pool, as much of it as we can get. Called without
+ * CoreMapLock, since we kmalloc; the result is installed under it.
+ */
+static
+int
+zcache_create(void)
+{
+	vaddr_t *pagev;
+	u_int16_t *next, *first, *len;
+	u_int32_t i, npages, nchunks;
+
+	if (zc_nslots == 0 || zc_maxpages == 0) {
+		/* No swap to put in front of */
+		return ENODEV;
+	}
+
+	pagev = kmalloc(zc_maxpages * sizeof(vaddr_t));
+	first = kmalloc(zc_nslots * sizeof(u_int16_t));
+	len = kmalloc(zc_nslots * sizeof(u_int16_t));
+	next = kmalloc(zc_maxpages * (PAGE_SIZE / ZCACHE_CHUNK) * sizeof(u_int16_t));
+	if (pagev == NULL || first == NULL || len == NULL || next == NULL) {
+		kfree(pagev);
+		kfree(first);
+		kfree(len);
+		kfree(next);
+		return ENOMEM;
+	}
+
+	for (npages = 0; npages < zc_maxpages; npages++) {
+		pagev[npages] = alloc_kpages(1);
+		if (pagev[npages] == 0) break;
+	}
+	if (npages == 0) {
+		kfree(pagev);
+		kfree(first);
+		kfree(len);
+		kfree(next);
+		return ENOMEM;
+	}
+
+	nchunks = npages * (PAGE_SIZE / ZCACHE_CHUNK);
+	for (i = 0; i < nchunks; i++) {
+		next[i] = (i + 1 < nchunks) ? i + 1 : ZC_NONE;
+	}
+	for (i = 0; i < zc_nslots; i++) {
+		first[i] = ZC_NONE;
+		len[i] = 0;
+	}
+
+	lock_acquire(CoreMapLock);
+	zc_pages = pagev;
+	zc_npages = npages;
+	zc_nchunks = nchunks;
+	zc_next = next;
+	zc_first = first;
+	zc_len = len;
+	zc_free = 0;
+	zc_nfree = nchunks;
+	lock_release(CoreMapLock);
+
+	return 0;
+}
+
+/*
+ * Turn the cache on or off. The pool is allocated the first time it's
+ * turned on.
+ */
+int
+zcache_enable(int on)
+{
+	int result;
+
+	if (on && zc_pages == NULL) {
+		result = zcache_create();
+		if (result) {
+			return result;
+		}
+	}
+
+	lock_acquire(CoreMapLock);
+	zcache_on = on;
+	lock_release(CoreMapLock);
+	return 0;
+}
+
+/*
+ * Forget the copy of swap slot SLOT, if there is one. Returns 1 if
+ * there was.
+ */
+int
+zcache_drop(int slot)
+{
+	u_int16_t c, next;
+
+	if (zc_first == NULL || zc_first[slot] == ZC_NONE) {
+		return 0;
+	}
+
+	for (c = zc_first[slot]; c != ZC_NONE; c = next) {
+		next = zc_next[c];
+		zc_next[c] = zc_free;
+		zc_free = c;
+		zc_nfree++;
+	}
+	zcstats.pages--;
+	zcstats.bytes -= zc_len[slot];
+	zc_first[slot] = ZC_NONE;
+	zc_len[slot] = 0;
+	return 1;
+}
+
+/*
+ * Make the page at PADDR the contents of swap slot SLOT, compressed,
+ * if the cache is on, the page compresses to ZCACHE_MAXLEN bytes or
+ * less, and there's room. Returns 0 if it's stored, in which case it
+ * needn't be written to disk; otherwise the caller has to.
+ */
+int
+zcache_store(int slot, paddr_t paddr)
+{
+	u_int32_t nchunks;
+	u_int16_t c, *cp;
+	size_t len, off, n;
+
+	assert(lock_do_i_hold(CoreMapLock));
+
+	/* Whatever we had for it is out of date now */
+	zcache_drop(slot);
+
+	if (!zcache_on) {
+		return EINVAL;
+	}
+
+	len = zc_compress((const u_int32_t *) PADDR_TO_KVADDR(paddr), zc_buf, ZCACHE_MAXLEN);
+	if (len == 0) {
+		zcstats.rejects++;
+		return EINVAL;
+	}
+
+	nchunks = DIVROUNDUP(len, ZCACHE_CHUNK);
+	if (nchunks > zc_nfree) {
+		zcstats.spills++;
+		return ENOSPC;
+	}
+
+	cp = &zc_first[slot];
+	for (off = 0; off < len; off += n) {
+		c = zc_free;
+		zc_free = zc_next[c];
+		zc_nfree--;
+
+		n = (len - off < ZCACHE_CHUNK) ? len - off : ZCACHE_CHUNK;
+		memcpy(zc_chunk(c), zc_buf + off, n);
+		*cp = c;
+		cp = &zc_next[c];
+	}
+	*cp = ZC_NONE;
+	zc_len[slot] = len;
+
+	zcstats.stores++;
+	zcstats.pages++;
+	zcstats.bytes += len;
+	return 0;
+}
+
+/*
+ * Decompress the copy of swap slot SLOT into the page at PADDR, if we
+ * have one. Returns 0 if so, ENOENT if it has to come from disk. The
+ * copy stays here, like the slot's copy on disk would.
+ */
+int
+zcache_load(int slot, paddr_t paddr)
+{
+	u_int16_t c;
+	size_t off, n;
+
+	assert(lock_do_i_hold(CoreMapLock));
+
+	if (zc_first == NULL || zc_first[slot] == ZC_NONE) {
+		return ENOENT;
+	}
+
+	off = 0;
+	for (c = zc_first[slot]; c != ZC_NONE; c = zc_next[c]) {
+		n = (zc_len[slot] - off < ZCACHE_CHUNK) ? zc_len[slot] - off : ZCACHE_CHUNK;
+		memcpy(zc_buf + off, zc_chunk(c), n);
+		off += n;
+	}
+	assert(off == zc_len[slot]);
+
+	if (zc_decompress(zc_buf, off, (u_int32_t *) PADDR_TO_KVADDR(paddr))) {
+		panic("zcache: copy of swap slot %d is corrupt\n", slot);
+	}
+
+	zcstats.hits++;
+	return 0;
+}
+
+void
+zcache_printstats(void)
+{
+	u_int32_t lookups, ratio;
+
+	lock_acquire(CoreMapLock);
+
+	lookups = zcstats.hits + vmstats.swapins;
+	if (lookups == 0) lookups = 1;
+	ratio = zcstats.bytes ? (zcstats.pages * PAGE_SIZE * 100) / zcstats.bytes : 0;
+
+	kprintf("Compressed swap cache: %s, pool %u pages (%u of %u chunks free)\n",
+		zcache_on ? "on" : "off", zc_npages, zc_nfree, zc_nchunks);
+	kprintf("    pages in cache: %u, %uk compressed to %u bytes (ratio %u.%02u:1)\n",
+		zcstats.pages, zcstats.pages * PAGE_SIZE / 1024, zcstats.bytes,
+		ratio / 100, ratio % 100);
+	kprintf("    pages stored: %u, sent to disk instead: %u (didn't compress), %u (pool full)\n",
+		zcstats.stores, zcstats.rejects, zcstats.spills);
+	kprintf("    swap-ins from cache: %u, from disk: %u (hit rate %u%%)\n",
+		zcstats.hits, vmstats.swapins, zcstats.hits * 100 / lookups);
+	kprintf("    disk I/O avoided: %u page writes, %u page reads\n",
+		zcstats.stores, zcstats.hits);
+
+	lock_release(CoreMapLock);
+}
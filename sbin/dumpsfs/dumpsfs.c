@@ -26,6 +26,8 @@
 
 #include "disk.h"
 
+static u_int32_t features;
+
 static
 u_int32_t
 dumpsb(void)
@@ -39,30 +41,78 @@ dumpsb(void)
 	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
 	       SWAPL(sp.sp_nblocks));
 
+	features = SWAPL(sp.sp_features);
+	printf("Features: 0x%x%s%s\n", features,
+	       (features & SFS_FEATURE_DINDIRECT) ? " dindirect" : "",
+	       (features & SFS_FEATURE_HASHDIR) ? " hashdir" : "");
+	if (features & ~SFS_FEATURES) {
+		errx(1, "Unknown features 0x%x", features & ~SFS_FEATURES);
+	}
+
 	return SWAPL(sp.sp_nblocks);
 }
 
+/* Bucket a name belongs in, in a hashed directory (see kern/sfs.h) */
 static
-void
-dodirblock(u_int32_t block)
+u_int32_t
+hashname(const char *name)
+{
+	u_int32_t h = 5381;
+
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return 0;
+	}
+	while (*name) {
+		h = h * 33 + (unsigned char) *name++;
+	}
+	return h % SFS_HDIR_BUCKETS;
+}
+
+/*
+ * Dump block FILEBLOCK of a directory. In a hashed directory that's
+ * the bucket number; entries that overflowed into it from another
+ * bucket say which.
+ */
+static
+u_int32_t
+dodirblock(u_int32_t block, u_int32_t fileblock)
 {
 	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
 	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
-	int i;
+	int i, hashed = (features & SFS_FEATURE_HASHDIR) != 0;
+	u_int32_t home, used = 0;
 
 	diskread(&sds, block);
 
-	printf("    [block %u]\n", block);
+	if (hashed) {
+		printf("    [bucket %u, block %u]\n", fileblock, block);
+	}
+	else {
+		printf("    [block %u]\n", block);
+	}
 	for (i=0; i<nsds; i++) {
 		u_int32_t ino = SWAPL(sds[i].sfd_ino);
-		if (ino==SFS_NOINO) {
+		if (ino==SFS_NOINO && hashed &&
+		    (unsigned char)sds[i].sfd_name[0] == SFS_HDIR_DELETED) {
+			printf("        [deleted entry]\n");
+		}
+		else if (ino==SFS_NOINO) {
 			printf("        [free entry]\n");
 		}
 		else {
 			sds[i].sfd_name[SFS_NAMELEN-1] = 0; /* just in case */
-			printf("        %u %s\n", ino, sds[i].sfd_name);
+			home = hashname(sds[i].sfd_name);
+			if (hashed && home != fileblock) {
+				printf("        %u %s (from bucket %u)\n", ino,
+				       sds[i].sfd_name, home);
+			}
+			else {
+				printf("        %u %s\n", ino, sds[i].sfd_name);
+			}
+			used++;
 		}
 	}
+	return used;
 }
 
 static
@@ -70,9 +120,9 @@ void
 dumpdir(u_int32_t ino)
 {
 	struct sfs_inode sfi;
-	u_int32_t ib[SFS_DBPERIDB];
-	int nentries, i;
-	u_int32_t block, nblocks=0;
+	u_int32_t ib[SFS_DBPERIDB], dib[SFS_DBPERIDB];
+	int nentries, i, j;
+	u_int32_t block, nblocks=0, used=0, fileblock;
 
 	diskread(&sfi, ino);
 
@@ -85,7 +135,7 @@ dumpdir(u_int32_t ino)
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = SWAPL(sfi.sfi_direct[i]);
 		if (block) {
-			dodirblock(block);
+			used += dodirblock(block, i);
 			nblocks++;
 		}
 	}
@@ -94,12 +144,31 @@ dumpdir(u_int32_t ino)
 		for (i=0; i<SFS_DBPERIDB; i++) {
 			block = SWAPL(ib[i]);
 			if (block) {
-				dodirblock(block);
+				used += dodirblock(block, SFS_NDIRECT + i);
 				nblocks++;
 			}
 		}
 	}
-	printf("    %u blocks in directory\n", nblocks);
+	if (SWAPL(sfi.sfi_dindirect)) {
+		diskread(&dib, SWAPL(sfi.sfi_dindirect));
+		for (j=0; j<SFS_DBPERIDB; j++) {
+			if (SWAPL(dib[j]) == 0) {
+				continue;
+			}
+			diskread(&ib, SWAPL(dib[j]));
+			for (i=0; i<SFS_DBPERIDB; i++) {
+				block = SWAPL(ib[i]);
+				if (block) {
+					fileblock = SFS_NDIRECT + SFS_DBPERIDB
+						+ j*SFS_DBPERIDB + i;
+					used += dodirblock(block, fileblock);
+					nblocks++;
+				}
+			}
+		}
+	}
+	printf("    %u blocks in directory, %u entries in use\n",
+	       nblocks, used);
 }
 
 static
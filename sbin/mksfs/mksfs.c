@@ -38,7 +38,7 @@ check(void)
 
 static
 void
-writesuper(const char *volname, u_int32_t nblocks)
+writesuper(const char *volname, u_int32_t nblocks, u_int32_t features)
 {
 	struct sfs_super sp;
 
@@ -50,6 +50,7 @@ writesuper(const char *volname, u_int32_t nblocks)
 
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
+	sp.sp_features = SWAPL(features);
 	strcpy(sp.sp_volname, volname);
 
 	diskwrite(&sp, SFS_SB_LOCATION);
@@ -116,15 +117,25 @@ writebitmap(u_int32_t fsblocks)
 int
 main(int argc, char **argv)
 {
-	u_int32_t size, blocksize;
+	u_int32_t size, blocksize, features = 0;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	/*
+	 * -h: hashed directories (and the bigger files they need). The
+	 * kernel sets up the root directory at the first mount.
+	 */
+	if (argc==4 && !strcmp(argv[1], "-h")) {
+		features = SFS_FEATURE_DINDIRECT | SFS_FEATURE_HASHDIR;
+		argc--;
+		argv++;
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-h] device/diskfile volume-name");
 	}
 
 	check();
@@ -155,7 +166,7 @@ main(int argc, char **argv)
 	}
 	size = diskblocks();
 
-	writesuper(volname, size);
+	writesuper(volname, size, features);
 	writerootdir();
 	writebitmap(size);
 
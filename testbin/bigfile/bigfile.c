@@ -5,6 +5,11 @@
  * and should work on SFS when the file system assignment is
  * done. Sufficiently small files should work on SFS even before that
  * assignment.
+ *
+ * Afterwards it reads the file back, first a block (512 bytes) at a
+ * time, the way cat does, and then in big chunks, and prints how fast
+ * the writing and each of the reads went. Run "bc" at the kernel menu
+ * for what the buffer cache and read-ahead made of it.
  */
 
 #include <stdlib.h>
@@ -14,6 +19,58 @@
 #include <err.h>
 
 static char buffer[100];
+static char readbuf[16384];
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+static
+void
+report(const char *what, int size, time_t s1, unsigned long ns1)
+{
+	time_t s2;
+	unsigned long ns2, usec;
+
+	__time(&s2, &ns2);
+	usec = elapsed_usec(s1, ns1, s2, ns2);
+	printf("%s: %d bytes in %lu us (%lu KB/sec)\n", what, size, usec,
+	       ((unsigned long) size * 1000 / 1024) / (usec / 1000 + 1));
+}
+
+/* Read the whole file back, CHUNK bytes at a time */
+static
+void
+readback(const char *filename, int size, int chunk, const char *what)
+{
+	time_t s1;
+	unsigned long ns1;
+	int fileid, len, total;
+
+	fileid = open(filename, O_RDONLY);
+	if (fileid < 0) {
+		err(1, "%s: open for read", filename);
+	}
+
+	__time(&s1, &ns1);
+	total = 0;
+	while ((len = read(fileid, readbuf, chunk)) > 0) {
+		total += len;
+	}
+	if (len < 0) {
+		err(1, "%s: read", filename);
+	}
+	report(what, total, s1, ns1);
+
+	if (total != size) {
+		errx(1, "%s: read back %d bytes, expected %d", filename,
+		     total, size);
+	}
+	close(fileid);
+}
 
 int
 main(int argc, char *argv[])
@@ -22,6 +79,8 @@ main(int argc, char *argv[])
 	int i, size;
 	int fileid;
 	int len;
+	time_t s1;
+	unsigned long ns1;
 
 	if (argc != 3) {
 		errx(1, "Usage: bigfile <filename> <size>");
@@ -37,6 +96,7 @@ main(int argc, char *argv[])
 		err(1, "%s: create", filename);
 	}
 
+	__time(&s1, &ns1);
 	i=0;
 	while (i<size) {
 		snprintf(buffer, sizeof(buffer), "%-10d", i);
@@ -48,6 +108,10 @@ main(int argc, char *argv[])
 	}	
 
 	close(fileid);
+	report("write", i, s1, ns1);
+
+	readback(filename, i, 512, "read, 512 at a time");
+	readback(filename, i, sizeof(readbuf), "read, 16k at a time");
 
 	return 0;
 }
@@ -0,0 +1,159 @@
+/*
+ * dirbench - big directory benchmark.
+ *
+ * Usage: dirbench [nentries]
+ *
+ * Creates NENTRIES files (10000 by default) in one directory, opens
+ * each of them again, looks up a tenth as many names that aren't
+ * there, replaces every file with one of another name (removing one,
+ * then creating the next), looks up the missing names again, and
+ * removes them all, timing each phase. If the disk or the directory
+ * fills up first, carries on with however many files it got.
+ *
+ * Every create has to make sure the name isn't already there, so in a
+ * flat directory the create and miss phases get slower as the directory
+ * grows; a filesystem made with "mksfs -h" hashes its directories. The
+ * second miss phase should take about as long as the first: if removed
+ * entries pile up and searches have to go past them, it won't.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define TESTDIR   "dirbench"
+#define NAMESIZE  32
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+static time_t start_s;
+static unsigned long start_ns;
+
+static
+void
+starttimer(void)
+{
+	__time(&start_s, &start_ns);
+}
+
+/* Look up N/10 names that aren't there */
+static
+void
+misses(int n)
+{
+	char buf[NAMESIZE];
+	int i, fd;
+
+	for (i=0; i<n/10; i++) {
+		snprintf(buf, sizeof(buf), "%s/g%d", TESTDIR, i);
+		fd = open(buf, O_RDONLY);
+		if (fd >= 0) {
+			errx(1, "%s: open succeeded", buf);
+		}
+		if (errno != ENOENT) {
+			err(1, "%s: open", buf);
+		}
+	}
+}
+
+static
+void
+report(const char *phase, int n)
+{
+	time_t s;
+	unsigned long ns, usec;
+
+	__time(&s, &ns);
+	usec = elapsed_usec(start_s, start_ns, s, ns);
+	printf("dirbench: %-7s %6d in %9lu us (%lu/sec)\n", phase, n, usec,
+	       ((unsigned long) n * 1000) / (usec / 1000 + 1));
+}
+
+int
+main(int argc, char *argv[])
+{
+	char buf[NAMESIZE];
+	int n = 10000, i, fd;
+
+	if (argc > 1) n = atoi(argv[1]);
+	if (n < 1) {
+		errx(1, "nentries must be at least 1");
+	}
+
+	if (mkdir(TESTDIR, 0775) < 0) {
+		err(1, "%s: mkdir", TESTDIR);
+	}
+
+	starttimer();
+	for (i=0; i<n; i++) {
+		snprintf(buf, sizeof(buf), "%s/f%d", TESTDIR, i);
+		fd = open(buf, O_WRONLY|O_CREAT|O_EXCL);
+		if (fd < 0) {
+			if (i == 0) {
+				err(1, "%s: create", buf);
+			}
+			warn("%s: create; going on with %d files", buf, i);
+			n = i;
+			break;
+		}
+		close(fd);
+	}
+	report("create", n);
+
+	starttimer();
+	for (i=0; i<n; i++) {
+		snprintf(buf, sizeof(buf), "%s/f%d", TESTDIR, i);
+		fd = open(buf, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s: open", buf);
+		}
+		close(fd);
+	}
+	report("lookup", n);
+
+	starttimer();
+	misses(n);
+	report("miss", n/10);
+
+	starttimer();
+	for (i=0; i<n; i++) {
+		snprintf(buf, sizeof(buf), "%s/f%d", TESTDIR, i);
+		if (remove(buf) < 0) {
+			err(1, "%s: remove", buf);
+		}
+		snprintf(buf, sizeof(buf), "%s/c%d", TESTDIR, i);
+		fd = open(buf, O_WRONLY|O_CREAT|O_EXCL);
+		if (fd < 0) {
+			err(1, "%s: create", buf);
+		}
+		close(fd);
+	}
+	report("churn", n);
+
+	starttimer();
+	misses(n);
+	report("miss", n/10);
+
+	starttimer();
+	for (i=0; i<n; i++) {
+		snprintf(buf, sizeof(buf), "%s/c%d", TESTDIR, i);
+		if (remove(buf) < 0) {
+			err(1, "%s: remove", buf);
+		}
+	}
+	report("unlink", n);
+
+	if (rmdir(TESTDIR) < 0) {
+		err(1, "%s: rmdir", TESTDIR);
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * execbench - program startup latency benchmark.
+ *
+ * Usage: execbench [nruns] program [args...]
+ *
+ * Runs PROGRAM (with ARGS) NRUNS times, one at a time, each time
+ * forking, exec'ing it and waiting for it to exit. Prints the average
+ * time per run.
+ *
+ * For a program that prints something and exits straight away
+ * (/bin/true, /bin/pwd, /testbin/add 1 2) nearly all of that is exec:
+ * faulting in the program's code and data from the executable. For
+ * a longer one like /testbin/huge it includes the whole run. Run "vs"
+ * at the kernel menu afterwards to see how many executable pages were
+ * loaded, and how many of those were read ahead of a fault.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nruns = 10;
+	char **args;
+	int i, pid, status;
+	time_t s1, s2;
+	unsigned long ns1, ns2, usec;
+
+	args = argv + 1;
+	if (argc > 2 && atoi(argv[1]) > 0) {
+		nruns = atoi(argv[1]);
+		args++;
+	}
+	if (args[0] == NULL) {
+		errx(1, "Usage: execbench [nruns] program [args...]");
+	}
+
+	__time(&s1, &ns1);
+	for (i=0; i<nruns; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv(args[0], args);
+			err(1, "%s", args[0]);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (status != 0) {
+			errx(1, "%s exited with status %d", args[0], status);
+		}
+	}
+	__time(&s2, &ns2);
+
+	usec = elapsed_usec(s1, ns1, s2, ns2);
+	printf("execbench: %s: %d runs in %lu us, %lu us per fork+exec+exit+wait\n",
+	       args[0], nruns, usec, usec / nruns);
+	return 0;
+}
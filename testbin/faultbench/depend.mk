@@ -0,0 +1,15 @@
+
+faultbench.o: \
+ faultbench.c \
+ $(OSTREE)/include/sys/types.h \
+ $(OSTREE)/include/machine/types.h \
+ $(OSTREE)/include/kern/types.h \
+ $(OSTREE)/include/sys/wait.h \
+ $(OSTREE)/include/stdarg.h \
+ $(OSTREE)/include/stdio.h \
+ $(OSTREE)/include/string.h \
+ $(OSTREE)/include/stdlib.h \
+ $(OSTREE)/include/unistd.h \
+ $(OSTREE)/include/kern/unistd.h \
+ $(OSTREE)/include/kern/ioctl.h \
+ $(OSTREE)/include/err.h
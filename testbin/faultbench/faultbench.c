@@ -0,0 +1,154 @@
+/*
+ * faultbench - parallel page fault throughput test.
+ *
+ * Usage: faultbench [nprocs] [npages] [nrounds]
+ *
+ * Forks NPROCS processes (in the style of parallelvm), each of which
+ * sweeps over NPAGES pages of its own memory NROUNDS times, writing a
+ * pattern to every page and then checking it. With enough processes
+ * and pages the total doesn't fit in RAM, so most touches fault, and
+ * many of those have to wait for swap. Prints how long it all took and
+ * the page touches per second across all processes.
+ *
+ * Run "vs" at the kernel menu afterwards for the fault, eviction and
+ * swap counts.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PAGE_SIZE	4096
+#define MAXPROCS	16
+#define MAXPAGES	256
+
+/* Visit pages in a scattered order so neighbours aren't hit together */
+#define STRIDE		37
+
+static char mem[MAXPAGES][PAGE_SIZE];
+
+/*
+ * Use this instead of just calling printf so we know each printout
+ * is atomic; this prevents the lines from getting intermingled.
+ */
+static
+void
+say(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	write(STDOUT_FILENO, buf, strlen(buf));
+}
+
+static
+char
+pattern(int mynum, int round, int page)
+{
+	return (char) (mynum * 31 + round * 7 + page);
+}
+
+static
+void
+go(int mynum, int npages, int nrounds)
+{
+	int round, i, page;
+
+	for (round=0; round<nrounds; round++) {
+		for (i=0; i<npages; i++) {
+			page = (i * STRIDE) % npages;
+			mem[page][0] = pattern(mynum, round, page);
+			mem[page][PAGE_SIZE-1] = pattern(mynum, round, page);
+		}
+		for (i=0; i<npages; i++) {
+			page = (i * STRIDE) % npages;
+			if (mem[page][0] != pattern(mynum, round, page) ||
+			    mem[page][PAGE_SIZE-1] != pattern(mynum, round, page)) {
+				say("Process %d: page %d corrupt in round %d\n",
+				    mynum, page, round);
+				_exit(1);
+			}
+		}
+	}
+	_exit(0);
+}
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nprocs = 4, npages = 128, nrounds = 4;
+	int i, status, failcount;
+	pid_t pids[MAXPROCS];
+	time_t s1, s2;
+	unsigned long ns1, ns2, usec, touches;
+
+	if (argc > 1) nprocs = atoi(argv[1]);
+	if (argc > 2) npages = atoi(argv[2]);
+	if (argc > 3) nrounds = atoi(argv[3]);
+	if (nprocs < 1 || nprocs > MAXPROCS) {
+		errx(1, "nprocs must be 1-%d", MAXPROCS);
+	}
+	if (npages < 1 || npages > MAXPAGES) {
+		errx(1, "npages must be 1-%d", MAXPAGES);
+	}
+	if (npages % STRIDE == 0) {
+		/* The stride wouldn't visit every page */
+		npages--;
+	}
+
+	printf("faultbench: %d processes, %d pages each (%dk total), %d rounds\n",
+	       nprocs, npages, nprocs * npages * PAGE_SIZE / 1024, nrounds);
+
+	__time(&s1, &ns1);
+	for (i=0; i<nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			warn("fork");
+		}
+		if (pids[i] == 0) {
+			/* child */
+			go(i, npages, nrounds);
+		}
+	}
+
+	failcount = 0;
+	for (i=0; i<nprocs; i++) {
+		if (pids[i] < 0) {
+			failcount++;
+		}
+		else {
+			if (waitpid(pids[i], &status, 0) < 0) {
+				err(1, "waitpid");
+			}
+			if (status != 0) {
+				failcount++;
+			}
+		}
+	}
+	__time(&s2, &ns2);
+
+	if (failcount > 0) {
+		printf("faultbench: %d subprocesses failed\n", failcount);
+		return 1;
+	}
+
+	usec = elapsed_usec(s1, ns1, s2, ns2);
+	touches = (unsigned long) nprocs * npages * nrounds * 2;
+	printf("faultbench: %lu page touches in %lu us, %lu touches/sec\n",
+	       touches, usec, (touches * 1000) / (usec / 1000 + 1));
+	return 0;
+}
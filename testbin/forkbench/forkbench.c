@@ -0,0 +1,84 @@
+/*
+ * forkbench - fork latency benchmark.
+ *
+ * Usage: forkbench [npages] [nforks] [ndirty]
+ *
+ * Touches NPAGES pages of heap, then forks NFORKS children one at a
+ * time. Each child writes to NDIRTY of the pages and exits; the parent
+ * waits for it. Prints the average time per fork+exit+wait.
+ *
+ * With copy-on-write fork the cost should depend on NDIRTY rather than
+ * NPAGES. Run "vs" at the kernel menu afterwards to see how many pages
+ * fork shared and how many were actually copied.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE_SIZE 4096
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int npages = 64, nforks = 20, ndirty = 0;
+	char *buf;
+	int i, j, pid, status;
+	time_t s1, s2;
+	unsigned long ns1, ns2, usec;
+
+	if (argc > 1) npages = atoi(argv[1]);
+	if (argc > 2) nforks = atoi(argv[2]);
+	if (argc > 3) ndirty = atoi(argv[3]);
+	if (ndirty > npages) ndirty = npages;
+
+	buf = malloc(npages * PAGE_SIZE);
+	if (buf == NULL) {
+		errx(1, "malloc of %d pages failed", npages);
+	}
+	for (i=0; i<npages; i++) {
+		buf[i * PAGE_SIZE] = (char) i;
+	}
+
+	__time(&s1, &ns1);
+	for (i=0; i<nforks; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			for (j=0; j<ndirty; j++) {
+				buf[j * PAGE_SIZE]++;
+			}
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	__time(&s2, &ns2);
+
+	/* The children's writes must not have leaked into our pages */
+	for (i=0; i<npages; i++) {
+		if (buf[i * PAGE_SIZE] != (char) i) {
+			errx(1, "page %d changed under us", i);
+		}
+	}
+
+	usec = elapsed_usec(s1, ns1, s2, ns2);
+	printf("forkbench: %d pages resident, %d dirtied per child\n",
+	       npages, ndirty);
+	printf("forkbench: %d forks in %lu us, %lu us per fork+exit+wait\n",
+	       nforks, usec, usec / nforks);
+	return 0;
+}
@@ -581,6 +581,78 @@ test7(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Test 8: grow and shrink the heap directly with sbrk.
+ *
+ * Repeatedly grows the heap by SBRKPAGES pages, writes to all of them,
+ * and gives them back with a negative sbrk. If shrinking the heap
+ * returns the pages to the system, each round gets the same physical
+ * memory back and nothing has to go to swap; if it doesn't, the
+ * kernel runs out of memory after a few rounds and starts paging.
+ * Prints the time per round; "vs" at the kernel menu shows how many
+ * heap pages were freed.
+ *
+ * Only the memory above the break at the start is touched, so this
+ * doesn't get in the way of malloc.
+ */
+
+#define SBRKPAGES	128
+#define SBRKROUNDS	32
+#define SBRK_PAGE_SIZE	4096
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+static
+void
+test8(void)
+{
+	char *base, *x;
+	int round, i;
+	time_t s1, s2;
+	unsigned long ns1, ns2, usec;
+
+	printf("Beginning malloc test 8\n");
+
+	base = sbrk(0);
+	__time(&s1, &ns1);
+	for (round=0; round<SBRKROUNDS; round++) {
+		x = sbrk(SBRKPAGES * SBRK_PAGE_SIZE);
+		if (x != base) {
+			printf("FAILED: sbrk(%d) returned %p, expected %p\n",
+			       SBRKPAGES * SBRK_PAGE_SIZE, x, base);
+			return;
+		}
+		for (i=0; i<SBRKPAGES; i++) {
+			x[i * SBRK_PAGE_SIZE] = (char) (round + i);
+		}
+		for (i=0; i<SBRKPAGES; i++) {
+			if (x[i * SBRK_PAGE_SIZE] != (char) (round + i)) {
+				printf("FAILED: data corrupt in round %d\n",
+				       round);
+				return;
+			}
+		}
+		sbrk(-SBRKPAGES * SBRK_PAGE_SIZE);
+		if (sbrk(0) != base) {
+			printf("FAILED: heap didn't shrink back\n");
+			return;
+		}
+	}
+	__time(&s2, &ns2);
+
+	usec = elapsed_usec(s1, ns1, s2, ns2);
+	printf("%d rounds of %d pages: %lu us, %lu us per round\n",
+	       SBRKROUNDS, SBRKPAGES, usec, usec / SBRKROUNDS);
+	printf("Passed malloc test 8.\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static struct {
 	int num;
 	const char *desc;
@@ -593,6 +665,7 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "sbrk grow/shrink benchmark", test8 },
 	{ -1, NULL, NULL }
 };
 
@@ -0,0 +1,198 @@
+/*
+ * mmapbench - read() versus mmap() throughput.
+ *
+ * Usage: mmapbench filename [size] [rounds]
+ *
+ * Creates FILENAME, SIZE bytes long (like bigfile does), then reads all
+ * of it ROUNDS times with read() into a buffer, and ROUNDS times by
+ * mapping it with mmap() and looking at the pages directly, and prints
+ * the throughput of each. Both add up every byte, so they have to
+ * agree.
+ *
+ * Then it maps the file MAP_SHARED, changes a byte in every page,
+ * unmaps it, and reads the file back to check the changes got there.
+ *
+ * Run "vs" at the kernel menu afterwards for the mmap fault and
+ * write-back counts.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE_SIZE	4096
+
+static char buf[PAGE_SIZE];
+
+static
+char
+pattern(int pos)
+{
+	return (char) (pos * 7 + pos / PAGE_SIZE);
+}
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+static
+void
+report(const char *what, int size, int rounds, unsigned long usec)
+{
+	printf("mmapbench: %-5s %d rounds in %lu us, %lu KB/sec\n", what,
+	       rounds, usec,
+	       ((unsigned long) size * rounds / 1024) * 1000 / (usec / 1000 + 1));
+}
+
+static
+void
+makefile(const char *filename, int size)
+{
+	int fd, pos, i, len;
+
+	fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s: create", filename);
+	}
+	for (pos = 0; pos < size; pos += len) {
+		len = size - pos;
+		if (len > PAGE_SIZE) len = PAGE_SIZE;
+		for (i=0; i<len; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		if (write(fd, buf, len) != len) {
+			err(1, "%s: write", filename);
+		}
+	}
+	close(fd);
+}
+
+static
+unsigned long
+sum_read(int fd, int size)
+{
+	unsigned long sum = 0;
+	int pos, i, len;
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	for (pos = 0; pos < size; pos += len) {
+		len = read(fd, buf, PAGE_SIZE);
+		if (len <= 0) {
+			err(1, "read");
+		}
+		for (i=0; i<len; i++) {
+			sum += (unsigned char) buf[i];
+		}
+	}
+	return sum;
+}
+
+static
+unsigned long
+sum_mmap(int fd, int size)
+{
+	unsigned long sum = 0;
+	char *p;
+	int i;
+
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	for (i=0; i<size; i++) {
+		sum += (unsigned char) p[i];
+	}
+	if (munmap(p, size)) {
+		err(1, "munmap");
+	}
+	return sum;
+}
+
+/* Change the first byte of every page through a shared mapping */
+static
+void
+write_shared(int fd, int size)
+{
+	char *p;
+	int pos;
+
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap shared");
+	}
+	for (pos = 0; pos < size; pos += PAGE_SIZE) {
+		p[pos] = ~pattern(pos);
+	}
+	if (munmap(p, size)) {
+		err(1, "munmap shared");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filename;
+	int size = 512 * 1024, rounds = 4;
+	int fd, i, pos;
+	unsigned long rsum, msum;
+	time_t s1, s2;
+	unsigned long ns1, ns2;
+
+	if (argc < 2) {
+		errx(1, "Usage: mmapbench filename [size] [rounds]");
+	}
+	filename = argv[1];
+	if (argc > 2) size = atoi(argv[2]);
+	if (argc > 3) rounds = atoi(argv[3]);
+	if (size < 1 || rounds < 1) {
+		errx(1, "size and rounds must be positive");
+	}
+
+	printf("mmapbench: %d bytes, %d rounds\n", size, rounds);
+	makefile(filename, size);
+
+	fd = open(filename, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s", filename);
+	}
+
+	__time(&s1, &ns1);
+	for (i=0; i<rounds; i++) {
+		rsum = sum_read(fd, size);
+	}
+	__time(&s2, &ns2);
+	report("read", size, rounds, elapsed_usec(s1, ns1, s2, ns2));
+
+	__time(&s1, &ns1);
+	for (i=0; i<rounds; i++) {
+		msum = sum_mmap(fd, size);
+	}
+	__time(&s2, &ns2);
+	report("mmap", size, rounds, elapsed_usec(s1, ns1, s2, ns2));
+
+	if (rsum != msum) {
+		errx(1, "FAILED: read() sum %lu, mmap() sum %lu", rsum, msum);
+	}
+
+	write_shared(fd, size);
+	for (pos = 0; pos < size; pos += PAGE_SIZE) {
+		if (lseek(fd, pos, SEEK_SET) < 0 || read(fd, buf, 1) != 1) {
+			err(1, "%s: read back", filename);
+		}
+		if (buf[0] != (char) ~pattern(pos)) {
+			errx(1, "FAILED: change at offset %d didn't reach the file",
+			     pos);
+		}
+	}
+	printf("mmapbench: shared mapping changes written back\n");
+
+	close(fd);
+	return 0;
+}
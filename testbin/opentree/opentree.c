@@ -0,0 +1,242 @@
+/*
+ * opentree - open() benchmark over a big directory tree.
+ *
+ * Usage: opentree [nprocs [rounds]]
+ *
+ * Builds a tree like the one dirconc plays in, with directories named
+ * aaaa..dddd three deep and NFILES files in each of the bottom ones
+ * (1024 files in all). Then forks NPROCS processes (8 by default) that
+ * each open every file ROUNDS times (4 by default), keeping the last
+ * KEEPOPEN of them open as they go so the kernel has plenty of vnodes
+ * loaded at once. Prints how long that took and the opens per second,
+ * and removes the tree again.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define TESTDIR   "opentree"
+#define NNAMES    4
+#define NFILES    16
+#define KEEPOPEN  16	/* a process can have 20 files open */
+#define NAMESIZE  64
+
+#define NLEAVES   (NNAMES * NNAMES * NNAMES)
+#define NTOTAL    (NLEAVES * NFILES)
+
+#define MAXPROCS  32
+
+static const char *const names[NNAMES] = {
+	"aaaa",
+	"bbbb",
+	"cccc",
+	"dddd",
+};
+
+static
+void
+leafname(char *buf, size_t len, int leaf)
+{
+	snprintf(buf, len, "%s/%s/%s/%s", TESTDIR,
+		 names[leaf / (NNAMES * NNAMES)],
+		 names[(leaf / NNAMES) % NNAMES],
+		 names[leaf % NNAMES]);
+}
+
+static
+void
+filename(char *buf, size_t len, int n)
+{
+	char dir[NAMESIZE];
+
+	leafname(dir, sizeof(dir), n / NFILES);
+	snprintf(buf, len, "%s/f%d", dir, n % NFILES);
+}
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+////////////////////////////////////////////////////////////
+
+static
+void
+domkdir(const char *path)
+{
+	if (mkdir(path, 0775) < 0) {
+		err(1, "%s: mkdir", path);
+	}
+}
+
+static
+void
+maketree(void)
+{
+	char buf[NAMESIZE];
+	int i, j, k, n, fd;
+
+	domkdir(TESTDIR);
+	for (i=0; i<NNAMES; i++) {
+		snprintf(buf, sizeof(buf), "%s/%s", TESTDIR, names[i]);
+		domkdir(buf);
+		for (j=0; j<NNAMES; j++) {
+			snprintf(buf, sizeof(buf), "%s/%s/%s", TESTDIR,
+				 names[i], names[j]);
+			domkdir(buf);
+			for (k=0; k<NNAMES; k++) {
+				snprintf(buf, sizeof(buf), "%s/%s/%s/%s",
+					 TESTDIR, names[i], names[j], names[k]);
+				domkdir(buf);
+			}
+		}
+	}
+
+	for (n=0; n<NTOTAL; n++) {
+		filename(buf, sizeof(buf), n);
+		fd = open(buf, O_WRONLY|O_CREAT|O_TRUNC);
+		if (fd < 0) {
+			err(1, "%s: create", buf);
+		}
+		close(fd);
+	}
+}
+
+static
+void
+removetree(void)
+{
+	char buf[NAMESIZE];
+	int i, j, n;
+
+	for (n=0; n<NTOTAL; n++) {
+		filename(buf, sizeof(buf), n);
+		if (remove(buf) < 0) {
+			warn("%s: remove", buf);
+		}
+	}
+	for (n=0; n<NLEAVES; n++) {
+		leafname(buf, sizeof(buf), n);
+		if (rmdir(buf) < 0) {
+			warn("%s: rmdir", buf);
+		}
+	}
+	for (i=0; i<NNAMES; i++) {
+		for (j=0; j<NNAMES; j++) {
+			snprintf(buf, sizeof(buf), "%s/%s/%s", TESTDIR,
+				 names[i], names[j]);
+			if (rmdir(buf) < 0) {
+				warn("%s: rmdir", buf);
+			}
+		}
+		snprintf(buf, sizeof(buf), "%s/%s", TESTDIR, names[i]);
+		if (rmdir(buf) < 0) {
+			warn("%s: rmdir", buf);
+		}
+	}
+	if (rmdir(TESTDIR) < 0) {
+		warn("%s: rmdir", TESTDIR);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Open every file ROUNDS times. Each process starts at a different
+ * place in the tree so they aren't all in the same directory at once.
+ */
+static
+void
+opener(int me, int nprocs, int rounds)
+{
+	char buf[NAMESIZE];
+	int fds[KEEPOPEN];
+	int r, i, n, slot = 0;
+
+	for (i=0; i<KEEPOPEN; i++) {
+		fds[i] = -1;
+	}
+
+	for (r=0; r<rounds; r++) {
+		for (i=0; i<NTOTAL; i++) {
+			n = (i + me * (NTOTAL / nprocs)) % NTOTAL;
+			filename(buf, sizeof(buf), n);
+			if (fds[slot] >= 0) {
+				close(fds[slot]);
+			}
+			fds[slot] = open(buf, O_RDONLY);
+			if (fds[slot] < 0) {
+				err(1, "%s", buf);
+			}
+			slot = (slot + 1) % KEEPOPEN;
+		}
+	}
+
+	for (i=0; i<KEEPOPEN; i++) {
+		if (fds[i] >= 0) {
+			close(fds[i]);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nprocs = 8, rounds = 4;
+	int pids[MAXPROCS];
+	int i, status, failed = 0;
+	time_t s1, s2;
+	unsigned long ns1, ns2, usec, nopens;
+
+	if (argc > 1) nprocs = atoi(argv[1]);
+	if (argc > 2) rounds = atoi(argv[2]);
+	if (nprocs < 1 || nprocs > MAXPROCS) {
+		errx(1, "nprocs must be 1-%d", MAXPROCS);
+	}
+	if (rounds < 1) {
+		errx(1, "rounds must be at least 1");
+	}
+
+	printf("opentree: creating %d files\n", NTOTAL);
+	maketree();
+
+	__time(&s1, &ns1);
+	for (i=0; i<nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			opener(i, nprocs, rounds);
+			_exit(0);
+		}
+	}
+	for (i=0; i<nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (status != 0) {
+			failed = 1;
+		}
+	}
+	__time(&s2, &ns2);
+
+	usec = elapsed_usec(s1, ns1, s2, ns2);
+	nopens = (unsigned long) nprocs * rounds * NTOTAL;
+	printf("opentree: %d processes did %lu opens in %lu us "
+	       "(%lu opens/sec)\n", nprocs, nopens, usec,
+	       (nopens * 1000) / (usec / 1000 + 1));
+
+	removetree();
+	if (failed) {
+		errx(1, "an opener failed");
+	}
+	return 0;
+}
@@ -9,5 +9,6 @@ stacktest.o: \
  $(OSTREE)/include/kern/ioctl.h \
  $(OSTREE)/include/stdlib.h \
  $(OSTREE)/include/stdio.h \
- $(OSTREE)/include/stdarg.h
+ $(OSTREE)/include/stdarg.h \
+ $(OSTREE)/include/err.h
 
@@ -1,26 +1,102 @@
+/*
+ * stacktest - stack growth test and benchmark.
+ *
+ * Usage: stacktest [depth] [rounds]
+ *
+ * Recurses DEPTH levels, with each call putting FRAMESIZE bytes of its
+ * own on the stack and writing to all of them, and then checks the
+ * data on the way back up. The first round takes a fault for every new
+ * stack page; the later rounds run over pages that are already mapped,
+ * so the difference between them is the cost of growing the stack.
+ *
+ * The kernel limits the stack to 1MB (USER_STACK_MAX); a depth much
+ * beyond 4000 runs past it, and the process should then be killed by
+ * a clean fault rather than the kernel panicking.
+ */
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <err.h>
 
-static int n = 4000;
+#define PAGE_SIZE	4096
+#define FRAMESIZE	240
 
+static int depth = 2000;
+static char *deepest;
 
-void
-foo(int i)
+static
+int
+recurse(int i)
 {
-        if (i <= 0)
-                return;
-        printf("calling foo: n-i = %d, &i = 0x%x\n", n-i, (unsigned int)&i);
-        foo(i-1);
+	volatile char frame[FRAMESIZE];
+	int j, ok;
+
+	for (j=0; j<FRAMESIZE; j++) {
+		frame[j] = (char) (i + j);
+	}
+	if ((char *) frame < deepest) {
+		deepest = (char *) frame;
+	}
+
+	ok = (i <= 1) ? 1 : recurse(i-1);
+
+	for (j=0; j<FRAMESIZE; j++) {
+		if (frame[j] != (char) (i + j)) {
+			ok = 0;
+		}
+	}
+	return ok;
+}
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
 }
 
 int
 main(int argc, char *argv[])
 {
-	if (argc > 1) {
-                n = atoi(argv[1]);
-        }
-        printf("n = %d\n", n);
-        foo(n);
+	int rounds = 4, i;
+	char top;
+	time_t s1, s2;
+	unsigned long ns1, ns2, first, warm, pages;
+
+	if (argc > 1) depth = atoi(argv[1]);
+	if (argc > 2) rounds = atoi(argv[2]);
+	if (depth < 1 || rounds < 2) {
+		errx(1, "Usage: stacktest [depth] [rounds >= 2]");
+	}
+
+	printf("stacktest: depth %d, %d rounds\n", depth, rounds);
+	deepest = &top;
+
+	__time(&s1, &ns1);
+	if (!recurse(depth)) {
+		errx(1, "stack data corrupt in round 0");
+	}
+	__time(&s2, &ns2);
+	first = elapsed_usec(s1, ns1, s2, ns2);
+
+	__time(&s1, &ns1);
+	for (i=1; i<rounds; i++) {
+		if (!recurse(depth)) {
+			errx(1, "stack data corrupt in round %d", i);
+		}
+	}
+	__time(&s2, &ns2);
+	warm = elapsed_usec(s1, ns1, s2, ns2) / (rounds - 1);
+
+	pages = (&top - deepest) / PAGE_SIZE + 1;
+	printf("stacktest: stack grew by %lu bytes (%lu pages)\n",
+	       (unsigned long) (&top - deepest), pages);
+	printf("stacktest: first round %lu us, warm rounds %lu us each\n",
+	       first, warm);
+	if (first > warm) {
+		printf("stacktest: %lu us per stack page fault\n",
+		       (first - warm) / pages);
+	}
 	return 0;
 }
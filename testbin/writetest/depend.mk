@@ -1,4 +1,3 @@
-
 writetest.o: \
  writetest.c \
  $(OSTREE)/include/unistd.h \
@@ -6,5 +5,9 @@ writetest.o: \
  $(OSTREE)/include/machine/types.h \
  $(OSTREE)/include/kern/types.h \
  $(OSTREE)/include/kern/unistd.h \
- $(OSTREE)/include/kern/ioctl.h
-
+ $(OSTREE)/include/kern/ioctl.h \
+ $(OSTREE)/include/fcntl.h \
+ $(OSTREE)/include/stdio.h \
+ $(OSTREE)/include/stdarg.h \
+ $(OSTREE)/include/stdlib.h \
+ $(OSTREE)/include/err.h
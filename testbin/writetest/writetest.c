@@ -1,14 +1,123 @@
 /*
  * writetest - test write()
+ *
+ * With no arguments, checks that a zero-length write() works.
+ *
+ * Usage: writetest file [nwrites [size]]
+ *
+ * is a small-write benchmark: it writes NWRITES chunks of SIZE bytes
+ * (2000 of 100 by default) to FILE one write() at a time, so most of
+ * them only cover part of a disk block, fsync()s it, and then reads it
+ * back to check it. Prints how long the writes and the fsync took.
+ *
+ * Run "bc" at the kernel menu afterwards for the buffer cache counts.
  */
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define MAXSIZE		4096
+
+static char buf[MAXSIZE];
+
+static
+char
+pattern(int chunk, int i)
+{
+	return (char) ('a' + (chunk * 7 + i) % 26);
+}
+
+static
+unsigned long
+elapsed_usec(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (s2 - s1) * 1000000 + (ns2 / 1000) - (ns1 / 1000);
+}
+
+static
+void
+bench(const char *file, int nwrites, int size)
+{
+	int fd, chunk, i, r;
+	time_t s1, s2, s3;
+	unsigned long ns1, ns2, ns3, wusec, susec;
+
+	fd = open(file, O_WRONLY|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+
+	__time(&s1, &ns1);
+	for (chunk=0; chunk<nwrites; chunk++) {
+		for (i=0; i<size; i++) {
+			buf[i] = pattern(chunk, i);
+		}
+		r = write(fd, buf, size);
+		if (r < 0) {
+			err(1, "%s: write", file);
+		}
+		if (r != size) {
+			errx(1, "%s: short write (%d of %d)", file, r, size);
+		}
+	}
+	__time(&s2, &ns2);
+	if (fsync(fd) < 0) {
+		err(1, "%s: fsync", file);
+	}
+	__time(&s3, &ns3);
+	close(fd);
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+	for (chunk=0; chunk<nwrites; chunk++) {
+		r = read(fd, buf, size);
+		if (r < 0) {
+			err(1, "%s: read", file);
+		}
+		if (r != size) {
+			errx(1, "%s: short read (%d of %d)", file, r, size);
+		}
+		for (i=0; i<size; i++) {
+			if (buf[i] != pattern(chunk, i)) {
+				errx(1, "%s: byte %d of write %d is wrong",
+				     file, i, chunk);
+			}
+		}
+	}
+	close(fd);
+
+	wusec = elapsed_usec(s1, ns1, s2, ns2);
+	susec = elapsed_usec(s2, ns2, s3, ns3);
+	printf("writetest: %d writes of %d bytes in %lu us (%lu writes/sec), "
+	       "fsync %lu us\n", nwrites, size, wusec,
+	       ((unsigned long) nwrites * 1000) / (wusec / 1000 + 1), susec);
+	printf("writetest: file checks out\n");
+}
 
 int
 main(int argc, char *argv[])
 {
-	(void) argc;
-	(void) argv;
-	write(0, "testing write() - if this prints we're good.\n", 0);
+	int nwrites = 2000, size = 100;
+
+	if (argc < 2) {
+		write(0, "testing write() - if this prints we're good.\n", 0);
+		return 0;
+	}
+
+	if (argc > 2) nwrites = atoi(argv[2]);
+	if (argc > 3) size = atoi(argv[3]);
+	if (nwrites < 1) {
+		errx(1, "nwrites must be at least 1");
+	}
+	if (size < 1 || size > MAXSIZE) {
+		errx(1, "size must be 1-%d", MAXSIZE);
+	}
+
+	bench(argv[1], nwrites, size);
 	return 0;
 }